@@ -1,3 +1,10 @@
 #pragma once
 
 #include "./exprdsl/exprdsl.hpp"
+#include "./exprdsl/cache.hpp"
+#include "./exprdsl/atomic.hpp"
+#include "./exprdsl/parallel.hpp"
+#include "./exprdsl/stream.hpp"
+#include "./exprdsl/session.hpp"
+#include "./exprdsl/serialize.hpp"
+#include "./exprdsl/static_expr.hpp"
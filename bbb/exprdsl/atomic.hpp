@@ -0,0 +1,124 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "./exprdsl.hpp"
+
+namespace bbb {
+
+namespace detail {
+// a small number fixed per thread, spreading the reader counters of atomic_expr
+inline std::size_t reader_stripe() {
+	static std::atomic<std::size_t> next{0};
+	thread_local const std::size_t stripe = next.fetch_add(1, std::memory_order_relaxed);
+	return stripe;
+}
+} // namespace detail
+
+// a compiled_expr that one thread replaces while others evaluate it. readers take no lock
+// and never wait: each read pins the current program with an increment and a decrement of
+// a counter in a cache line shared with few other threads (read-copy-update). store()
+// publishes the new program with one atomic exchange, so every read starts on either the
+// old or the new program; it then waits until the readers already on the old one have
+// left it and drops it. writers serialize on a mutex; readers never touch it.
+// a thread must not call store() while it holds a read_guard of the same atomic_expr: it
+// would wait for itself.
+class atomic_expr {
+	struct alignas(64) stripe {
+		std::atomic<std::size_t> readers[2] = {{0}, {0}}; // by the epoch read on entry
+	};
+
+public:
+	// threads hashed onto reader counters; more threads than this share lines
+	static constexpr std::size_t reader_stripes = 64;
+
+	// keeps one program alive for its lifetime and reads through to it; not shared between
+	// threads. long-lived guards hold up store(), so keep each to a call or a batch
+	class read_guard {
+	public:
+		read_guard(read_guard &&o) noexcept : count_(o.count_), e_(o.e_) { o.count_ = nullptr; }
+		read_guard(const read_guard &) = delete;
+		read_guard &operator=(const read_guard &) = delete;
+		read_guard &operator=(read_guard &&) = delete;
+		~read_guard() {
+			if (count_) count_->fetch_sub(1, std::memory_order_release);
+		}
+
+		const compiled_expr &operator*() const { return *e_; }
+		const compiled_expr *operator->() const { return e_; }
+
+	private:
+		friend class atomic_expr;
+		read_guard(std::atomic<std::size_t> *count, const compiled_expr *e) : count_(count), e_(e) {}
+
+		std::atomic<std::size_t> *count_;
+		const compiled_expr *e_;
+	};
+
+	explicit atomic_expr(compiled_expr e = compiled_expr{}) : cur_(new compiled_expr(std::move(e))) {}
+	atomic_expr(const atomic_expr &) = delete;
+	atomic_expr &operator=(const atomic_expr &) = delete;
+	// no reader may be left
+	~atomic_expr() { delete cur_.load(std::memory_order_relaxed); }
+
+	// pins the current program, e.g. for eval_batch: `auto g = a.read(); g->eval_batch(...)`
+	read_guard read() const {
+		std::atomic<std::size_t> &count =
+			stripes_[detail::reader_stripe() % reader_stripes].readers[epoch_.load(std::memory_order_relaxed)];
+		// seq_cst: store() either sees this reader or published before it loads cur_
+		count.fetch_add(1, std::memory_order_seq_cst);
+		return read_guard(&count, cur_.load(std::memory_order_seq_cst));
+	}
+
+	double operator()(double x, double y, double z, double w) const {
+		const read_guard g = read();
+		return (*g)(x, y, z, w);
+	}
+	double eval(const double *record) const {
+		const read_guard g = read();
+		return g->eval(record);
+	}
+
+	// a copy of the current program handle, for readers that keep it
+	compiled_expr load() const { return *read(); }
+
+	// publishes e, then returns once no read still uses the program it replaced
+	void store(compiled_expr e) { exchange(std::move(e)); }
+
+	// store() returning the program replaced
+	compiled_expr exchange(compiled_expr e) {
+		std::unique_ptr<compiled_expr> next(new compiled_expr(std::move(e)));
+		std::lock_guard<std::mutex> lk(writer_);
+		std::unique_ptr<compiled_expr> old(cur_.exchange(next.release(), std::memory_order_seq_cst));
+		synchronize();
+		return std::move(*old);
+	}
+
+private:
+	std::atomic<compiled_expr *> cur_;
+	std::atomic<std::size_t> epoch_{0}; // which counter of a stripe new readers take
+	mutable stripe stripes_[reader_stripes];
+	std::mutex writer_;
+
+	// waits until every read that began before the exchange of cur_ has ended. a reader
+	// can count on either side of a stripe, depending on when it read epoch_, so both sides
+	// are drained in turn, each after moving new readers to the other one: readers keep
+	// arriving, but none on the side being waited for, and a side once empty holds no
+	// reader of the old program (those incremented before the exchange, so store() sees them)
+	void synchronize() {
+		std::size_t side = epoch_.load(std::memory_order_relaxed);
+		for (int phase = 0; phase < 2; ++phase) {
+			epoch_.store(side ^ 1, std::memory_order_seq_cst);
+			for (stripe &s : stripes_) {
+				while (s.readers[side].load(std::memory_order_seq_cst) != 0) std::this_thread::yield();
+			}
+			side ^= 1;
+		}
+	}
+};
+
+} // namespace bbb
@@ -0,0 +1,208 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "./exprdsl.hpp"
+
+namespace bbb {
+
+struct expr_cache_stats {
+	std::uint64_t hits = 0;
+	std::uint64_t misses = 0;    // lookups that ran compile(), including failed ones
+	std::uint64_t evictions = 0;
+	std::size_t size = 0;
+};
+
+// thread-safe cache of compiled programs keyed by whitespace-normalized source text and
+// compile_options. entries are split across independently locked shards; lookups take a
+// shared lock only, so readers never serialize on each other. once a shard holds its share
+// of capacity, each miss evicts an entry not used lately (detail::clock_cache), in O(1).
+// failed compiles are not cached.
+class expr_cache {
+public:
+	using result = std::pair<std::shared_ptr<const compiled_expr>, std::optional<compile_error>>;
+
+	explicit expr_cache(std::size_t capacity = 4096, std::size_t shards = 16)
+		: shards_(shards ? shards : 1), capacity_(capacity) {
+		shard_capacity_ = (capacity_ + shards_.size() - 1) / shards_.size();
+		if (shard_capacity_ == 0) shard_capacity_ = 1;
+		for (shard &s : shards_) s.map.set_capacity(shard_capacity_);
+	}
+
+	expr_cache(const expr_cache &) = delete;
+	expr_cache &operator=(const expr_cache &) = delete;
+
+	// same as bbb::compile, but shares one immutable program per distinct (source, options).
+	// a hit returns the program compiled from the first spelling seen, so its expr()
+	// may differ from src in whitespace.
+	result compile(std::string_view src, const compile_options &opts = compile_options{}) {
+		std::string key = make_key(src, opts);
+		shard &s = shard_for(key);
+		{
+			std::shared_lock<std::shared_mutex> lk(s.mutex);
+			if (const std::shared_ptr<const compiled_expr> *hit = s.map.find(key)) {
+				s.hits.fetch_add(1, std::memory_order_relaxed);
+				return {*hit, std::nullopt};
+			}
+		}
+
+		s.misses.fetch_add(1, std::memory_order_relaxed);
+		auto [e, err] = bbb::compile(src, opts); // outside the lock: other keys stay available
+		if (err) return {nullptr, std::move(err)};
+		auto value = std::make_shared<const compiled_expr>(std::move(e));
+
+		std::unique_lock<std::shared_mutex> lk(s.mutex);
+		const auto put = s.map.insert(std::move(key), value); // the value found if another thread compiled it first
+		if (put.evicted) s.evictions.fetch_add(1, std::memory_order_relaxed);
+		return {*put.value, std::nullopt};
+	}
+
+	expr_cache_stats stats() const {
+		expr_cache_stats st;
+		for (const shard &s : shards_) {
+			st.hits += s.hits.load(std::memory_order_relaxed);
+			st.misses += s.misses.load(std::memory_order_relaxed);
+			st.evictions += s.evictions.load(std::memory_order_relaxed);
+			std::shared_lock<std::shared_mutex> lk(s.mutex);
+			st.size += s.map.size();
+		}
+		return st;
+	}
+
+	std::size_t size() const { return stats().size; }
+	std::size_t capacity() const { return capacity_; }
+
+	// drops every entry; programs already handed out stay alive through their shared_ptr
+	void clear() {
+		for (shard &s : shards_) {
+			std::unique_lock<std::shared_mutex> lk(s.mutex);
+			s.map.clear();
+		}
+	}
+
+	// canonical spelling of src: whitespace runs dropped where no token can span them and
+	// squeezed to one space elsewhere (e.g. "1 .5", "1e +5", "< ="), so every spelling that
+	// only differs in whitespace gets the same normal form and lexes to the same tokens.
+	static std::string normalize(std::string_view src) {
+		std::string out(src.size(), '\0');
+		std::size_t n = 0;
+		bool gap = false;
+		for (char c : src) {
+			if (is_space(c)) {
+				gap = true;
+				continue;
+			}
+			if (gap && n && joins(out.data(), n, c)) out[n++] = ' ';
+			gap = false;
+			out[n++] = c;
+		}
+		out.resize(n);
+		return out;
+	}
+
+private:
+	struct alignas(64) shard {
+		mutable std::shared_mutex mutex;
+		detail::clock_cache<std::shared_ptr<const compiled_expr>> map;
+		std::atomic<std::uint64_t> hits{0}, misses{0}, evictions{0};
+	};
+
+	std::vector<shard> shards_;
+	std::size_t capacity_;
+	std::size_t shard_capacity_;
+
+	// the lexer's character classes in the "C" locale, without the locale lookup
+	static bool is_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+	static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+	static bool is_word(char c) {
+		return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '.' || c == '$';
+	}
+	static bool is_op(char c) {
+		return c == '&' || c == '|' || c == '=' || c == '!' || c == '<' || c == '>';
+	}
+	// first and second character of a two-character operator: && || == != <= >=
+	static bool is_op_pair(char a, char c) {
+		return (a == '&' && c == '&') || (a == '|' && c == '|') || (is_op(a) && c == '=');
+	}
+	// would removing the whitespace between out[0, n) and c let one token span both sides?
+	static bool joins(const char *out, std::size_t n, char c) {
+		const char a = out[n - 1];
+		if ((is_word(a) && is_word(c)) || is_op_pair(a, c)) return true; // names, numbers, && <= ...
+		if ((a == 'e' || a == 'E') && (c == '+' || c == '-')) return true;     // exponent sign
+		if ((a == '+' || a == '-') && is_digit(c) && n >= 2) {
+			const char e = out[n - 2];
+			return e == 'e' || e == 'E'; // exponent digits
+		}
+		return false;
+	}
+
+	// options fingerprint + ':' + normal form
+	static std::string make_key(std::string_view src, const compile_options &opts) {
+		std::string key;
+		key.push_back(static_cast<char>('0' + static_cast<int>(opts.backend)));
+		key.push_back(opts.jit ? 'j' : '-');
+		key.push_back(opts.fast_math ? 'f' : '-');
+		key.push_back(opts.profile ? 'p' : '-');
+		if (opts.tier_up) key.append(std::to_string(opts.tier_up)).push_back('t');
+		if (opts.vars) { // size#name=slot, ... /stride: unambiguous even for names compile() rejects
+			for (const var_schema::var &v : opts.vars->vars()) {
+				key.append(std::to_string(v.name.size()));
+				key.push_back('#');
+				key.append(v.name);
+				key.push_back('=');
+				key.append(std::to_string(v.slot));
+				key.push_back(',');
+			}
+			key.push_back('/');
+			key.append(std::to_string(opts.vars->stride()));
+		}
+		if (opts.ranges) { // ~size#name=lo..hi, ... with the bounds' bit patterns
+			key.push_back('~');
+			for (const range_hints::range &r : opts.ranges->ranges()) {
+				std::uint64_t lo, hi;
+				std::memcpy(&lo, &r.lo, sizeof lo);
+				std::memcpy(&hi, &r.hi, sizeof hi);
+				key.append(std::to_string(r.name.size()));
+				key.push_back('#');
+				key.append(r.name);
+				key.push_back('=');
+				key.append(std::to_string(lo)).append("..").append(std::to_string(hi));
+				key.push_back(',');
+			}
+		}
+		if (opts.bound) { // =size#name=bits, ...
+			key.push_back('=');
+			for (const var_bindings::binding &b : opts.bound->bindings()) {
+				std::uint64_t bits;
+				std::memcpy(&bits, &b.value, sizeof bits);
+				key.append(std::to_string(b.name.size()));
+				key.push_back('#');
+				key.append(b.name);
+				key.push_back('=');
+				key.append(std::to_string(bits));
+				key.push_back(',');
+			}
+		}
+		key.push_back(':');
+		key.append(normalize(src));
+		return key;
+	}
+
+	shard &shard_for(const std::string &key) {
+		return shards_[std::hash<std::string>{}(key) % shards_.size()];
+	}
+};
+
+} // namespace bbb
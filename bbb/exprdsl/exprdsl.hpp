@@ -1,39 +1,632 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <charconv>
 #include <cmath>
-#include <cctype>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <initializer_list>
 #include <limits>
+#include <memory>
+#include <new>
+#include <mutex>
 #include <optional>
-#include <stdexcept>
+#include <shared_mutex>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "./jit.hpp"
+#include "./lane_kernels.hpp"
+
+// direct-threaded vm_eval dispatch (labels as values); define BBB_EXPRDSL_NO_THREADED for the switch loop
+#if !defined(BBB_EXPRDSL_NO_THREADED) && (defined(__GNUC__) || defined(__clang__))
+#	define BBB_EXPRDSL_THREADED 1
+#endif
+
 namespace bbb {
-namespace detail { class bytecode_compiler; }
+namespace detail {
+class bytecode_compiler;
+class register_compiler;
+class jit_compiler;
+class program_io;
+class bytecode_verifier;
+struct branch_hints;
+template <class T> inline T eval_func(int fid, T a);
+template <class T> inline T eval_func(int fid, T a, T b);
+
+// read-only view of n contiguous Ts owned by someone else
+template <class T>
+struct const_span {
+	const T *ptr = nullptr;
+	std::size_t n = 0;
+
+	const T *data() const { return ptr; }
+	std::size_t size() const { return n; }
+	bool empty() const { return n == 0; }
+	const T &operator[](std::size_t i) const { return ptr[i]; }
+	const T *begin() const { return ptr; }
+	const T *end() const { return ptr + n; }
+};
+}
 
 // =============================
 // public api
 // =============================
 
+// kind of a compile_error, for callers that branch on it rather than on the message
+enum class compile_errc : std::uint8_t {
+	none,
+	// lexer errors (reported at pos 0)
+	expected_digit,         // '$' not followed by a digit
+	invalid_var_index,      // $n outside 1..4 (1..vars.size() with compile_options::vars)
+	invalid_number,         // '.' not followed by a digit
+	unexpected_character,
+	// parser errors
+	trailing_input,         // a complete expression followed by more tokens
+	expected_token,         // missing ':' or ')'
+	not_a_call,             // identifier not followed by '('
+	unknown_variable,       // with compile_options::vars: identifier neither a call nor a variable
+	unknown_function,
+	wrong_arity,
+	expected_primary,
+	// compile_options::vars errors (reported at pos 0)
+	invalid_schema,         // a name that is no identifier or is bound twice, or a slot past var_schema::max_slot
+	invalid_range,          // compile_options::ranges: an unknown variable, a repeated one, or lo > hi
+	invalid_binding,        // compile_options::bound: an unknown variable, or one bound twice
+	internal,               // the compiler itself failed (e.g. out of memory)
+};
+
 struct compile_error {
 	std::size_t pos = 0;   // 0-based index into the input string
 	std::string message;
+	compile_errc code = compile_errc::none;
+	std::size_t index = 0; // compile_many: the input the error is in
+};
+
+// interpreter used by compiled_expr::operator()
+enum class vm_backend : std::uint8_t {
+	stack, // stack bytecode (default)
+	reg,   // three-address register bytecode
+};
+
+class compile_context;
+class compiled_multi_expr;
+
+// named inputs for compile_options::vars. each name reads the double at record[slot] of the
+// record handed to compiled_expr::eval: a row of an interleaved buffer, or a struct of
+// doubles with slot = offsetof(T, member) / sizeof(double). eval_batch steps stride()
+// doubles from one record to the next. $1, $2, ... name the variables in the order added.
+class var_schema {
+public:
+	struct var {
+		std::string name;
+		std::size_t slot;
+	};
+
+	// slots must stay below this, so every backend can address them directly
+	static constexpr std::size_t max_slot = 16384;
+
+	var_schema() = default;
+	var_schema(std::initializer_list<var> vars, std::size_t stride = 0) : vars_(vars), stride_(stride) {}
+
+	// checked by compile(), which reports a bad schema as compile_errc::invalid_schema
+	var_schema &add(std::string name, std::size_t slot) {
+		vars_.push_back(var{std::move(name), slot});
+		return *this;
+	}
+	// doubles from one record to the next; 0 (the default) packs them at record_size()
+	var_schema &set_stride(std::size_t n) {
+		stride_ = n;
+		return *this;
+	}
+
+	const std::vector<var> &vars() const { return vars_; }
+	std::size_t size() const { return vars_.size(); }
+	// one past the highest slot: how many doubles eval() reads from a record
+	std::size_t record_size() const {
+		std::size_t n = 0;
+		for (const var &v : vars_) n = std::max(n, v.slot + 1);
+		return n;
+	}
+	std::size_t stride() const { return stride_ ? stride_ : record_size(); }
+
+	// variable called name, or nullptr
+	const var *find(std::string_view name) const {
+		for (const var &v : vars_) if (v.name == name) return &v;
+		return nullptr;
+	}
+
+private:
+	std::vector<var> vars_;
+	std::size_t stride_ = 0;
+};
+
+// known bounds of the inputs, for compile_options::ranges: every record evaluated has
+// lo <= v <= hi for each variable named, and v is not NaN. compile() then resolves the
+// comparisons and conditions those bounds decide and drops the arms they rule out, so
+// evaluating a record outside them gives unspecified results. bounds order -0 below +0:
+// [0, 1] excludes -0, [-0.0, 1] admits it. a strict bound is the next double, e.g. y > 0
+// is add("y", std::nextafter(0.0, 1.0), inf).
+class range_hints {
+public:
+	struct range {
+		std::string name; // x y z w, or a compile_options::vars name
+		double lo, hi;
+	};
+
+	range_hints() = default;
+	range_hints(std::initializer_list<range> ranges) : ranges_(ranges) {}
+
+	// checked by compile(), which reports an unknown name or lo > hi as compile_errc::invalid_range
+	range_hints &add(std::string name, double lo, double hi) {
+		ranges_.push_back(range{std::move(name), lo, hi});
+		return *this;
+	}
+
+	const std::vector<range> &ranges() const { return ranges_; }
+	std::size_t size() const { return ranges_.size(); }
+
+private:
+	std::vector<range> ranges_;
+};
+
+// variables fixed to a value, for compile_options::bound and compiled_expr::specialize: each
+// read of one is that constant, which then folds like a literal. the program still takes
+// records of the same layout and leaves the bound slots unread.
+class var_bindings {
+public:
+	struct binding {
+		std::string name; // x y z w, or a compile_options::vars name
+		double value;
+	};
+
+	var_bindings() = default;
+	var_bindings(std::initializer_list<binding> bindings) : bindings_(bindings) {}
+
+	// checked by compile(), which reports an unknown or repeated name as compile_errc::invalid_binding
+	var_bindings &add(std::string name, double value) {
+		bindings_.push_back(binding{std::move(name), value});
+		return *this;
+	}
+
+	const std::vector<binding> &bindings() const { return bindings_; }
+	std::size_t size() const { return bindings_.size(); }
+
+private:
+	std::vector<binding> bindings_;
+};
+
+struct compile_options {
+	vm_backend backend = vm_backend::stack;
+	// also lower to native code where supported (see compiled_expr::native_function)
+	bool jit = false;
+	// value-changing rewrites (reassociation, strength reduction, fma contraction); results
+	// may differ from the default in rounding, signed zeros and NaN/inf edge cases
+	bool fast_math = false;
+	// named inputs; nullptr keeps x y z w ($1..$4) at record slots 0..3. only read during
+	// compile(): the slots are baked into the program.
+	const var_schema *vars = nullptr;
+	// known input bounds (see range_hints); only read during compile()
+	const range_hints *ranges = nullptr;
+	// variables replaced by constants (see var_bindings); only read during compile()
+	const var_bindings *bound = nullptr;
+	// count what operator() and eval() execute (see compiled_expr::profile). profiled programs
+	// always run the stack bytecode and get no native code; eval_batch is not counted.
+	bool profile = false;
+	// tiered recompilation: profile, and after this many evaluations recompile with the
+	// branch outcomes seen so far (see compiled_expr::reoptimize); 0: only on request.
+	// compile_many programs are profiled but never recompiled.
+	std::uint64_t tier_up = 0;
+};
+
+// what a compile_options::profile program has executed, from compiled_expr::profile()
+struct expr_profile {
+	struct op_count {
+		std::string_view op;
+		std::uint64_t count;
+	};
+	struct call_count {
+		std::string_view func;
+		std::uint64_t count;
+	};
+	// a conditional jump (jz or a fused compare-and-jump) at code position pc. taken counts
+	// the jumps to its target, i.e. the condition was false: the else arm of ?:, the
+	// short-circuit of &&.
+	struct branch {
+		std::size_t pc;
+		std::string_view op;
+		std::uint64_t executed;
+		std::uint64_t taken;
+
+		double taken_ratio() const { return executed ? static_cast<double>(taken) / static_cast<double>(executed) : 0.0; }
+	};
+
+	std::uint64_t evals = 0;        // operator() / eval() calls
+	std::uint64_t instructions = 0; // bytecode instructions executed by them, op::end included
+	std::size_t max_depth = 0;      // deepest evaluation stack, locals excluded
+	std::vector<op_count> ops;      // executed opcodes, most frequent first
+	std::vector<branch> branches;   // every conditional jump in code order, executed or not
+	std::vector<call_count> calls;  // function calls by function (op::call and call_*), most frequent first
+
+	// multi-line text dump of the above
+	std::string to_string() const {
+		std::string s = "evals " + std::to_string(evals) + ", instructions " + std::to_string(instructions) +
+		                ", max depth " + std::to_string(max_depth) + "\n";
+		for (const op_count &o : ops) s.append("  op ").append(o.op).append(" ").append(std::to_string(o.count)).append("\n");
+		for (const branch &b : branches) {
+			s.append("  branch @").append(std::to_string(b.pc)).append(" ").append(b.op).append(" taken ");
+			s.append(std::to_string(b.taken)).append(" of ").append(std::to_string(b.executed)).append("\n");
+		}
+		for (const call_count &c : calls) s.append("  call ").append(c.func).append(" ").append(std::to_string(c.count)).append("\n");
+		return s;
+	}
+};
+
+namespace detail {
+// counters behind compile_options::profile, one per program and shared by its copies.
+// relaxed atomics: threads evaluating the same expression all count, in no particular order.
+struct profile_counters {
+	// a conditional jump and the cse value number of the ?: && || it implements
+	struct site {
+		std::size_t pc;
+		std::uint32_t node;
+	};
+
+	explicit profile_counters(std::size_t code_size) : hits(code_size), taken(code_size) {}
+
+	std::vector<std::atomic<std::uint64_t>> hits;  // executions of each code entry
+	std::vector<std::atomic<std::uint64_t>> taken; // conditional jumps that went to their target
+	std::vector<site> sites;
+	std::atomic<std::uint64_t> evals{0};
+	std::atomic<std::size_t> max_depth{0};
+
+	void finish(std::size_t depth) {
+		evals.fetch_add(1, std::memory_order_relaxed);
+		std::size_t m = max_depth.load(std::memory_order_relaxed);
+		while (m < depth && !max_depth.compare_exchange_weak(m, depth, std::memory_order_relaxed)) {}
+	}
+	void clear() {
+		for (std::atomic<std::uint64_t> &h : hits) h.store(0, std::memory_order_relaxed);
+		for (std::atomic<std::uint64_t> &t : taken) t.store(0, std::memory_order_relaxed);
+		evals.store(0, std::memory_order_relaxed);
+		max_depth.store(0, std::memory_order_relaxed);
+	}
+};
+
+// string-keyed cache of at most capacity values, evicting with a CLOCK sweep: a hit only
+// sets the entry's referenced flag, so find() runs under a shared lock; insert() (under
+// the unique lock) passes over flagged entries, clearing them, and replaces the first one
+// not used since the hand last went by. amortized O(1) per insert however full it is.
+// locking is the caller's: find() alongside other find()s, everything else alone
+template <class V>
+class clock_cache {
+public:
+	struct insert_result {
+		const V *value; // the value stored under the key
+		bool inserted;  // false: the key was there already, value is the one found
+		bool evicted;   // another entry went to make room
+	};
+
+	explicit clock_cache(std::size_t capacity = 1) : capacity_(capacity ? capacity : 1) {}
+
+	// empty caches only
+	void set_capacity(std::size_t capacity) { capacity_ = capacity ? capacity : 1; }
+	std::size_t capacity() const { return capacity_; }
+	std::size_t size() const { return index_.size(); }
+
+	// the value under key, marked used; null if there is none
+	const V *find(const std::string &key) const {
+		auto it = index_.find(key);
+		if (it == index_.end()) return nullptr;
+		const slot &e = slots_[it->second];
+		// relaxed: recency only steers eviction. load first: a hot entry's line stays shared
+		if (!e.referenced.load(std::memory_order_relaxed)) e.referenced.store(true, std::memory_order_relaxed);
+		return &e.value;
+	}
+
+	insert_result insert(std::string key, V value) {
+		auto [it, inserted] = index_.try_emplace(std::move(key), slots_.size());
+		if (!inserted) return {&slots_[it->second].value, false, false};
+		if (slots_.size() < capacity_) {
+			slots_.emplace_back(std::move(value), &it->first);
+			return {&slots_.back().value, true, false};
+		}
+		while (slots_[hand_].referenced.load(std::memory_order_relaxed)) {
+			slots_[hand_].referenced.store(false, std::memory_order_relaxed);
+			hand_ = (hand_ + 1) % slots_.size();
+		}
+		slot &victim = slots_[hand_];
+		index_.erase(index_.find(*victim.key));
+		it->second = hand_;
+		victim.value = std::move(value);
+		victim.key = &it->first; // unordered_map keys stay put across rehashing
+		hand_ = (hand_ + 1) % slots_.size();
+		return {&victim.value, true, true};
+	}
+
+	void clear() {
+		index_.clear();
+		slots_.clear();
+		hand_ = 0;
+	}
+
+private:
+	struct slot {
+		V value;
+		const std::string *key; // in index_
+		mutable std::atomic<bool> referenced{false};
+		slot(V v, const std::string *k) : value(std::move(v)), key(k) {}
+	};
+
+	std::unordered_map<std::string, std::size_t> index_; // key -> slots_ index
+	std::deque<slot> slots_; // grows in place: slots hold atomics
+	std::size_t hand_ = 0;
+	std::size_t capacity_;
 };
+} // namespace detail
 
 struct compiled_expr {
+	// stack slots available to operator() without a caller-supplied buffer
+	static constexpr std::size_t inline_stack_size = 32;
+	// record slots operator() pads on the C++ stack when a var_schema is wider than x y z w
+	static constexpr std::size_t inline_record_size = 64;
+
+	// evaluates the record {x, y, z, w}; slots past 3 of a wider var_schema read as 0
 	double operator()(double x, double y, double z, double w) const {
-		ctx c{{x, y, z, w}};
-		return vm_eval(c);
+		const program &p = *prog_;
+		if (p.native) return p.native(x, y, z, w);
+		const double r[4] = {x, y, z, w};
+		if (p.record_size > 4) return eval_padded(r, nullptr);
+		return eval(r);
+	}
+
+	// evaluate on a caller-supplied stack of at least stack_size() doubles (no allocation)
+	double operator()(double x, double y, double z, double w, double *scratch) const {
+		const program &p = *prog_;
+		if (p.native) return p.native(x, y, z, w);
+		const double r[4] = {x, y, z, w};
+		if (p.record_size > 4) return eval_padded(r, scratch);
+		return eval(r, scratch);
+	}
+
+	// evaluates against record_size() doubles at record, read in place: each variable is
+	// record[slot] (compile_options::vars), x y z w are record[0..3]
+	double eval(const double *record) const {
+		const program &p = *prog_;
+		if (p.native_record) return p.native_record(record);
+		const ctx c{record, nullptr};
+		if (p.detour) return detour_eval(p, c, nullptr);
+		if (p.max_stack <= inline_stack_size) {
+			double st[inline_stack_size];
+			return vm_eval(p, c, st);
+		}
+		std::vector<double> st(p.max_stack); // deep program without scratch: allocate
+		return vm_eval(p, c, st.data());
+	}
+
+	// same on a caller-supplied stack of at least stack_size() doubles (no allocation)
+	double eval(const double *record, double *scratch) const {
+		const program &p = *prog_;
+		if (p.native_record) return p.native_record(record);
+		const ctx c{record, nullptr};
+		if (p.detour) return detour_eval(p, c, scratch);
+		return vm_eval(p, c, scratch);
+	}
+
+	// doubles eval() reads from a record, and from one record to the next in eval_batch
+	std::size_t record_size() const { return prog_->record_size; }
+	std::size_t record_stride() const { return prog_->record_stride; }
+	// the compile_options::vars schema the program was compiled with; empty for x y z w
+	const std::vector<var_schema::var> &vars() const { return prog_->vars; }
+
+	using native_fn = double (*)(double x, double y, double z, double w);
+	using native_record_fn = double (*)(const double *record);
+	using native_outputs_fn = void (*)(const double *record, double *out);
+
+	// machine code operator() runs when compiled with compile_options::jit, or nullptr if the
+	// platform has no JIT or lowering failed (or the record is wider than x y z w).
+	// valid while any copy of this compiled_expr lives.
+	native_fn native_function() const { return prog_->native; }
+	// the same code taking a record, as run by eval()
+	native_record_fn native_record_function() const { return prog_->native_record; }
+
+	// stack slots operator() needs: maximum evaluation depth plus the locals holding
+	// common subexpressions, both computed by the bytecode compiler, and past those the
+	// padded record when it is wider than inline_record_size
+	std::size_t stack_size() const {
+		const program &p = *prog_;
+		return p.max_stack + (p.record_size > inline_record_size ? p.record_size : 0);
+	}
+
+	// backend behind operator(); eval_batch always runs the stack bytecode
+	vm_backend backend() const { return prog_->backend; }
+
+	// length of the program operator() interprets
+	std::size_t instruction_count() const {
+		return prog_->backend == vm_backend::reg ? prog_->reg_code.size() : prog_->code.size();
+	}
+
+	// rows interpreted together by eval_batch: every opcode runs once per block of this many rows
+	static constexpr std::size_t batch_block = detail::lane_block;
+	// lane-stack slots eval_batch keeps on the C++ stack before it needs a scratch buffer
+	static constexpr std::size_t inline_batch_slots = 16;
+
+	// structure-of-arrays evaluation: out[i] = f(x[i], y[i], z[i], w[i]) for i in [0, n).
+	// a null column reads as 0 for every row, as do slots past 3 of a wider var_schema.
+	void eval_batch(const double *x, const double *y, const double *z, const double *w,
+	                double *out, std::size_t n) const {
+		if (batch_scratch_size() <= inline_batch_slots * batch_block) {
+			alignas(64) double lanes[inline_batch_slots * batch_block];
+			eval_batch(x, y, z, w, out, n, lanes);
+			return;
+		}
+		std::vector<double> lanes(batch_scratch_size());
+		eval_batch(x, y, z, w, out, n, lanes.data());
+	}
+
+	// same with a caller-supplied lane stack of at least batch_scratch_size() doubles
+	void eval_batch(const double *x, const double *y, const double *z, const double *w,
+	                double *out, std::size_t n, double *scratch) const {
+		const double *four[4] = {x, y, z, w};
+		if (prog_->record_size <= 4) {
+			run_batch(batch_input{four, nullptr, 0, nullptr, 0}, out, n, scratch);
+			return;
+		}
+		const double *inline_cols[inline_record_size];
+		const double **cols = column_table(four, prog_->record_size, inline_cols, scratch + prog_->batch_slots * batch_block);
+		run_batch(batch_input{cols, nullptr, 0, nullptr, 0}, out, n, scratch);
+	}
+
+	// array-of-structures evaluation, read in place: out[i] = eval(records + i * record_stride())
+	void eval_batch(const double *records, double *out, std::size_t n) const {
+		if (prog_->batch_slots <= inline_batch_slots) {
+			alignas(64) double lanes[inline_batch_slots * batch_block];
+			eval_batch(records, out, n, lanes);
+			return;
+		}
+		std::vector<double> lanes(batch_scratch_size());
+		eval_batch(records, out, n, lanes.data());
+	}
+
+	// same with a caller-supplied lane stack of at least batch_scratch_size() doubles
+	void eval_batch(const double *records, double *out, std::size_t n, double *scratch) const {
+		run_batch(batch_input{nullptr, records, prog_->record_stride, nullptr, 0}, out, n, scratch);
+	}
+
+	std::size_t batch_scratch_size() const {
+		return prog_->batch_slots * batch_block + column_tail<double>(prog_->record_size);
+	}
+
+	// source text this program was compiled from
+	const std::string &expr() const { return prog_->expr; }
+
+	// whether compiled with compile_options::profile
+	bool profiling() const { return prog_->counters != nullptr; }
+	// counts so far, summed over every copy of this compiled_expr and every thread; empty
+	// unless profiling()
+	expr_profile profile() const;
+	// zeroes the counts; evaluations running meanwhile may be partly counted
+	void reset_profile() const {
+		if (prog_->counters) prog_->counters->clear();
 	}
 
-	std::string expr;
+	// recompiles a profiled program with what profile() has seen: a ?: && || that nearly always
+	// goes one way is a branch with its likely arm falling through, one that goes either way
+	// becomes a select where native code runs both arms cheaply, and counting stops. with
+	// compile_options::jit the new program is native code. every copy of this compiled_expr,
+	// on every thread, switches to it atomically on its next call; eval_batch and the
+	// accessors keep describing the program compile() returned. done once, on the first call
+	// (or the evaluation reaching compile_options::tier_up); returns whether the recompiled
+	// program is in use, false for a program compiled without compile_options::profile
+	bool reoptimize() const { return prog_->tier && tier_up(*prog_); }
+	bool reoptimized() const { return prog_->tier && prog_->tier->next.load(std::memory_order_acquire); }
+
+	// this expression with the variables in b fixed to their values, e.g. a parameter that
+	// changes per tenant while the others vary per row: expr() is compiled again with the
+	// options this program was compiled with, so whatever the constants decide folds away.
+	// the result reads records of the same layout. results are cached in this program (and
+	// shared by its copies) by bound values, up to specialization_capacity, then one not
+	// used lately goes per miss (detail::clock_cache). a name the program does not read as a variable, or one bound
+	// already, is compile_errc::invalid_binding. a program from load() recompiles with
+	// default options but for jit.
+	std::pair<compiled_expr, std::optional<compile_error>> specialize(const var_bindings &b) const;
+	static constexpr std::size_t specialization_capacity = 4096;
+	// drops the cached specializations; those handed out stay valid
+	void clear_specializations() const;
 
 private:
-	struct ctx { double v[4]; };
+	template <class T>
+	struct basic_ctx {
+		const T *v; // the record
+		T *out;     // store_out targets
+	};
+	using ctx = basic_ctx<double>;
+
+	// where eval_batch finds slot s of row r: cols[s][r] (a null column reads 0), or
+	// records[r * stride + s] when cols is null. store_out writes row r's output j to
+	// out[r * n_out + j].
+	// T: the lane type, float for compiled_expr_f32
+	template <class T>
+	struct basic_batch_input {
+		const T *const *cols;
+		const T *records;
+		std::size_t stride;
+		T *out;
+		std::size_t n_out;
+	};
+	using batch_input = basic_batch_input<double>;
+
+	// out receives the value each row leaves on the stack; null for compile_many programs
+	template <class T>
+	void run_batch(const basic_batch_input<T> &in, T *out, std::size_t n, T *scratch) const {
+		const program &p = *prog_;
+		const detail::basic_lane_kernels<T> &k = detail::active_lane_kernels<T>();
+		T *loc = scratch + (p.batch_slots - p.n_locals) * batch_block;
+		for (std::size_t row = 0; row < n; row += batch_block) {
+			const std::size_t cnt = (n - row < batch_block) ? n - row : batch_block;
+			T *sp = vm_eval_block(p, k, 0, p.code.size(), in, row, cnt, scratch, loc);
+			if (!out) continue;
+			if (sp == scratch) {
+				for (std::size_t i = 0; i < cnt; ++i) out[row + i] = T(0);
+			} else {
+				const T *top = sp - batch_block;
+				for (std::size_t i = 0; i < cnt; ++i) out[row + i] = top[i];
+			}
+		}
+	}
+
+	// T slots batch_scratch_size() adds past the lane stack for the column table of a record
+	// wider than inline_record_size, with room to align it
+	template <class T>
+	static constexpr std::size_t column_tail(std::size_t record_size) {
+		if (record_size <= inline_record_size) return 0;
+		return (record_size * sizeof(const T *) + alignof(const T *) - 1 + sizeof(T) - 1) / sizeof(T);
+	}
+
+	// eval_batch(x, y, z, w, ...) columns as record_size slots, the ones past w null: in
+	// inline_cols up to inline_record_size slots, past that in scratch from tail on
+	template <class T>
+	static const T **column_table(const T *const four[4], std::size_t record_size,
+	                              const T *(&inline_cols)[inline_record_size], T *tail) {
+		if (record_size <= inline_record_size) {
+			std::copy(four, four + 4, inline_cols);
+			std::fill(inline_cols + 4, inline_cols + record_size, nullptr);
+			return inline_cols;
+		}
+		const std::uintptr_t align = alignof(const T *);
+		const std::uintptr_t at = (reinterpret_cast<std::uintptr_t>(tail) + align - 1) & ~(align - 1);
+		const T **cols = reinterpret_cast<const T **>(at);
+		for (std::size_t i = 0; i < record_size; ++i) ::new (static_cast<void *>(cols + i)) const T *(i < 4 ? four[i] : nullptr);
+		return cols;
+	}
+
+	// operator() on a record wider than {x, y, z, w}: the remaining slots read as 0. the
+	// padded record lives on the C++ stack up to inline_record_size slots, past that in
+	// scratch after the evaluation stack (see stack_size())
+	double eval_padded(const double *four, double *scratch) const {
+		const std::size_t n = prog_->record_size;
+		if (n <= inline_record_size) {
+			double r[inline_record_size];
+			std::copy(four, four + 4, r);
+			std::fill(r + 4, r + n, 0.0);
+			return scratch ? eval(r, scratch) : eval(r);
+		}
+		if (scratch) {
+			double *r = scratch + prog_->max_stack;
+			std::copy(four, four + 4, r);
+			std::fill(r + 4, r + n, 0.0);
+			return eval(r, scratch);
+		}
+		std::vector<double> r(n, 0.0); // very wide record without scratch: allocate
+		std::copy(four, four + 4, r.begin());
+		return eval(r.data());
+	}
 
 	enum class op : std::uint8_t {
 		push_const,
@@ -48,184 +641,1105 @@ private:
 		lt, le, gt, ge, eq, ne,
 
 		jz,          // pop cond; if false => pc = target
+		jnz,         // pop cond; if true => pc = target (the then arm placed second)
 		jmp,         // pc = target
 
 		call,        // arg = function id
 
-		end
+		store_local, // locals[arg] = top; the value stays on the stack
+		load_local,  // push locals[arg]
+		fma,         // pop c, b, a; push std::fma(a, b, c) (compile_options::fast_math only)
+		select,      // pop f, t, cond; push truth(cond) ? t : f
+		store_out,   // out[arg] = pop() (compile_many only)
+
+		end,
+
+		// superinstructions from bytecode_compiler::fuse. v = c.v[arg], k = consts[k]
+		add_vc, sub_vc, mul_vc, div_vc, // push v op k
+		add_cv, sub_cv, mul_cv, div_cv, // push k op v
+		add_vv, sub_vv, mul_vv, div_vv, // push v op c.v[arg2]
+		add_c, sub_c, mul_c, div_c,     // top = top op k
+		add_v, sub_v, mul_v, div_v,     // top = top op v
+
+		jlt, jle, jgt, jge, jeq, jne,                   // pop b, a; if !(a cmp b) => pc = arg
+		jlt_vc, jle_vc, jgt_vc, jge_vc, jeq_vc, jne_vc, // if !(c.v[arg2] cmp k) => pc = arg
+
+		// call with the function id resolved, in find_func() id order
+		call_sin, call_cos, call_tan, call_asin, call_acos, call_atan, call_exp,
+		call_log, call_log10, call_sqrt, call_abs, call_floor, call_ceil, call_round,
+		call_pow, call_atan2, call_fmod, call_min, call_max,
 	};
+	static constexpr std::size_t op_count = static_cast<std::size_t>(op::call_max) + 1;
+
+	static const char *op_name(op o) {
+		static const char *const names[] = {
+			"push_const", "push_var", "pop", "to_bool", "neg", "logical_not",
+			"add", "sub", "mul", "div", "mod", "pow",
+			"lt", "le", "gt", "ge", "eq", "ne",
+			"jz", "jnz", "jmp", "call", "store_local", "load_local", "fma", "select", "store_out", "end",
+			"add_vc", "sub_vc", "mul_vc", "div_vc",
+			"add_cv", "sub_cv", "mul_cv", "div_cv",
+			"add_vv", "sub_vv", "mul_vv", "div_vv",
+			"add_c", "sub_c", "mul_c", "div_c",
+			"add_v", "sub_v", "mul_v", "div_v",
+			"jlt", "jle", "jgt", "jge", "jeq", "jne",
+			"jlt_vc", "jle_vc", "jgt_vc", "jge_vc", "jeq_vc", "jne_vc",
+			"call_sin", "call_cos", "call_tan", "call_asin", "call_acos", "call_atan", "call_exp",
+			"call_log", "call_log10", "call_sqrt", "call_abs", "call_floor", "call_ceil", "call_round",
+			"call_pow", "call_atan2", "call_fmod", "call_min", "call_max",
+		};
+		static_assert(sizeof(names) / sizeof(names[0]) == op_count, "op names out of sync with op");
+		return names[static_cast<std::size_t>(o)];
+	}
+	// jz, jnz and the fused compare-and-jumps
+	static bool is_cond_jump(op o) { return o == op::jz || o == op::jnz || (o >= op::jlt && o <= op::jne_vc); }
 
+	// 8 bytes, so a cache line holds 8 instructions; constants live in program::consts
 	struct instr {
 		op opcode = op::end;
-		double imm = 0.0; // for push_const
-		int arg = 0;      // var index, jump target, func id
+		std::uint8_t arg2 = 0; // second var index / var of a fused jump
+		std::uint16_t k = 0;   // constant pool index of a superinstruction's k
+		std::int32_t arg = 0;  // var index, jump target, func id, constant pool index of push_const
+	};
+	static_assert(sizeof(instr) == 8, "instr must stay 8 bytes");
+	// largest pool index a superinstruction can address; push_const reaches the whole pool
+	static constexpr std::size_t max_short_const = 0xffff;
+
+	// ---------- register backend ----------
+	enum class reg_op : std::uint8_t {
+		mov,         // dst = a
+		neg, to_bool, logical_not,
+
+		add, sub, mul, div_, mod, pow,
+		fma,         // dst = std::fma(a, b, dst)
+		select,      // dst = truth(dst) ? a : b
+
+		lt, le, gt, ge, eq, ne,
+
+		jz,          // if a is false => pc = dst
+		jmp,         // pc = dst
+		call,        // dst = fid(a) / fid(a, b)
+		ret          // return a
 	};
 
-	std::vector<instr> code_;
+	// three-address instruction. an operand is a register, a variable or a constant:
+	// the bank sits in the top bits so no mov is needed to bring inputs into registers.
+	struct reg_instr {
+		reg_op opcode = reg_op::ret;
+		std::uint8_t fid = 0;
+		std::uint16_t dst = 0; // destination register or jump target
+		std::uint16_t a = 0, b = 0;
+	};
 
-	static bool truth(double v) { return v != 0.0; }
+	static constexpr unsigned operand_bits = 14;
+	static constexpr std::uint16_t reg_bank = 0, var_bank = 1, const_bank = 2;
+	// registers operator() keeps on the C++ stack
+	static constexpr std::size_t inline_regs = 64;
 
-	double vm_eval(const ctx &c) const {
-		std::vector<double> st;
-		st.reserve(64);
+	// ---------- program ----------
+	struct program;
 
-		auto pop = [&]() -> double {
-			double v = st.back();
-			st.pop_back();
-			return v;
-		};
-		auto push = [&](double v) { st.push_back(v); };
+	// a profiled program's way to its reoptimized successor
+	struct tier_state {
+		std::uint64_t after = 0; // compile_options::tier_up
+		std::atomic<bool> started{false};
+		std::atomic<const program *> next{nullptr}; // set once, then fixed
+		std::shared_ptr<const program> keep;        // owns *next, written before next
+	};
 
+	// specialize() results of one program, keyed by the bound values
+	struct specializations {
+		std::shared_mutex mutex;
+		detail::clock_cache<std::shared_ptr<const program>> map{specialization_capacity};
+	};
+
+	// everything compile() produces. built once, then frozen and shared by every copy of the
+	// compiled_expr, so copying is a reference count bump and all threads evaluating one
+	// expression read the same bytecode.
+	struct program {
+		program() = default;
+		program(const program &) = delete; // code and consts may point into the program itself
+		program &operator=(const program &) = delete;
+
+		std::string expr;
+
+		detail::const_span<instr> code;
+		detail::const_span<double> consts; // constant pool, deduplicated by bit pattern
+		std::vector<instr> code_store;     // what code and consts view, unless they live in
+		std::vector<double> consts_store;  // a loaded bundle that backing keeps mapped
+		std::shared_ptr<const void> backing;
+#if defined(BBB_EXPRDSL_THREADED)
+		std::vector<const void *> dispatch; // vm_eval handler address of each code entry
+#endif
+		std::size_t max_stack = 0;   // incl. the n_locals slots at the top
+		std::size_t batch_slots = 0; // lane-stack slots incl. those reserved for divergent branches and n_locals
+		std::size_t n_locals = 0;    // store_local/load_local slots, placed after the stack
+		std::size_t record_size = 4;   // doubles read from a record: one past the highest variable slot
+		std::size_t record_stride = 4; // doubles between records in eval_batch
+
+		std::vector<reg_instr> reg_code;
+		std::vector<double> reg_consts;
+		std::size_t n_regs = 0;
+		vm_backend backend = vm_backend::stack;
+
+		std::shared_ptr<const detail::exec_memory> native_code;
+		native_fn native = nullptr;               // entry taking x, y, z, w; null for wider records
+		native_record_fn native_record = nullptr; // entry taking the record
+		native_outputs_fn native_outputs = nullptr; // compile_many: the same entry, writing out
+
+		bool multi = false;               // compile_many
+		std::vector<std::string> outputs; // compile_many: source of each output, in out order
+		std::vector<var_schema::var> vars; // compile_options::vars, if any
+		bool has_schema = false;
+		// what compile() was given, to compile expr again (tier_up, specialize); the pointers in
+		// opts are cleared, ranges and bound are copies
+		compile_options opts;
+		range_hints ranges;
+		var_bindings bound;
+
+		std::unique_ptr<detail::profile_counters> counters; // compile_options::profile
+		std::unique_ptr<tier_state> tier;                   // with counters
+		mutable std::once_flag specs_once;
+		mutable std::unique_ptr<specializations> specs;     // made by the first specialize()
+		bool detour = false; // eval() goes through detour_eval: profiling or vm_backend::reg
+
+		void own(const std::vector<instr> &c, const std::vector<double> &k) {
+			code_store = c;
+			consts_store = k;
+			code = {code_store.data(), code_store.size()};
+			consts = {consts_store.data(), consts_store.size()};
+		}
+	};
+
+	// shared by default-constructed and failed compiled_exprs: evaluates to 0
+	static const std::shared_ptr<const program> &empty_program() {
+		static const std::shared_ptr<const program> p = std::make_shared<const program>();
+		return p;
+	}
+
+	std::shared_ptr<const program> prog_ = empty_program(); // never null
+
+	template <class T>
+	static bool truth(T v) { return v != T(0); }
+
+	// bind every instruction to its vm_eval handler; rerun whenever p.code changes
+	static void resolve_dispatch(program &p) {
+#if defined(BBB_EXPRDSL_THREADED)
+		const void *const *table = nullptr;
+		vm_eval<false, double>(p, ctx{nullptr, nullptr}, nullptr, &table);
+		p.dispatch.resize(p.code.size());
+		for (std::size_t i = 0; i < p.code.size(); ++i) p.dispatch[i] = table[static_cast<std::size_t>(p.code[i].opcode)];
+#else
+		(void)p;
+#endif
+	}
+
+	// st must hold at least p.max_stack slots; the compiler guarantees no overflow.
+	// the last p.n_locals of them hold the locals.
+	// with BBB_EXPRDSL_THREADED every handler jumps straight to the next one through
+	// p.dispatch (handler addresses resolved by compile()); otherwise a switch loop.
+	// a non-null table_out only reports the handler table, in op order.
+	// Profile counts into p.counters (compile_options::profile); the instantiation without
+	// it has no counting code at all. T = float (compiled_expr_f32) computes in single
+	// precision. both dispatch through the opcode rather than p.dispatch, which holds the
+	// handlers of the plain double instantiation.
+#if defined(BBB_EXPRDSL_THREADED)
+#	pragma GCC diagnostic push
+#	pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+	template <bool Profile = false, class T = double>
+	static T vm_eval(const program &p, const basic_ctx<T> &c, T *st, const void *const **table_out = nullptr) {
+#if defined(BBB_EXPRDSL_THREADED)
+		static const void *const table[] = {
+			&&l_push_const, &&l_push_var, &&l_pop, &&l_to_bool, &&l_neg, &&l_logical_not,
+			&&l_add, &&l_sub, &&l_mul, &&l_div_, &&l_mod, &&l_pow,
+			&&l_lt, &&l_le, &&l_gt, &&l_ge, &&l_eq, &&l_ne,
+			&&l_jz, &&l_jnz, &&l_jmp, &&l_call, &&l_store_local, &&l_load_local, &&l_fma, &&l_select, &&l_store_out, &&l_end,
+			&&l_add_vc, &&l_sub_vc, &&l_mul_vc, &&l_div_vc,
+			&&l_add_cv, &&l_sub_cv, &&l_mul_cv, &&l_div_cv,
+			&&l_add_vv, &&l_sub_vv, &&l_mul_vv, &&l_div_vv,
+			&&l_add_c, &&l_sub_c, &&l_mul_c, &&l_div_c,
+			&&l_add_v, &&l_sub_v, &&l_mul_v, &&l_div_v,
+			&&l_jlt, &&l_jle, &&l_jgt, &&l_jge, &&l_jeq, &&l_jne,
+			&&l_jlt_vc, &&l_jle_vc, &&l_jgt_vc, &&l_jge_vc, &&l_jeq_vc, &&l_jne_vc,
+			&&l_call_sin, &&l_call_cos, &&l_call_tan, &&l_call_asin, &&l_call_acos, &&l_call_atan, &&l_call_exp,
+			&&l_call_log, &&l_call_log10, &&l_call_sqrt, &&l_call_abs, &&l_call_floor, &&l_call_ceil, &&l_call_round,
+			&&l_call_pow, &&l_call_atan2, &&l_call_fmod, &&l_call_min, &&l_call_max,
+		};
+		static_assert(sizeof(table) / sizeof(table[0]) == op_count, "handler table out of sync with op");
+		if (table_out) {
+			*table_out = table;
+			return 0.0;
+		}
+		if (p.code.empty()) return 0.0;
+		[[maybe_unused]] const void *const *d = p.dispatch.data();
+		// p.dispatch holds the handlers of vm_eval<false, double>
+		constexpr bool by_opcode = Profile || !std::is_same<T, double>::value;
+#	define BBB_EXPRDSL_OP(name) l_##name:
+#	define BBB_EXPRDSL_NEXT                                                                  \
+		do {                                                                                \
+			in = &code[pc];                                                                 \
+			if constexpr (Profile) count();                                                 \
+			if constexpr (by_opcode) {                                                      \
+				goto *table[static_cast<std::size_t>(in->opcode)];                          \
+			} else {                                                                        \
+				goto *d[pc];                                                                \
+			}                                                                               \
+		} while (0)
+#else
+		(void)table_out;
+#	define BBB_EXPRDSL_OP(name) case op::name:
+#	define BBB_EXPRDSL_NEXT continue
+#endif
+		T *sp = st;
+		T *loc = st + (p.max_stack - p.n_locals);
+
+		auto pop = [&]() -> T { return *--sp; };
+		auto push = [&](T v) { *sp++ = v; };
+
+		// every program ends with op::end, so the pc needs no bounds check
+		const instr *code = p.code.data();
+		const double *pool = p.consts.data();
+		// constants are rounded to T before they meet an operand, as eval_batch does
+		auto konst = [pool](std::size_t i) { return static_cast<T>(pool[i]); };
 		std::size_t pc = 0;
-		while (pc < code_.size()) {
-			const instr &in = code_[pc];
-			switch (in.opcode) {
-				case op::push_const:
-					push(in.imm);
+		const instr *in = code;
+
+		[[maybe_unused]] detail::profile_counters *prof = Profile ? p.counters.get() : nullptr;
+		[[maybe_unused]] std::size_t depth = 0;
+		auto count = [&] {
+			prof->hits[pc].fetch_add(1, std::memory_order_relaxed);
+			depth = std::max(depth, static_cast<std::size_t>(sp - st));
+		};
+		// next pc of a conditional jump that falls through when cond holds
+		auto jump_unless = [&](bool cond) -> std::size_t {
+			if constexpr (Profile) {
+				if (!cond) prof->taken[pc].fetch_add(1, std::memory_order_relaxed);
+			}
+			return cond ? pc + 1 : static_cast<std::size_t>(in->arg);
+		};
+#if defined(BBB_EXPRDSL_THREADED)
+		BBB_EXPRDSL_NEXT;
+#else
+		if (p.code.empty()) return 0.0;
+		for (;; in = &code[pc]) {
+			if constexpr (Profile) count();
+			switch (in->opcode) {
+#endif
+				BBB_EXPRDSL_OP(push_const)
+					push(konst(in->arg));
 					++pc;
-					break;
-				case op::push_var:
-					push(c.v[in.arg]);
+					BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(push_var)
+					push(c.v[in->arg]);
 					++pc;
-					break;
-				case op::pop:
+					BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(pop)
 					(void)pop();
 					++pc;
-					break;
-				case op::to_bool: {
-					double v = pop();
-					push(truth(v) ? 1.0 : 0.0);
+					BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(to_bool)
+					sp[-1] = truth(sp[-1]) ? 1.0 : 0.0;
 					++pc;
-					break;
+					BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(neg)
+					sp[-1] = -sp[-1];
+					++pc;
+					BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(logical_not)
+					sp[-1] = !truth(sp[-1]) ? 1.0 : 0.0;
+					++pc;
+					BBB_EXPRDSL_NEXT;
+
+				BBB_EXPRDSL_OP(add) { T b = pop(), a = pop(); push(a + b); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(sub) { T b = pop(), a = pop(); push(a - b); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(mul) { T b = pop(), a = pop(); push(a * b); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(div_) { T b = pop(), a = pop(); push(a / b); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(mod) { T b = pop(), a = pop(); push(std::fmod(a, b)); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(pow) { T b = pop(), a = pop(); push(std::pow(a, b)); ++pc; BBB_EXPRDSL_NEXT; }
+
+				BBB_EXPRDSL_OP(lt) { T b = pop(), a = pop(); push(a < b  ? 1.0 : 0.0); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(le) { T b = pop(), a = pop(); push(a <= b ? 1.0 : 0.0); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(gt) { T b = pop(), a = pop(); push(b < a  ? 1.0 : 0.0); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(ge) { T b = pop(), a = pop(); push(b <= a ? 1.0 : 0.0); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(eq) { T b = pop(), a = pop(); push(a == b ? 1.0 : 0.0); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(ne) { T b = pop(), a = pop(); push(a != b ? 1.0 : 0.0); ++pc; BBB_EXPRDSL_NEXT; }
+
+				BBB_EXPRDSL_OP(jz) {
+					T cond = pop(); // consumes condition
+					pc = jump_unless(truth(cond));
+					BBB_EXPRDSL_NEXT;
+				}
+				BBB_EXPRDSL_OP(jnz) {
+					T cond = pop();
+					pc = jump_unless(!truth(cond));
+					BBB_EXPRDSL_NEXT;
 				}
-				case op::neg: {
-					double a = pop();
-					push(-a);
+				BBB_EXPRDSL_OP(jmp)
+					pc = static_cast<std::size_t>(in->arg);
+					BBB_EXPRDSL_NEXT;
+
+				BBB_EXPRDSL_OP(call) {
+					if (in->arg >= 14) {
+						T b = pop(), a = pop();
+						push(detail::eval_func(in->arg, a, b));
+					} else {
+						sp[-1] = detail::eval_func(in->arg, sp[-1]);
+					}
 					++pc;
-					break;
+					BBB_EXPRDSL_NEXT;
 				}
-				case op::logical_not: {
-					double a = pop();
-					push(!truth(a) ? 1.0 : 0.0);
+
+				BBB_EXPRDSL_OP(store_local)
+					loc[in->arg] = sp[-1];
+					++pc;
+					BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(load_local)
+					push(loc[in->arg]);
 					++pc;
+					BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(fma) { T e = pop(), b = pop(), a = pop(); push(std::fma(a, b, e)); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(select) { T f = pop(), t = pop(); sp[-1] = truth(sp[-1]) ? t : f; ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(store_out) c.out[in->arg] = pop(); ++pc; BBB_EXPRDSL_NEXT;
+
+				BBB_EXPRDSL_OP(add_vc) push(c.v[in->arg] + konst(in->k)); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(sub_vc) push(c.v[in->arg] - konst(in->k)); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(mul_vc) push(c.v[in->arg] * konst(in->k)); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(div_vc) push(c.v[in->arg] / konst(in->k)); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(add_cv) push(konst(in->k) + c.v[in->arg]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(sub_cv) push(konst(in->k) - c.v[in->arg]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(mul_cv) push(konst(in->k) * c.v[in->arg]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(div_cv) push(konst(in->k) / c.v[in->arg]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(add_vv) push(c.v[in->arg] + c.v[in->arg2]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(sub_vv) push(c.v[in->arg] - c.v[in->arg2]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(mul_vv) push(c.v[in->arg] * c.v[in->arg2]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(div_vv) push(c.v[in->arg] / c.v[in->arg2]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(add_c) sp[-1] = sp[-1] + konst(in->k); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(sub_c) sp[-1] = sp[-1] - konst(in->k); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(mul_c) sp[-1] = sp[-1] * konst(in->k); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(div_c) sp[-1] = sp[-1] / konst(in->k); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(add_v) sp[-1] = sp[-1] + c.v[in->arg]; ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(sub_v) sp[-1] = sp[-1] - c.v[in->arg]; ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(mul_v) sp[-1] = sp[-1] * c.v[in->arg]; ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(div_v) sp[-1] = sp[-1] / c.v[in->arg]; ++pc; BBB_EXPRDSL_NEXT;
+
+				BBB_EXPRDSL_OP(jlt) { T b = pop(), a = pop(); pc = jump_unless(a < b); BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(jle) { T b = pop(), a = pop(); pc = jump_unless(a <= b); BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(jgt) { T b = pop(), a = pop(); pc = jump_unless(b < a); BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(jge) { T b = pop(), a = pop(); pc = jump_unless(b <= a); BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(jeq) { T b = pop(), a = pop(); pc = jump_unless(a == b); BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(jne) { T b = pop(), a = pop(); pc = jump_unless(a != b); BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(jlt_vc) { T a = c.v[in->arg2]; pc = jump_unless(a < konst(in->k)); BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(jle_vc) { T a = c.v[in->arg2]; pc = jump_unless(a <= konst(in->k)); BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(jgt_vc) { T a = c.v[in->arg2]; pc = jump_unless(konst(in->k) < a); BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(jge_vc) { T a = c.v[in->arg2]; pc = jump_unless(konst(in->k) <= a); BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(jeq_vc) { T a = c.v[in->arg2]; pc = jump_unless(a == konst(in->k)); BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(jne_vc) { T a = c.v[in->arg2]; pc = jump_unless(a != konst(in->k)); BBB_EXPRDSL_NEXT; }
+
+				BBB_EXPRDSL_OP(call_sin)   sp[-1] = std::sin(sp[-1]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(call_cos)   sp[-1] = std::cos(sp[-1]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(call_tan)   sp[-1] = std::tan(sp[-1]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(call_asin)  sp[-1] = std::asin(sp[-1]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(call_acos)  sp[-1] = std::acos(sp[-1]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(call_atan)  sp[-1] = std::atan(sp[-1]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(call_exp)   sp[-1] = std::exp(sp[-1]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(call_log)   sp[-1] = std::log(sp[-1]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(call_log10) sp[-1] = std::log10(sp[-1]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(call_sqrt)  sp[-1] = std::sqrt(sp[-1]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(call_abs)   sp[-1] = std::fabs(sp[-1]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(call_floor) sp[-1] = std::floor(sp[-1]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(call_ceil)  sp[-1] = std::ceil(sp[-1]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(call_round) sp[-1] = std::round(sp[-1]); ++pc; BBB_EXPRDSL_NEXT;
+				BBB_EXPRDSL_OP(call_pow)   { T b = pop(), a = pop(); push(std::pow(a, b)); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(call_atan2) { T b = pop(), a = pop(); push(std::atan2(a, b)); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(call_fmod)  { T b = pop(), a = pop(); push(std::fmod(a, b)); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(call_min)   { T b = pop(), a = pop(); push(a < b ? a : b); ++pc; BBB_EXPRDSL_NEXT; }
+				BBB_EXPRDSL_OP(call_max)   { T b = pop(), a = pop(); push(b < a ? a : b); ++pc; BBB_EXPRDSL_NEXT; }
+
+				BBB_EXPRDSL_OP(end)
+					if constexpr (Profile) prof->finish(depth);
+					return sp == st ? 0.0 : sp[-1];
+#if !defined(BBB_EXPRDSL_THREADED)
+			}
+		}
+#endif
+#undef BBB_EXPRDSL_OP
+#undef BBB_EXPRDSL_NEXT
+	}
+#if defined(BBB_EXPRDSL_THREADED)
+#	pragma GCC diagnostic pop
+#endif
+
+	static double reg_eval(const program &p, const ctx &c) {
+		if (p.n_regs <= inline_regs) {
+			double r[inline_regs];
+			return reg_run(p, c, r);
+		}
+		std::vector<double> r(p.n_regs);
+		return reg_run(p, c, r.data());
+	}
+
+	static double reg_run(const program &p, const ctx &c, double *r) {
+		const double *bank[3] = {r, c.v, p.reg_consts.data()};
+		auto ld = [&](std::uint16_t o) -> double {
+			return bank[o >> operand_bits][o & ((1u << operand_bits) - 1)];
+		};
+
+		std::size_t pc = 0;
+		while (pc < p.reg_code.size()) {
+			const reg_instr &in = p.reg_code[pc++];
+			switch (in.opcode) {
+				case reg_op::mov:         r[in.dst] = ld(in.a); break;
+				case reg_op::neg:         r[in.dst] = -ld(in.a); break;
+				case reg_op::to_bool:     r[in.dst] = truth(ld(in.a)) ? 1.0 : 0.0; break;
+				case reg_op::logical_not: r[in.dst] = !truth(ld(in.a)) ? 1.0 : 0.0; break;
+
+				case reg_op::add:  r[in.dst] = ld(in.a) + ld(in.b); break;
+				case reg_op::sub:  r[in.dst] = ld(in.a) - ld(in.b); break;
+				case reg_op::mul:  r[in.dst] = ld(in.a) * ld(in.b); break;
+				case reg_op::div_: r[in.dst] = ld(in.a) / ld(in.b); break;
+				case reg_op::mod:  r[in.dst] = std::fmod(ld(in.a), ld(in.b)); break;
+				case reg_op::pow:  r[in.dst] = std::pow(ld(in.a), ld(in.b)); break;
+				case reg_op::fma:  r[in.dst] = std::fma(ld(in.a), ld(in.b), r[in.dst]); break;
+				case reg_op::select: r[in.dst] = truth(r[in.dst]) ? ld(in.a) : ld(in.b); break;
+
+				case reg_op::lt: r[in.dst] = ld(in.a) < ld(in.b)  ? 1.0 : 0.0; break;
+				case reg_op::le: r[in.dst] = ld(in.a) <= ld(in.b) ? 1.0 : 0.0; break;
+				case reg_op::gt: r[in.dst] = ld(in.b) < ld(in.a)  ? 1.0 : 0.0; break;
+				case reg_op::ge: r[in.dst] = ld(in.b) <= ld(in.a) ? 1.0 : 0.0; break;
+				case reg_op::eq: r[in.dst] = ld(in.a) == ld(in.b) ? 1.0 : 0.0; break;
+				case reg_op::ne: r[in.dst] = ld(in.a) != ld(in.b) ? 1.0 : 0.0; break;
+
+				case reg_op::jz:
+					if (!truth(ld(in.a))) pc = in.dst;
 					break;
-				}
+				case reg_op::jmp:
+					pc = in.dst;
+					break;
+
+				case reg_op::call:
+					r[in.dst] = (in.fid < 14) ? detail::eval_func(in.fid, ld(in.a))
+					                          : detail::eval_func(in.fid, ld(in.a), ld(in.b));
+					break;
+
+				case reg_op::ret:
+					return ld(in.a);
+			}
+		}
+		return 0.0;
+	}
 
-				case op::add: { double b = pop(), a = pop(); push(a + b); ++pc; break; }
-				case op::sub: { double b = pop(), a = pop(); push(a - b); ++pc; break; }
-				case op::mul: { double b = pop(), a = pop(); push(a * b); ++pc; break; }
-				case op::div_: { double b = pop(), a = pop(); push(a / b); ++pc; break; }
-				case op::mod: { double b = pop(), a = pop(); push(std::fmod(a, b)); ++pc; break; }
-				case op::pow: { double b = pop(), a = pop(); push(std::pow(a, b)); ++pc; break; }
-
-				case op::lt: { double b = pop(), a = pop(); push(a < b  ? 1.0 : 0.0); ++pc; break; }
-				case op::le: { double b = pop(), a = pop(); push(a <= b ? 1.0 : 0.0); ++pc; break; }
-				case op::gt: { double b = pop(), a = pop(); push(b < a  ? 1.0 : 0.0); ++pc; break; }
-				case op::ge: { double b = pop(), a = pop(); push(b <= a ? 1.0 : 0.0); ++pc; break; }
-				case op::eq: { double b = pop(), a = pop(); push(a == b ? 1.0 : 0.0); ++pc; break; }
-				case op::ne: { double b = pop(), a = pop(); push(a != b ? 1.0 : 0.0); ++pc; break; }
-
-				case op::jz: {
-					double cond = pop(); // consumes condition
-					if (!truth(cond)) pc = static_cast<std::size_t>(in.arg);
-					else ++pc;
+	// eval() off the plain stack loop: counting for compile_options::profile, or the
+	// register backend. scratch may be null.
+	static double detour_eval(const program &p, const ctx &c, double *scratch) {
+		if (!p.counters) return reg_eval(p, c);
+		if (const program *t = p.tier->next.load(std::memory_order_acquire)) return eval_tier(*t, p, c, scratch);
+		double v;
+		if (scratch) {
+			v = vm_eval<true>(p, c, scratch);
+		} else if (p.max_stack <= inline_stack_size) {
+			double st[inline_stack_size];
+			v = vm_eval<true>(p, c, st);
+		} else {
+			std::vector<double> st(p.max_stack);
+			v = vm_eval<true>(p, c, st.data());
+		}
+		const tier_state &t = *p.tier;
+		if (t.after && !t.started.load(std::memory_order_relaxed) &&
+		    p.counters->evals.load(std::memory_order_relaxed) >= t.after) {
+			tier_up(p);
+		}
+		return v;
+	}
+
+	// eval() on the program that reoptimize() put in place of first, which sized scratch
+	static double eval_tier(const program &t, const program &first, const ctx &c, double *scratch) {
+		if (t.native_record) return t.native_record(c.v);
+		if (t.detour) return reg_eval(t, c);
+		if (scratch && t.max_stack <= first.max_stack) return vm_eval(t, c, scratch);
+		if (t.max_stack <= inline_stack_size) {
+			double st[inline_stack_size];
+			return vm_eval(t, c, st);
+		}
+		std::vector<double> st(t.max_stack);
+		return vm_eval(t, c, st.data());
+	}
+
+	// see reoptimize(); the first caller recompiles while everyone else keeps evaluating p
+	static bool tier_up(const program &p);
+	// compile() of p.expr with p's options and bindings plus also_bound, adjust(compile_options &)
+	// changing the options last
+	template <class Adjust>
+	static std::pair<compiled_expr, std::optional<compile_error>>
+	recompile(const program &p, const detail::branch_hints *hints, const var_bindings *also_bound, Adjust &&adjust);
+
+	// runs p.code[pc, stop) on a block of rows [row, row + cnt); every stack slot is
+	// batch_block lanes of T wide (double, or float for compiled_expr_f32). lanes past cnt hold filler values and are never observed.
+	// returns the stack pointer after the range. element-wise opcodes go through the
+	// runtime-selected SIMD kernels in k; the remaining libm calls loop per lane.
+	//
+	// a jz (or jnz) whose lanes disagree evaluates both arms and blends them by the condition.
+	// this relies on the structured layout emitted by bytecode_compiler: the slot before a
+	// jz target is the jmp that skips the else arm. the taken arm runs one slot above the
+	// condition, the else arm one slot above that. locals live in loc, past every lane slot.
+	template <class T>
+	static T *vm_eval_block(const program &p, const detail::basic_lane_kernels<T> &k, std::size_t pc, std::size_t stop,
+	                        const basic_batch_input<T> &src, std::size_t row, std::size_t cnt, T *sp, T *loc) {
+		constexpr std::size_t B = batch_block;
+		using bin_fn = typename detail::basic_lane_kernels<T>::bin_fn;
+		const bin_fn arith[4] = {k.add, k.sub, k.mul, k.div_};
+		const bin_fn cmp[6] = {k.lt, k.le, k.gt, k.ge, k.eq, k.ne};
+		const double *pool = p.consts.data();
+
+		auto fill_const = [&](T *d, double v) {
+			const T t = static_cast<T>(v);
+			for (std::size_t i = 0; i < B; ++i) d[i] = t;
+		};
+		auto fill_var = [&](T *d, int index) {
+			const T *col = src.cols ? src.cols[index] : nullptr;
+			if (col) {
+				for (std::size_t i = 0; i < cnt; ++i) d[i] = col[row + i];
+			} else if (src.records) {
+				const T *r = src.records + row * src.stride + static_cast<std::size_t>(index);
+				for (std::size_t i = 0; i < cnt; ++i) d[i] = r[i * src.stride];
+			} else {
+				for (std::size_t i = 0; i < cnt; ++i) d[i] = T(0);
+			}
+			for (std::size_t i = cnt; i < B; ++i) d[i] = T(0);
+		};
+		// pops the condition on top; returns the next pc. with inverted (jnz) the arm at the
+		// target is the one for a true condition.
+		auto branch = [&](std::size_t at, std::size_t target, bool inverted = false) -> std::size_t {
+			sp -= B;
+			std::size_t n_true = 0;
+			for (std::size_t i = 0; i < cnt; ++i) n_true += truth(sp[i]) ? 1 : 0;
+
+			if (n_true == cnt) return inverted ? target : at + 1;
+			if (n_true == 0) return inverted ? at + 1 : target;
+
+			// divergent block: cond stays at sp, taken arm -> sp + B, else arm -> sp + 2B
+			const std::size_t end_pc = static_cast<std::size_t>(p.code[target - 1].arg);
+			T *t = sp + B;
+			T *f = sp + 2 * B;
+			(void)vm_eval_block(p, k, at + 1, target - 1, src, row, cnt, t, loc);
+			(void)vm_eval_block(p, k, target, end_pc, src, row, cnt, f, loc);
+			if (inverted) k.blend(sp, f, t);
+			else k.blend(sp, t, f);
+			sp += B;
+			return end_pc;
+		};
+
+		while (pc < stop) {
+			const instr &in = p.code[pc];
+			switch (in.opcode) {
+				case op::push_const:
+					fill_const(sp, pool[in.arg]);
+					sp += B;
+					break;
+				case op::push_var:
+					fill_var(sp, in.arg);
+					sp += B;
+					break;
+				case op::pop:
+					sp -= B;
+					break;
+				case op::store_local:
+					std::memcpy(loc + static_cast<std::size_t>(in.arg) * B, sp - B, B * sizeof(T));
+					break;
+				case op::load_local:
+					std::memcpy(sp, loc + static_cast<std::size_t>(in.arg) * B, B * sizeof(T));
+					sp += B;
+					break;
+				case op::fma: sp -= 2 * B; k.fma(sp - B, sp, sp + B); break;
+				case op::select: sp -= 2 * B; k.blend(sp - B, sp, sp + B); break;
+				case op::store_out: {
+					sp -= B;
+					T *o = src.out + row * src.n_out + static_cast<std::size_t>(in.arg);
+					for (std::size_t i = 0; i < cnt; ++i) o[i * src.n_out] = sp[i];
 					break;
 				}
+				case op::to_bool:     k.to_bool(sp - B); break;
+				case op::neg:         k.neg(sp - B); break;
+				case op::logical_not: k.logical_not(sp - B); break;
+
+				case op::add:  sp -= B; k.add(sp - B, sp); break;
+				case op::sub:  sp -= B; k.sub(sp - B, sp); break;
+				case op::mul:  sp -= B; k.mul(sp - B, sp); break;
+				case op::div_: sp -= B; k.div_(sp - B, sp); break;
+				case op::mod:  sp -= B; detail::lanes2(sp - B, sp, [](T a, T b) { return std::fmod(a, b); }); break;
+				case op::pow:  sp -= B; detail::lanes2(sp - B, sp, [](T a, T b) { return std::pow(a, b); }); break;
+
+				case op::lt: sp -= B; k.lt(sp - B, sp); break;
+				case op::le: sp -= B; k.le(sp - B, sp); break;
+				case op::gt: sp -= B; k.gt(sp - B, sp); break;
+				case op::ge: sp -= B; k.ge(sp - B, sp); break;
+				case op::eq: sp -= B; k.eq(sp - B, sp); break;
+				case op::ne: sp -= B; k.ne(sp - B, sp); break;
+
+				case op::jz:
+					pc = branch(pc, static_cast<std::size_t>(in.arg));
+					continue;
+				case op::jnz:
+					pc = branch(pc, static_cast<std::size_t>(in.arg), true);
+					continue;
 				case op::jmp:
 					pc = static_cast<std::size_t>(in.arg);
-					break;
+					continue;
 
 				case op::call: {
-					const int fid = in.arg;
-
-					auto pop1 = [&]() { return pop(); };
-					auto pop2 = [&]() {
-						double b = pop();
-						double a = pop();
-						return std::pair<double,double>{a,b};
-					};
-
-					switch (fid) {
+					T *a = sp - B;
+					switch (in.arg) {
 						// 1-arg
-						case 0: push(std::sin(pop1())); break;
-						case 1: push(std::cos(pop1())); break;
-						case 2: push(std::tan(pop1())); break;
-						case 3: push(std::asin(pop1())); break;
-						case 4: push(std::acos(pop1())); break;
-						case 5: push(std::atan(pop1())); break;
-						case 6: push(std::exp(pop1())); break;
-						case 7: push(std::log(pop1())); break;
-						case 8: push(std::log10(pop1())); break;
-						case 9: push(std::sqrt(pop1())); break;
-						case 10: push(std::fabs(pop1())); break;
-						case 11: push(std::floor(pop1())); break;
-						case 12: push(std::ceil(pop1())); break;
-						case 13: push(std::round(pop1())); break;
+						case 0:  detail::lanes1(a, [](T v) { return std::sin(v); }); break;
+						case 1:  detail::lanes1(a, [](T v) { return std::cos(v); }); break;
+						case 2:  detail::lanes1(a, [](T v) { return std::tan(v); }); break;
+						case 3:  detail::lanes1(a, [](T v) { return std::asin(v); }); break;
+						case 4:  detail::lanes1(a, [](T v) { return std::acos(v); }); break;
+						case 5:  detail::lanes1(a, [](T v) { return std::atan(v); }); break;
+						case 6:  detail::lanes1(a, [](T v) { return std::exp(v); }); break;
+						case 7:  detail::lanes1(a, [](T v) { return std::log(v); }); break;
+						case 8:  detail::lanes1(a, [](T v) { return std::log10(v); }); break;
+						case 9:  k.sqrt(a); break;
+						case 10: k.abs(a); break;
+						case 11: k.floor(a); break;
+						case 12: k.ceil(a); break;
+						case 13: k.round(a); break;
 
 						// 2-arg
-						case 14: { auto [a, b] = pop2(); push(std::pow(a, b)); } break;
-						case 15: { auto [a, b] = pop2(); push(std::atan2(a, b)); } break;
-						case 16: { auto [a, b] = pop2(); push(std::fmod(a, b)); } break;
-						case 17: { auto [a, b] = pop2(); push(a < b ? a : b); } break;
-						case 18: { auto [a, b] = pop2(); push(b < a ? a : b); } break;
+						case 14: sp -= B; detail::lanes2(sp - B, sp, [](T u, T v) { return std::pow(u, v); }); break;
+						case 15: sp -= B; detail::lanes2(sp - B, sp, [](T u, T v) { return std::atan2(u, v); }); break;
+						case 16: sp -= B; detail::lanes2(sp - B, sp, [](T u, T v) { return std::fmod(u, v); }); break;
+						case 17: sp -= B; k.min(sp - B, sp); break;
+						case 18: sp -= B; k.max(sp - B, sp); break;
 
 						default:
-							push(std::numeric_limits<double>::quiet_NaN());
+							detail::lanes1(a, [](T) { return std::numeric_limits<T>::quiet_NaN(); });
 							break;
 					}
-					++pc;
 					break;
 				}
 
+				case op::add_vc: case op::sub_vc: case op::mul_vc: case op::div_vc:
+					fill_var(sp, in.arg);
+					fill_const(sp + B, pool[in.k]);
+					arith[static_cast<int>(in.opcode) - static_cast<int>(op::add_vc)](sp, sp + B);
+					sp += B;
+					break;
+				case op::add_cv: case op::sub_cv: case op::mul_cv: case op::div_cv:
+					fill_const(sp, pool[in.k]);
+					fill_var(sp + B, in.arg);
+					arith[static_cast<int>(in.opcode) - static_cast<int>(op::add_cv)](sp, sp + B);
+					sp += B;
+					break;
+				case op::add_vv: case op::sub_vv: case op::mul_vv: case op::div_vv:
+					fill_var(sp, in.arg);
+					fill_var(sp + B, in.arg2);
+					arith[static_cast<int>(in.opcode) - static_cast<int>(op::add_vv)](sp, sp + B);
+					sp += B;
+					break;
+				case op::add_c: case op::sub_c: case op::mul_c: case op::div_c:
+					fill_const(sp, pool[in.k]);
+					arith[static_cast<int>(in.opcode) - static_cast<int>(op::add_c)](sp - B, sp);
+					break;
+				case op::add_v: case op::sub_v: case op::mul_v: case op::div_v:
+					fill_var(sp, in.arg);
+					arith[static_cast<int>(in.opcode) - static_cast<int>(op::add_v)](sp - B, sp);
+					break;
+
+				case op::jlt: case op::jle: case op::jgt: case op::jge: case op::jeq: case op::jne:
+					sp -= B;
+					cmp[static_cast<int>(in.opcode) - static_cast<int>(op::jlt)](sp - B, sp);
+					pc = branch(pc, static_cast<std::size_t>(in.arg));
+					continue;
+				case op::jlt_vc: case op::jle_vc: case op::jgt_vc: case op::jge_vc: case op::jeq_vc: case op::jne_vc:
+					fill_var(sp, in.arg2);
+					fill_const(sp + B, pool[in.k]);
+					cmp[static_cast<int>(in.opcode) - static_cast<int>(op::jlt_vc)](sp, sp + B);
+					sp += B;
+					pc = branch(pc, static_cast<std::size_t>(in.arg));
+					continue;
+
+				case op::call_sin:   detail::lanes1(sp - B, [](T v) { return std::sin(v); }); break;
+				case op::call_cos:   detail::lanes1(sp - B, [](T v) { return std::cos(v); }); break;
+				case op::call_tan:   detail::lanes1(sp - B, [](T v) { return std::tan(v); }); break;
+				case op::call_asin:  detail::lanes1(sp - B, [](T v) { return std::asin(v); }); break;
+				case op::call_acos:  detail::lanes1(sp - B, [](T v) { return std::acos(v); }); break;
+				case op::call_atan:  detail::lanes1(sp - B, [](T v) { return std::atan(v); }); break;
+				case op::call_exp:   detail::lanes1(sp - B, [](T v) { return std::exp(v); }); break;
+				case op::call_log:   detail::lanes1(sp - B, [](T v) { return std::log(v); }); break;
+				case op::call_log10: detail::lanes1(sp - B, [](T v) { return std::log10(v); }); break;
+				case op::call_sqrt:  k.sqrt(sp - B); break;
+				case op::call_abs:   k.abs(sp - B); break;
+				case op::call_floor: k.floor(sp - B); break;
+				case op::call_ceil:  k.ceil(sp - B); break;
+				case op::call_round: k.round(sp - B); break;
+				case op::call_pow:   sp -= B; detail::lanes2(sp - B, sp, [](T u, T v) { return std::pow(u, v); }); break;
+				case op::call_atan2: sp -= B; detail::lanes2(sp - B, sp, [](T u, T v) { return std::atan2(u, v); }); break;
+				case op::call_fmod:  sp -= B; detail::lanes2(sp - B, sp, [](T u, T v) { return std::fmod(u, v); }); break;
+				case op::call_min:   sp -= B; k.min(sp - B, sp); break;
+				case op::call_max:   sp -= B; k.max(sp - B, sp); break;
+
 				case op::end:
-					return st.empty() ? 0.0 : st.back();
+					return sp;
 			}
+			++pc;
 		}
-		return st.empty() ? 0.0 : st.back();
+		return sp;
 	}
 
+	// fills p from the finished (fused) bytecode: slot counts, dispatch and native code
+	static void link(program &p, const detail::bytecode_compiler &bc, const compile_options &opts);
+	// dispatch for p.code, and native code if jit (the last steps of link)
+	static void bind(program &p, bool jit);
+
 	friend std::pair<compiled_expr, std::optional<compile_error>>
-	compile(std::string_view);
+	compile(std::string_view, compile_context &, const compile_options &);
+	friend std::pair<compiled_multi_expr, std::optional<compile_error>>
+	compile_many(const std::vector<std::string_view> &, compile_context &, const compile_options &);
+	friend class compiled_multi_expr;
+	friend class compiled_expr_f32;
+	friend class expr_session;
 	friend class detail::bytecode_compiler;
+	friend class detail::register_compiler;
+	friend class detail::jit_compiler;
+	friend class detail::program_io;
+	friend class detail::bytecode_verifier;
 };
 
-// forward
-inline std::pair<compiled_expr, std::optional<compile_error>>
-compile(std::string_view input);
+// several expressions over the same inputs compiled into one program (see compile_many):
+// each row runs one dispatch loop that writes all size() outputs, and subexpressions common
+// to several outputs are computed once. copies share the program like compiled_expr.
+class compiled_multi_expr {
+public:
+	// number of outputs: the inputs given to compile_many, in order
+	std::size_t size() const { return p().outputs.size(); }
+	const std::string &expr(std::size_t i) const { return p().outputs[i]; }
+
+	// out[i] = output i on record (see compiled_expr::eval), for i in [0, size())
+	void eval(const double *record, double *out) const {
+		const program &q = p();
+		if (q.native_outputs) {
+			q.native_outputs(record, out);
+			return;
+		}
+		if (q.max_stack <= compiled_expr::inline_stack_size) {
+			double st[compiled_expr::inline_stack_size];
+			run(q, ctx{record, out}, st);
+			return;
+		}
+		std::vector<double> st(q.max_stack);
+		run(q, ctx{record, out}, st.data());
+	}
 
-// =============================
-// internals: lexer / parser / folding / bc compiler
-// =============================
-namespace detail {
+	// same on a caller-supplied stack of at least stack_size() doubles (no allocation)
+	void eval(const double *record, double *out, double *scratch) const {
+		const program &q = p();
+		if (q.native_outputs) {
+			q.native_outputs(record, out);
+			return;
+		}
+		run(q, ctx{record, out}, scratch);
+	}
 
-// ---------- tokens ----------
-enum class tok_kind : std::uint8_t {
-	end,
-	number,
-	ident,
-	var,      // var_index 0..3
-	lparen, rparen,
-	comma,
-	plus, minus, star, slash, percent, caret,
-	bang,
-	less, less_eq, greater, greater_eq,
-	eq_eq, bang_eq,
-	and_and, or_or,
-	question, colon
-};
+	// the record {x, y, z, w}; slots past 3 of a wider var_schema read as 0
+	void operator()(double x, double y, double z, double w, double *out) const {
+		const double r[4] = {x, y, z, w};
+		if (record_size() <= 4) {
+			eval(r, out);
+			return;
+		}
+		const std::size_t n = record_size();
+		if (n <= compiled_expr::inline_record_size) {
+			double wide[compiled_expr::inline_record_size];
+			std::copy(r, r + 4, wide);
+			std::fill(wide + 4, wide + n, 0.0);
+			eval(wide, out);
+			return;
+		}
+		std::vector<double> wide(n, 0.0); // very wide record: allocate
+		std::copy(r, r + 4, wide.begin());
+		eval(wide.data(), out);
+	}
+
+	// array-of-structures batch: row i reads records + i * record_stride() and writes its
+	// outputs to out[i * size() .. i * size() + size())
+	void eval_batch(const double *records, double *out, std::size_t n) const {
+		if (p().batch_slots <= compiled_expr::inline_batch_slots) {
+			alignas(64) double lanes[compiled_expr::inline_batch_slots * compiled_expr::batch_block];
+			eval_batch(records, out, n, lanes);
+			return;
+		}
+		std::vector<double> lanes(batch_scratch_size());
+		eval_batch(records, out, n, lanes.data());
+	}
+
+	// same with a caller-supplied lane stack of at least batch_scratch_size() doubles
+	void eval_batch(const double *records, double *out, std::size_t n, double *scratch) const {
+		e_.run_batch<double>(compiled_expr::batch_input{nullptr, records, record_stride(), out, size()}, nullptr, n, scratch);
+	}
+
+	std::size_t record_size() const { return p().record_size; }
+	std::size_t record_stride() const { return p().record_stride; }
+	// the compile_options::vars schema the program was compiled with; empty for x y z w
+	const std::vector<var_schema::var> &vars() const { return p().vars; }
+	std::size_t stack_size() const { return p().max_stack; }
+	std::size_t batch_scratch_size() const { return e_.batch_scratch_size(); }
+	std::size_t instruction_count() const { return p().code.size(); }
+	// whether eval() runs native code (compile_options::jit)
+	bool is_native() const { return p().native_outputs != nullptr; }
+
+	// compile_options::profile counts of eval() and operator(), as compiled_expr::profile
+	bool profiling() const { return e_.profiling(); }
+	expr_profile profile() const { return e_.profile(); }
+	void reset_profile() const { e_.reset_profile(); }
+
+private:
+	using program = compiled_expr::program;
+	using ctx = compiled_expr::ctx;
+
+	compiled_expr e_; // holds the program; never evaluated as a single expression
+
+	const program &p() const { return *e_.prog_; }
+
+	static void run(const program &q, const ctx &c, double *st) {
+		if (q.detour) compiled_expr::vm_eval<true>(q, c, st); // profiling
+		else compiled_expr::vm_eval(q, c, st);
+	}
+
+	// the program computing ctx.roots_ (bound and folded, fast_math applied) into out[i], i in
+	// root order, labelled outputs
+	static compiled_multi_expr build(compile_context &ctx, std::vector<std::string> outputs, const compile_options &opts);
+
+	friend std::pair<compiled_multi_expr, std::optional<compile_error>>
+	compile_many(const std::vector<std::string_view> &, compile_context &, const compile_options &);
+	friend std::pair<compiled_multi_expr, std::optional<compile_error>>
+	compile_gradient(std::string_view, compile_context &, const compile_options &);
+	friend class expr_session;
+	friend class detail::program_io;
+};
+
+// single-precision evaluation of a compiled_expr's stack bytecode: records, columns, results,
+// constants and every intermediate are float, calls go to float libm (sinf, ...), and the
+// eval_batch kernels hold twice the lanes per vector at half the memory traffic. the program
+// is shared with the compiled_expr, so parsing, var_schema, folding, cse, range hints and
+// bindings are compile()'s; constants are folded in double and rounded to float once. results
+// differ from the double evaluation by float rounding, and range hints are proven for double
+// arithmetic. operator() and eval run the same float bytecode row by row and match eval_batch
+// bit for bit. profiling and tier-up stay with the double evaluation.
+class compiled_expr_f32 {
+public:
+	compiled_expr_f32() = default;
+	explicit compiled_expr_f32(compiled_expr e) : e_(std::move(e)) {}
+
+	// the record {x, y, z, w}; slots past 3 of a wider var_schema read as 0
+	float operator()(float x, float y, float z, float w) const {
+		const float r[4] = {x, y, z, w};
+		const std::size_t n = p().record_size;
+		if (n <= 4) return eval(r);
+		if (n <= compiled_expr::inline_record_size) {
+			float padded[compiled_expr::inline_record_size];
+			std::copy(r, r + 4, padded);
+			std::fill(padded + 4, padded + n, 0.0f);
+			return eval(padded);
+		}
+		std::vector<float> padded(n, 0.0f); // very wide record: allocate
+		std::copy(r, r + 4, padded.begin());
+		return eval(padded.data());
+	}
+
+	// record_size() floats at record, laid out as for compiled_expr::eval
+	float eval(const float *record) const {
+		const program &q = p();
+		if (q.max_stack <= compiled_expr::inline_stack_size) {
+			float st[compiled_expr::inline_stack_size];
+			return eval(record, st);
+		}
+		std::vector<float> st(q.max_stack);
+		return eval(record, st.data());
+	}
+
+	// same on a caller-supplied stack of at least stack_size() floats
+	float eval(const float *record, float *scratch) const {
+		return compiled_expr::vm_eval<false, float>(p(), ctx{record, nullptr}, scratch);
+	}
+
+	// structure-of-arrays, as compiled_expr::eval_batch(x, y, z, w, out, n)
+	void eval_batch(const float *x, const float *y, const float *z, const float *w, float *out, std::size_t n) const {
+		if (batch_scratch_size() <= compiled_expr::inline_batch_slots * batch_block) {
+			alignas(64) float lanes[compiled_expr::inline_batch_slots * batch_block];
+			eval_batch(x, y, z, w, out, n, lanes);
+			return;
+		}
+		std::vector<float> lanes(batch_scratch_size());
+		eval_batch(x, y, z, w, out, n, lanes.data());
+	}
+
+	// same with a caller-supplied lane stack of at least batch_scratch_size() floats
+	void eval_batch(const float *x, const float *y, const float *z, const float *w, float *out, std::size_t n,
+	                float *scratch) const {
+		const float *four[4] = {x, y, z, w};
+		if (p().record_size <= 4) {
+			e_.run_batch(batch_input{four, nullptr, 0, nullptr, 0}, out, n, scratch);
+			return;
+		}
+		const float *inline_cols[compiled_expr::inline_record_size];
+		const float **cols =
+			compiled_expr::column_table(four, p().record_size, inline_cols, scratch + p().batch_slots * batch_block);
+		e_.run_batch(batch_input{cols, nullptr, 0, nullptr, 0}, out, n, scratch);
+	}
+
+	// array-of-structures, read in place: out[i] = eval(records + i * record_stride())
+	void eval_batch(const float *records, float *out, std::size_t n) const {
+		if (p().batch_slots <= compiled_expr::inline_batch_slots) {
+			alignas(64) float lanes[compiled_expr::inline_batch_slots * batch_block];
+			eval_batch(records, out, n, lanes);
+			return;
+		}
+		std::vector<float> lanes(batch_scratch_size());
+		eval_batch(records, out, n, lanes.data());
+	}
+
+	// same with a caller-supplied lane stack of at least batch_scratch_size() floats
+	void eval_batch(const float *records, float *out, std::size_t n, float *scratch) const {
+		e_.run_batch(batch_input{nullptr, records, p().record_stride, nullptr, 0}, out, n, scratch);
+	}
+
+	static constexpr std::size_t batch_block = compiled_expr::batch_block;
+	std::size_t batch_scratch_size() const {
+		return p().batch_slots * batch_block + compiled_expr::column_tail<float>(p().record_size);
+	}
+	std::size_t stack_size() const { return p().max_stack; }
+	// floats eval() reads from a record, and from one record to the next in eval_batch
+	std::size_t record_size() const { return p().record_size; }
+	std::size_t record_stride() const { return p().record_stride; }
+
+	const std::string &expr() const { return e_.expr(); }
+	// the double-precision expression this one evaluates
+	const compiled_expr &source() const { return e_; }
+
+private:
+	using program = compiled_expr::program;
+	using ctx = compiled_expr::basic_ctx<float>;
+	using batch_input = compiled_expr::basic_batch_input<float>;
+
+	compiled_expr e_;
+
+	const program &p() const { return *e_.prog_; }
+};
+
+// forward
+inline std::pair<compiled_expr, std::optional<compile_error>>
+compile(std::string_view input, compile_context &ctx, const compile_options &opts);
+inline std::pair<compiled_expr, std::optional<compile_error>>
+compile(std::string_view input, compile_context &ctx);
+inline std::pair<compiled_expr, std::optional<compile_error>>
+compile(std::string_view input, const compile_options &opts);
+inline std::pair<compiled_expr, std::optional<compile_error>>
+compile(std::string_view input);
+
+// =============================
+// internals: lexer / parser / folding / bc compiler
+// =============================
+namespace detail {
+
+// ---------- errors ----------
+// first error of a parse. the message is only assembled by to_compile_error(), so rejecting
+// input allocates nothing until a compile_error is actually handed out.
+struct parse_error {
+	compile_errc code = compile_errc::none;
+	std::size_t pos = 0;
+	const char *expected = nullptr; // expected_token: what was missing; invalid_schema/range/binding: what is wrong
+	std::string_view ident;         // unknown_function, wrong_arity, unknown_variable, invalid_schema/range/binding
+	int argc = 0;                   // wrong_arity: arguments the function takes; invalid_var_index: variables
+	std::size_t got = 0;            // wrong_arity: arguments passed
+
+	explicit operator bool() const { return code != compile_errc::none; }
+
+	// records e unless an earlier error is already kept
+	void set(const parse_error &e) {
+		if (code == compile_errc::none) *this = e;
+	}
+
+	std::string message() const {
+		switch (code) {
+			case compile_errc::none: return std::string();
+			case compile_errc::expected_digit: return "Expected digit after '$'";
+			case compile_errc::invalid_var_index: return "Variable index after '$' must be 1.." + std::to_string(argc);
+			case compile_errc::invalid_number: return "Invalid number literal";
+			case compile_errc::unexpected_character: return "Unexpected character";
+			case compile_errc::trailing_input: return "Unexpected token after end of expression";
+			case compile_errc::expected_token: return std::string("Expected ") + expected;
+			case compile_errc::not_a_call: return "Identifier must be a function call like name(...)";
+			case compile_errc::unknown_variable: return "Unknown variable: " + std::string(ident);
+			case compile_errc::unknown_function: return "Unknown or disallowed function: " + std::string(ident);
+			case compile_errc::wrong_arity:
+				return "Function '" + std::string(ident) + "' expects " + std::to_string(argc) + " args, got " + std::to_string(got);
+			case compile_errc::expected_primary: return "Expected primary expression";
+			case compile_errc::invalid_schema: return std::string("Invalid variable schema: ") + expected + " '" + std::string(ident) + "'";
+			case compile_errc::invalid_range: return std::string("Invalid range hint: ") + expected + " '" + std::string(ident) + "'";
+			case compile_errc::invalid_binding: return std::string("Invalid binding: ") + expected + " '" + std::string(ident) + "'";
+			case compile_errc::internal: return "Unknown error";
+		}
+		return "Unknown error";
+	}
+
+	compile_error to_compile_error() const { return compile_error{pos, message(), code}; }
+};
+
+// ---------- tokens ----------
+enum class tok_kind : std::uint8_t {
+	end,
+	error,    // the lexer failed; it keeps returning this
+	number,
+	ident,
+	var,      // var_index: record slot
+	lparen, rparen,
+	comma,
+	plus, minus, star, slash, percent, caret,
+	bang,
+	less, less_eq, greater, greater_eq,
+	eq_eq, bang_eq,
+	and_and, or_or,
+	question, colon
+};
 
 struct token {
 	tok_kind kind = tok_kind::end;
 	std::size_t pos = 0;
 	double number = 0.0;
 	int var_index = -1;
-	std::string ident;
+	std::string_view ident; // points into the source
 };
 
 // ---------- lexer ----------
+// "C" locale character classes, without the locale lookup
+inline bool is_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+inline bool is_alpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+
+// a literal as matched by the lexer: digits [. digits] [e [+-] digits] or . digits [...]
+inline double parse_number(std::string_view lit) {
+	double v = 0.0;
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+	const auto r = std::from_chars(lit.data(), lit.data() + lit.size(), v);
+	if (r.ec == std::errc()) return v;
+#endif
+	// no floating-point from_chars, or the value over/underflows: strtod rounds those the
+	// same way (to inf, 0 or a subnormal), from a NUL-terminated copy
+	char buf[128];
+	if (lit.size() < sizeof buf) {
+		std::memcpy(buf, lit.data(), lit.size());
+		buf[lit.size()] = '\0';
+		return std::strtod(buf, nullptr);
+	}
+	return std::strtod(std::string(lit).c_str(), nullptr);
+}
+
+// with a var_schema every identifier is lexed whole and $n names its n-th variable;
+// without one x y z w are variables wherever they start a token, as they always were
 class lexer {
 public:
-	explicit lexer(std::string_view s) : src_(s) {}
+	lexer(std::string_view s, parse_error &err, const var_schema *vars = nullptr) : src_(s), err_(err), vars_(vars) {}
 
 	const token &peek() {
 		if (!has_peek_) { peek_tok_ = next_impl(); has_peek_ = true; }
@@ -239,22 +1753,37 @@ public:
 
 private:
 	std::string_view src_;
+	parse_error &err_;
+	const var_schema *vars_;
 	std::size_t i_ = 0;
 	bool has_peek_ = false;
+	bool failed_ = false;
 	token peek_tok_;
 
-	static bool is_ident_start(char c) {
-		return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
-	}
-	static bool is_ident_cont(char c) {
-		return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
-	}
+	static bool is_ident_start(char c) { return is_alpha(c) || c == '_'; }
+	static bool is_ident_cont(char c) { return is_alpha(c) || is_digit(c) || c == '_'; }
 
 	void skip_ws() {
-		while (i_ < src_.size() && std::isspace(static_cast<unsigned char>(src_[i_]))) ++i_;
+		while (i_ < src_.size() && is_space(src_[i_])) ++i_;
+	}
+
+	// lexer errors carry no position (pos 0), as they always have
+	token fail(compile_errc code) {
+		parse_error e;
+		e.code = code;
+		e.argc = vars_ ? static_cast<int>(vars_->size()) : 4;
+		err_.set(e);
+		failed_ = true;
+		return next_impl();
 	}
 
 	token next_impl() {
+		if (failed_) {
+			token t;
+			t.kind = tok_kind::error;
+			t.pos = i_;
+			return t;
+		}
 		skip_ws();
 		token t;
 		t.pos = i_;
@@ -291,27 +1820,26 @@ private:
 			default: break;
 		}
 
-		// $1..$4
+		// $1..$4, or $1..$n of a var_schema
 		if (c == '$') {
 			++i_;
 			std::size_t start = i_;
-			if (i_ >= src_.size() || !std::isdigit(static_cast<unsigned char>(src_[i_]))) {
-				throw std::runtime_error("Expected digit after '$'");
-			}
-			int n = 0;
-			while (i_ < src_.size() && std::isdigit(static_cast<unsigned char>(src_[i_]))) {
-				n = n * 10 + (src_[i_] - '0');
+			if (i_ >= src_.size() || !is_digit(src_[i_])) return fail(compile_errc::expected_digit);
+			const std::size_t count = vars_ ? vars_->size() : 4;
+			std::size_t n = 0;
+			while (i_ < src_.size() && is_digit(src_[i_])) {
+				if (n <= count) n = n * 10 + static_cast<std::size_t>(src_[i_] - '0'); // anything past count is rejected anyway
 				++i_;
 			}
-			if (n < 1 || 4 < n) throw std::runtime_error("Variable index after '$' must be 1..4");
+			if (n < 1 || count < n) return fail(compile_errc::invalid_var_index);
 			t.kind = tok_kind::var;
-			t.var_index = n - 1;
+			t.var_index = vars_ ? static_cast<int>(vars_->vars()[n - 1].slot) : static_cast<int>(n - 1);
 			t.pos = start - 1;
 			return t;
 		}
 
 		// x,y,z,w
-		if (c=='x' || c=='y' || c=='z' || c=='w') {
+		if (!vars_ && (c=='x' || c=='y' || c=='z' || c=='w')) {
 			++i_;
 			t.kind = tok_kind::var;
 			t.var_index = (c=='x') ? 0 : (c=='y') ? 1 : (c=='z') ? 2 : 3;
@@ -324,24 +1852,24 @@ private:
 			++i_;
 			while (i_ < src_.size() && is_ident_cont(src_[i_])) ++i_;
 			t.kind = tok_kind::ident;
-			t.ident = std::string(src_.substr(start, i_ - start));
+			t.ident = src_.substr(start, i_ - start);
 			return t;
 		}
 
 		// number
-		if (std::isdigit(static_cast<unsigned char>(c)) || c == '.') {
+		if (is_digit(c) || c == '.') {
 			std::size_t start = i_;
 			bool saw_digit = false;
 
 			if (c == '.') {
 				++i_;
-				while (i_ < src_.size() && std::isdigit(static_cast<unsigned char>(src_[i_]))) { ++i_; saw_digit = true; }
-				if (!saw_digit) throw std::runtime_error("Invalid number literal");
+				while (i_ < src_.size() && is_digit(src_[i_])) { ++i_; saw_digit = true; }
+				if (!saw_digit) return fail(compile_errc::invalid_number);
 			} else {
-				while (i_ < src_.size() && std::isdigit(static_cast<unsigned char>(src_[i_]))) { ++i_; saw_digit = true; }
+				while (i_ < src_.size() && is_digit(src_[i_])) { ++i_; saw_digit = true; }
 				if (i_ < src_.size() && src_[i_] == '.') {
 					++i_;
-					while (i_ < src_.size() && std::isdigit(static_cast<unsigned char>(src_[i_]))) ++i_;
+					while (i_ < src_.size() && is_digit(src_[i_])) ++i_;
 				}
 			}
 
@@ -349,88 +1877,258 @@ private:
 				std::size_t epos = i_;
 				++i_;
 				if (i_ < src_.size() && (src_[i_] == '+' || src_[i_] == '-')) ++i_;
-				if (i_ >= src_.size() || !std::isdigit(static_cast<unsigned char>(src_[i_]))) {
+				if (i_ >= src_.size() || !is_digit(src_[i_])) {
 					i_ = epos;
 				} else {
-					while (i_ < src_.size() && std::isdigit(static_cast<unsigned char>(src_[i_]))) ++i_;
+					while (i_ < src_.size() && is_digit(src_[i_])) ++i_;
 				}
 			}
 
-			std::string num_str(src_.substr(start, i_ - start));
-			char *endp = nullptr;
-			double val = std::strtod(num_str.c_str(), &endp);
-			if (!endp || endp == num_str.c_str()) throw std::runtime_error("Failed to parse number");
-
 			t.kind = tok_kind::number;
-			t.number = val;
+			t.number = parse_number(src_.substr(start, i_ - start));
 			t.pos = start;
 			return t;
 		}
 
-		throw std::runtime_error("Unexpected character");
+		return fail(compile_errc::unexpected_character);
 	}
 };
 
 // ---------- function whitelist ----------
 struct func_spec { int fid; int argc; };
 
-inline const std::unordered_map<std::string, func_spec>& func_table() {
-	// fid must match compiled_expr::op::call dispatch
-	static const std::unordered_map<std::string, func_spec> tbl = {
-		{"sin",   {0, 1}}, {"cos",   {1, 1}}, {"tan",   {2, 1}},
-		{"asin",  {3, 1}}, {"acos",  {4, 1}}, {"atan",  {5, 1}},
-		{"exp",   {6, 1}}, {"log",   {7, 1}}, {"log10", {8, 1}},
-		{"sqrt",  {9, 1}}, {"abs",   {10,1}}, {"floor", {11,1}},
-		{"ceil",  {12,1}}, {"round", {13,1}},
-		{"pow",   {14,2}}, {"atan2", {15,2}}, {"fmod",  {16,2}},
-		{"min",   {17,2}}, {"max",   {18,2}},
-	};
-	return tbl;
+// fid of a whitelisted function (matching the op::call_* order), or {-1, 0}. a switch on
+// length and first letter, so each lookup is at most two string compares; constexpr so
+// static_expr resolves names with the same table.
+constexpr func_spec find_func(std::string_view s) {
+	switch (s.size()) {
+		case 3:
+			switch (s[0]) {
+				case 's': if (s == "sin") return {0, 1}; break;
+				case 'c': if (s == "cos") return {1, 1}; break;
+				case 't': if (s == "tan") return {2, 1}; break;
+				case 'e': if (s == "exp") return {6, 1}; break;
+				case 'l': if (s == "log") return {7, 1}; break;
+				case 'a': if (s == "abs") return {10, 1}; break;
+				case 'p': if (s == "pow") return {14, 2}; break;
+				case 'm':
+					if (s == "min") return {17, 2};
+					if (s == "max") return {18, 2};
+					break;
+				default: break;
+			}
+			break;
+		case 4:
+			switch (s[0]) {
+				case 'a':
+					if (s == "asin") return {3, 1};
+					if (s == "acos") return {4, 1};
+					if (s == "atan") return {5, 1};
+					break;
+				case 's': if (s == "sqrt") return {9, 1}; break;
+				case 'c': if (s == "ceil") return {12, 1}; break;
+				case 'f': if (s == "fmod") return {16, 2}; break;
+				default: break;
+			}
+			break;
+		case 5:
+			switch (s[0]) {
+				case 'l': if (s == "log10") return {8, 1}; break;
+				case 'f': if (s == "floor") return {11, 1}; break;
+				case 'r': if (s == "round") return {13, 1}; break;
+				case 'a': if (s == "atan2") return {15, 2}; break;
+				default: break;
+			}
+			break;
+		default: break;
+	}
+	return {-1, 0};
 }
 
 // ---------- ast (compile-time only) ----------
-struct node { virtual ~node() = default; };
-using node_ptr = std::unique_ptr<node>;
+// nodes are trivially destructible and owned by a node_arena. kind names the derived type,
+// so the passes below switch on it and static_cast instead of probing with dynamic_cast.
+enum class node_kind : std::uint8_t { num, var, unary, binary, ternary, call, fma, shared, ref };
+struct node {
+	node_kind kind;
+	std::size_t pos;
+	std::uint32_t id = 0; // value number assigned by cse_pass
+};
 
-struct num_node : node { double n; std::size_t pos; num_node(double v, std::size_t p): n(v), pos(p) {} };
-struct var_node : node { int index; std::size_t pos; var_node(int i, std::size_t p): index(i), pos(p) {} };
+struct num_node : node { double n; num_node(double v, std::size_t p): node{node_kind::num, p}, n(v) {} };
+struct var_node : node { int index; var_node(int i, std::size_t p): node{node_kind::var, p}, index(i) {} };
 
 enum class un_op : std::uint8_t { plus, minus, logical_not, to_bool };
-struct unary_node : node { un_op op; std::size_t pos; node_ptr a; unary_node(un_op o, std::size_t p, node_ptr x): op(o), pos(p), a(std::move(x)) {} };
+struct unary_node : node { un_op op; node *a; unary_node(un_op o, std::size_t p, node *x): node{node_kind::unary, p}, op(o), a(x) {} };
 
 enum class bin_op : std::uint8_t {
 	add, sub, mul, div_, mod, pow,
 	lt, le, gt, ge, eq, ne,
 	and_and, or_or
 };
-struct binary_node : node { bin_op op; std::size_t pos; node_ptr l, r; binary_node(bin_op o, std::size_t p, node_ptr a, node_ptr b): op(o), pos(p), l(std::move(a)), r(std::move(b)) {} };
+struct binary_node : node { bin_op op; node *l, *r; binary_node(bin_op o, std::size_t p, node *a, node *b): node{node_kind::binary, p}, op(o), l(a), r(b) {} };
 
-struct ternary_node : node { std::size_t pos; node_ptr c, t, f; ternary_node(std::size_t p, node_ptr cc, node_ptr tt, node_ptr ff): pos(p), c(std::move(cc)), t(std::move(tt)), f(std::move(ff)) {} };
+struct ternary_node : node { node *c, *t, *f; ternary_node(std::size_t p, node *cc, node *tt, node *ff): node{node_kind::ternary, p}, c(cc), t(tt), f(ff) {} };
 
 struct call_node : node {
 	int fid;
-	int argc;
-	std::size_t pos;
-	std::vector<node_ptr> args;
-	call_node(int f, int a, std::size_t p, std::vector<node_ptr> as): fid(f), argc(a), pos(p), args(std::move(as)) {}
+	int argc;     // 1 or 2: every whitelisted function takes at most two arguments
+	node *args[2];
+	call_node(int f, int a, std::size_t p, node *a0, node *a1): node{node_kind::call, p}, fid(f), argc(a), args{a0, a1} {}
+};
+
+// a * b + c with one rounding; made by fast_math_pass only
+struct fma_node : node { node *a, *b, *c; fma_node(std::size_t p, node *x, node *y, node *z): node{node_kind::fma, p}, a(x), b(y), c(z) {} };
+
+// made by cse_pass only: a value computed once and read back by every ref_node to it
+struct shared_node : node {
+	node *value;
+	std::uint32_t index; // numbers the shared_nodes of one tree from 0
+	int uses = 0;        // ref_nodes reading it; each reads after the value was computed
+	shared_node(node *v, std::uint32_t i, std::size_t p): node{node_kind::shared, p}, value(v), index(i) {}
+};
+struct ref_node : node { const shared_node *def; ref_node(const shared_node *d, std::size_t p): node{node_kind::ref, p}, def(d) {} };
+
+// bump allocator for ast nodes. reset() releases every node at once and keeps the blocks,
+// so a reused arena stops allocating once it has seen its largest expression.
+class node_arena {
+public:
+	node_arena() = default;
+	node_arena(const node_arena &) = delete;
+	node_arena &operator=(const node_arena &) = delete;
+
+	template <class T, class... Args>
+	T *make(Args &&...args) {
+		static_assert(std::is_trivially_destructible<T>::value, "arena nodes are never destroyed");
+		return ::new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	void reset() {
+		in_use_ = 0;
+		used_ = 0;
+	}
+
+private:
+	// blocks grow geometrically from 1 KiB to 64 KiB
+	static std::size_t block_size(std::size_t i) { return std::size_t(1024) << (i < 6 ? i : 6); }
+
+	std::vector<std::unique_ptr<unsigned char[]>> blocks_;
+	std::size_t in_use_ = 0; // blocks handed out since reset(); the last one is being filled
+	std::size_t used_ = 0;   // bytes taken from blocks_[in_use_ - 1]
+
+	void *allocate(std::size_t size, std::size_t align) {
+		std::size_t at = (used_ + align - 1) & ~(align - 1);
+		if (in_use_ == 0 || at + size > block_size(in_use_ - 1)) {
+			if (in_use_ == blocks_.size()) blocks_.emplace_back(new unsigned char[block_size(in_use_)]);
+			++in_use_;
+			at = 0;
+		}
+		used_ = at + size;
+		return blocks_[in_use_ - 1].get() + at;
+	}
 };
 
+// a copy of the tree in fresh nodes: passes rewrite nodes in place, so a subtree used twice
+// is copied first
+inline node *clone_tree(const node *n, node_arena &arena) {
+	switch (n->kind) {
+		case node_kind::num: return arena.make<num_node>(*static_cast<const num_node *>(n));
+		case node_kind::var: return arena.make<var_node>(*static_cast<const var_node *>(n));
+		case node_kind::unary: {
+			auto p = static_cast<const unary_node *>(n);
+			return arena.make<unary_node>(p->op, p->pos, clone_tree(p->a, arena));
+		}
+		case node_kind::binary: {
+			auto p = static_cast<const binary_node *>(n);
+			node *l = clone_tree(p->l, arena);
+			return arena.make<binary_node>(p->op, p->pos, l, clone_tree(p->r, arena));
+		}
+		case node_kind::ternary: {
+			auto p = static_cast<const ternary_node *>(n);
+			node *c = clone_tree(p->c, arena), *t = clone_tree(p->t, arena);
+			return arena.make<ternary_node>(p->pos, c, t, clone_tree(p->f, arena));
+		}
+		case node_kind::call: {
+			auto p = static_cast<const call_node *>(n);
+			node *a0 = clone_tree(p->args[0], arena);
+			return arena.make<call_node>(p->fid, p->argc, p->pos, a0, p->argc == 2 ? clone_tree(p->args[1], arena) : nullptr);
+		}
+		case node_kind::fma: {
+			auto p = static_cast<const fma_node *>(n);
+			node *a = clone_tree(p->a, arena), *b = clone_tree(p->b, arena);
+			return arena.make<fma_node>(p->pos, a, b, clone_tree(p->c, arena));
+		}
+		case node_kind::shared:
+		case node_kind::ref:
+			break; // cse_pass runs later
+	}
+	return const_cast<node *>(n);
+}
+
+// ---------- variable schema ----------
+// the record slot name reads, as the parser resolves it: x y z w without a schema
+inline bool resolve_slot(std::string_view name, const var_schema *vars, std::size_t &slot) {
+	if (vars) {
+		const var_schema::var *v = vars->find(name);
+		if (v) slot = v->slot;
+		return v != nullptr;
+	}
+	if (name.size() != 1 || name[0] < 'w' || name[0] > 'z') return false;
+	slot = name[0] == 'w' ? 3 : static_cast<std::size_t>(name[0] - 'x');
+	return true;
+}
+
+// the first problem with a compile_options::vars schema; reported at pos 0 like lexer errors
+inline parse_error check_schema(const var_schema &vars) {
+	parse_error e;
+	const std::vector<var_schema::var> &vs = vars.vars();
+	for (std::size_t i = 0; i < vs.size() && !e; ++i) {
+		const std::string &name = vs[i].name;
+		bool ident = !name.empty() && (is_alpha(name[0]) || name[0] == '_');
+		for (char c : name) ident = ident && (is_alpha(c) || is_digit(c) || c == '_');
+		if (!ident) e.expected = "not an identifier";
+		else if (vs[i].slot >= var_schema::max_slot) e.expected = "slot out of range for";
+		for (std::size_t j = 0; j < i && !e.expected; ++j) {
+			if (vs[j].name == name) e.expected = "duplicate variable";
+		}
+		if (e.expected) {
+			e.code = compile_errc::invalid_schema;
+			e.ident = name;
+		}
+	}
+	return e;
+}
+
 // ---------- parser ----------
+// recursive descent without exceptions: every parse_* returns nullptr once an error is
+// recorded, and callers return straight away, so the first error is the one reported.
 class parser {
 public:
-	explicit parser(std::string_view s) : lex_(s) {}
+	parser(std::string_view s, node_arena &arena, const var_schema *vars = nullptr) : lex_(s, err_, vars), arena_(arena), vars_(vars) {}
 
-	node_ptr parse_all() {
-		auto n = parse_expr();
-		if (lex_.peek().kind != tok_kind::end) fail(lex_.peek().pos, "Unexpected token after end of expression");
+	// nullptr on failure; error() then says why
+	node *parse_all() {
+		node *n = parse_expr();
+		if (!n) return nullptr;
+		if (lex_.peek().kind != tok_kind::end) return fail(lex_.peek().pos, compile_errc::trailing_input);
 		return n;
 	}
 
+	const parse_error &error() const { return err_; }
+
 private:
+	parse_error err_; // before lex_, which holds a reference to it
 	lexer lex_;
-
-	[[noreturn]] void fail(std::size_t pos, const std::string &msg) {
-		throw std::runtime_error(std::to_string(pos) + ":" + msg);
+	node_arena &arena_;
+	const var_schema *vars_;
+
+	// a lexer error seen on the way here has already been recorded and wins
+	node *fail(std::size_t pos, compile_errc code) {
+		parse_error e;
+		e.code = code;
+		e.pos = pos;
+		err_.set(e);
+		return nullptr;
 	}
 
 	bool accept(tok_kind k) {
@@ -438,506 +2136,3119 @@ private:
 		return false;
 	}
 
-	token expect(tok_kind k, const char *what) {
+	bool expect(tok_kind k, const char *what) {
 		token t = lex_.next();
-		if (t.kind != k) fail(t.pos, std::string("Expected ") + what);
-		return t;
+		if (t.kind == k) return true;
+		parse_error e;
+		e.code = compile_errc::expected_token;
+		e.pos = t.pos;
+		e.expected = what;
+		err_.set(e);
+		return false;
 	}
 
-	node_ptr parse_expr() { return parse_conditional(); }
+	node *parse_expr() { return parse_conditional(); }
 
-	node_ptr parse_conditional() {
-		auto c = parse_logical_or();
+	node *parse_conditional() {
+		node *c = parse_logical_or();
+		if (!c) return nullptr;
 		if (accept(tok_kind::question)) {
 			std::size_t p = lex_.peek().pos;
-			auto t = parse_expr();
-			expect(tok_kind::colon, "':' in conditional operator");
-			auto f = parse_conditional();
-			return std::make_unique<ternary_node>(p, std::move(c), std::move(t), std::move(f));
+			node *t = parse_expr();
+			if (!t || !expect(tok_kind::colon, "':' in conditional operator")) return nullptr;
+			node *f = parse_conditional();
+			if (!f) return nullptr;
+			return arena_.make<ternary_node>(p, c, t, f);
 		}
 		return c;
 	}
 
-	node_ptr parse_logical_or() {
-		auto n = parse_logical_and();
-		while (accept(tok_kind::or_or)) {
+	// one left-associative level: operands from (this->*sub)(), operators from ops
+	struct bin_tok { tok_kind tok; bin_op op; };
+	template <std::size_t N>
+	node *parse_left(node *(parser::*sub)(), const bin_tok (&ops)[N]) {
+		node *n = (this->*sub)();
+		while (n) {
+			const bin_tok *hit = nullptr;
+			for (const bin_tok &o : ops) {
+				if (accept(o.tok)) {
+					hit = &o;
+					break;
+				}
+			}
+			if (!hit) break;
 			std::size_t p = lex_.peek().pos;
-			auto r = parse_logical_and();
-			n = std::make_unique<binary_node>(bin_op::or_or, p, std::move(n), std::move(r));
+			node *r = (this->*sub)();
+			if (!r) return nullptr;
+			n = arena_.make<binary_node>(hit->op, p, n, r);
 		}
 		return n;
 	}
 
-	node_ptr parse_logical_and() {
-		auto n = parse_equality();
-		while (accept(tok_kind::and_and)) {
+	node *parse_logical_or() {
+		static constexpr bin_tok ops[] = {{tok_kind::or_or, bin_op::or_or}};
+		return parse_left(&parser::parse_logical_and, ops);
+	}
+
+	node *parse_logical_and() {
+		static constexpr bin_tok ops[] = {{tok_kind::and_and, bin_op::and_and}};
+		return parse_left(&parser::parse_equality, ops);
+	}
+
+	node *parse_equality() {
+		static constexpr bin_tok ops[] = {{tok_kind::eq_eq, bin_op::eq}, {tok_kind::bang_eq, bin_op::ne}};
+		return parse_left(&parser::parse_relational, ops);
+	}
+
+	node *parse_relational() {
+		static constexpr bin_tok ops[] = {
+			{tok_kind::less, bin_op::lt}, {tok_kind::less_eq, bin_op::le},
+			{tok_kind::greater, bin_op::gt}, {tok_kind::greater_eq, bin_op::ge},
+		};
+		return parse_left(&parser::parse_additive, ops);
+	}
+
+	node *parse_additive() {
+		static constexpr bin_tok ops[] = {{tok_kind::plus, bin_op::add}, {tok_kind::minus, bin_op::sub}};
+		return parse_left(&parser::parse_multiplicative, ops);
+	}
+
+	node *parse_multiplicative() {
+		static constexpr bin_tok ops[] = {
+			{tok_kind::star, bin_op::mul}, {tok_kind::slash, bin_op::div_}, {tok_kind::percent, bin_op::mod},
+		};
+		return parse_left(&parser::parse_unary, ops);
+	}
+
+	node *parse_unary() {
+		un_op o;
+		if (accept(tok_kind::plus)) o = un_op::plus;
+		else if (accept(tok_kind::minus)) o = un_op::minus;
+		else if (accept(tok_kind::bang)) o = un_op::logical_not;
+		else return parse_power();
+		std::size_t p = lex_.peek().pos;
+		node *a = parse_unary();
+		if (!a) return nullptr;
+		return arena_.make<unary_node>(o, p, a);
+	}
+
+	node *parse_power() {
+		node *n = parse_primary();
+		if (n && accept(tok_kind::caret)) {
 			std::size_t p = lex_.peek().pos;
-			auto r = parse_equality();
-			n = std::make_unique<binary_node>(bin_op::and_and, p, std::move(n), std::move(r));
+			node *r = parse_unary();
+			if (!r) return nullptr;
+			n = arena_.make<binary_node>(bin_op::pow, p, n, r);
+		}
+		return n;
+	}
+
+	node *parse_primary() {
+		const token &t = lex_.peek();
+		switch (t.kind) {
+			case tok_kind::number: {
+				token tt = lex_.next();
+				return arena_.make<num_node>(tt.number, tt.pos);
+			}
+			case tok_kind::var: {
+				token tt = lex_.next();
+				return arena_.make<var_node>(tt.var_index, tt.pos);
+			}
+			case tok_kind::ident: {
+				token id = lex_.next();
+				if (!accept(tok_kind::lparen)) {
+					if (!vars_) return fail(id.pos, compile_errc::not_a_call);
+					if (const var_schema::var *v = vars_->find(id.ident)) return arena_.make<var_node>(static_cast<int>(v->slot), id.pos);
+					parse_error e;
+					e.code = compile_errc::unknown_variable;
+					e.pos = id.pos;
+					e.ident = id.ident;
+					err_.set(e);
+					return nullptr;
+				}
+				const func_spec spec = find_func(id.ident);
+				if (spec.fid < 0) {
+					parse_error e;
+					e.code = compile_errc::unknown_function;
+					e.pos = id.pos;
+					e.ident = id.ident;
+					err_.set(e);
+					return nullptr;
+				}
+
+				node *args[2] = {nullptr, nullptr};
+				std::size_t argn = 0; // every argument is parsed (and checked); the first two are kept
+				if (!accept(tok_kind::rparen)) {
+					do {
+						node *a = parse_expr();
+						if (!a) return nullptr;
+						if (argn < 2) args[argn] = a;
+						++argn;
+					} while (accept(tok_kind::comma));
+					if (!expect(tok_kind::rparen, "')' to close function call")) return nullptr;
+				}
+
+				if (static_cast<int>(argn) != spec.argc) {
+					parse_error e;
+					e.code = compile_errc::wrong_arity;
+					e.pos = id.pos;
+					e.ident = id.ident;
+					e.argc = spec.argc;
+					e.got = argn;
+					err_.set(e);
+					return nullptr;
+				}
+				return arena_.make<call_node>(spec.fid, spec.argc, id.pos, args[0], args[1]);
+			}
+			case tok_kind::lparen: {
+				(void)lex_.next();
+				node *n = parse_expr();
+				if (!n || !expect(tok_kind::rparen, "')'")) return nullptr;
+				return n;
+			}
+			default:
+				return fail(t.pos, compile_errc::expected_primary);
+		}
+	}
+};
+
+// ---------- constant folding (safe set) ----------
+inline bool is_num(const node &n, double *out = nullptr) {
+	if (n.kind != node_kind::num) return false;
+	if (out) *out = static_cast<const num_node &>(n).n;
+	return true;
+}
+
+inline double b2d(bool v) { return v ? 1.0 : 0.0; }
+inline bool truth(double v) { return v != 0.0; }
+
+// T: double, or float for compiled_expr_f32
+template <class T>
+inline T eval_func(int fid, T a) {
+	switch (fid) {
+		case 0: return std::sin(a);
+		case 1: return std::cos(a);
+		case 2: return std::tan(a);
+		case 3: return std::asin(a);
+		case 4: return std::acos(a);
+		case 5: return std::atan(a);
+		case 6: return std::exp(a);
+		case 7: return std::log(a);
+		case 8: return std::log10(a);
+		case 9: return std::sqrt(a);
+		case 10: return std::fabs(a);
+		case 11: return std::floor(a);
+		case 12: return std::ceil(a);
+		case 13: return std::round(a);
+		default: return std::numeric_limits<T>::quiet_NaN();
+	}
+}
+
+template <class T>
+inline T eval_func(int fid, T a, T b) {
+	switch (fid) {
+		case 14: return std::pow(a,b);
+		case 15: return std::atan2(a,b);
+		case 16: return std::fmod(a,b);
+		case 17: return (a<b) ? a : b;
+		case 18: return (b < a) ? a : b;
+		default: return std::numeric_limits<T>::quiet_NaN();
+	}
+}
+
+// rewrites the tree in place where it can; replacement nodes come from arena
+inline node *fold_constants(node *n, node_arena &arena) {
+	if (!n) return n;
+
+	switch (n->kind) {
+		case node_kind::num:
+		case node_kind::var:
+		case node_kind::shared: // cse_pass runs after folding
+		case node_kind::ref:
+			return n;
+
+		case node_kind::unary: {
+			auto p = static_cast<unary_node *>(n);
+			p->a = fold_constants(p->a, arena);
+
+			double av = 0.0;
+			if (is_num(*p->a, &av)) {
+				switch (p->op) {
+					case un_op::plus:  return arena.make<num_node>(+av, p->pos);
+					case un_op::minus: return arena.make<num_node>(-av, p->pos);
+					case un_op::logical_not: return arena.make<num_node>(b2d(!truth(av)), p->pos);
+					case un_op::to_bool: return arena.make<num_node>(b2d(truth(av)), p->pos);
+				}
+			}
+
+			if (p->op == un_op::plus) return p->a; // +x -> x
+			return n;
+		}
+
+		case node_kind::call: {
+			auto p = static_cast<call_node *>(n);
+			for (int i = 0; i < p->argc; ++i) p->args[i] = fold_constants(p->args[i], arena);
+
+			if (p->argc == 1) {
+				double a0 = 0.0;
+				if (is_num(*p->args[0], &a0)) {
+					return arena.make<num_node>(eval_func(p->fid, a0), p->pos);
+				}
+			} else if (p->argc == 2) {
+				double a0 = 0.0, a1 = 0.0;
+				if (is_num(*p->args[0], &a0) && is_num(*p->args[1], &a1)) {
+					return arena.make<num_node>(eval_func(p->fid, a0, a1), p->pos);
+				}
+			}
+			return n;
+		}
+
+		case node_kind::fma: {
+			auto p = static_cast<fma_node *>(n);
+			p->a = fold_constants(p->a, arena);
+			p->b = fold_constants(p->b, arena);
+			p->c = fold_constants(p->c, arena);
+			double a = 0.0, b = 0.0, c = 0.0;
+			if (is_num(*p->a, &a) && is_num(*p->b, &b) && is_num(*p->c, &c)) return arena.make<num_node>(std::fma(a, b, c), p->pos);
+			return n;
+		}
+
+		case node_kind::ternary: {
+			auto p = static_cast<ternary_node *>(n);
+			p->c = fold_constants(p->c, arena);
+
+			double cv = 0.0;
+			if (is_num(*p->c, &cv)) {
+				if (truth(cv)) return fold_constants(p->t, arena);
+				return fold_constants(p->f, arena);
+			}
+
+			p->t = fold_constants(p->t, arena);
+			p->f = fold_constants(p->f, arena);
+			return n;
+		}
+
+		case node_kind::binary: {
+			auto p = static_cast<binary_node *>(n);
+			p->l = fold_constants(p->l, arena);
+
+			if (p->op == bin_op::and_and) {
+				double lv = 0.0;
+				if (is_num(*p->l, &lv)) {
+					if (!truth(lv)) {
+						return arena.make<num_node>(0.0, p->pos);
+					} else {
+						p->r = fold_constants(p->r, arena);
+						return arena.make<unary_node>(un_op::to_bool, p->pos, p->r);
+					}
+				}
+				p->r = fold_constants(p->r, arena);
+				return n;
+			}
+
+			if (p->op == bin_op::or_or) {
+				double lv = 0.0;
+				if (is_num(*p->l, &lv)) {
+					if (truth(lv)) {
+						return arena.make<num_node>(1.0, p->pos);
+					} else {
+						p->r = fold_constants(p->r, arena);
+						return arena.make<unary_node>(un_op::to_bool, p->pos, p->r);
+					}
+				}
+				p->r = fold_constants(p->r, arena);
+				return n;
+			}
+
+			p->r = fold_constants(p->r, arena);
+
+			double a = 0.0, b = 0.0;
+			if (is_num(*p->l, &a) && is_num(*p->r, &b)) {
+				double res = std::numeric_limits<double>::quiet_NaN();
+				switch (p->op) {
+					case bin_op::add: res = a + b; break;
+					case bin_op::sub: res = a - b; break;
+					case bin_op::mul: res = a * b; break;
+					case bin_op::div_: res = a / b; break;
+					case bin_op::mod: res = std::fmod(a, b); break;
+					case bin_op::pow: res = std::pow(a, b); break;
+
+					case bin_op::lt: res = b2d(a <  b); break;
+					case bin_op::le: res = b2d(a <= b); break;
+					case bin_op::gt: res = b2d(b <  a); break;
+					case bin_op::ge: res = b2d(b <= a); break;
+					case bin_op::eq: res = b2d(a == b); break;
+					case bin_op::ne: res = b2d(a != b); break;
+
+					case bin_op::and_and:
+					case bin_op::or_or:
+						break;
+				}
+				return arena.make<num_node>(res, p->pos);
+			}
+
+			return n;
+		}
+	}
+
+	return n;
+}
+
+// ---------- bound variables ----------
+// compile_options::bound: runs on the parsed tree, so everything downstream sees literals
+class bind_pass {
+public:
+	parse_error bind(const var_bindings &b, const var_schema *vars) {
+		bound_.clear();
+		parse_error e;
+		for (const var_bindings::binding &v : b.bindings()) {
+			std::size_t slot = 0;
+			if (!resolve_slot(v.name, vars, slot)) e.expected = "unknown variable";
+			else if (slot < bound_.size() && bound_[slot].set) e.expected = "duplicate variable";
+			if (e.expected) {
+				e.code = compile_errc::invalid_binding;
+				e.ident = v.name;
+				return e;
+			}
+			if (bound_.size() <= slot) bound_.resize(slot + 1);
+			bound_[slot] = value{v.value, true};
+		}
+		return e;
+	}
+
+	// returns the tree with every bound variable a num_node; new nodes come from arena
+	node *run(node *n, node_arena &arena) {
+		switch (n->kind) {
+			case node_kind::var: {
+				const std::size_t slot = static_cast<std::size_t>(static_cast<var_node *>(n)->index);
+				if (slot < bound_.size() && bound_[slot].set) return arena.make<num_node>(bound_[slot].v, n->pos);
+				return n;
+			}
+			case node_kind::unary: {
+				auto p = static_cast<unary_node *>(n);
+				p->a = run(p->a, arena);
+				return n;
+			}
+			case node_kind::binary: {
+				auto p = static_cast<binary_node *>(n);
+				p->l = run(p->l, arena);
+				p->r = run(p->r, arena);
+				return n;
+			}
+			case node_kind::ternary: {
+				auto p = static_cast<ternary_node *>(n);
+				p->c = run(p->c, arena);
+				p->t = run(p->t, arena);
+				p->f = run(p->f, arena);
+				return n;
+			}
+			case node_kind::call: {
+				auto p = static_cast<call_node *>(n);
+				for (int i = 0; i < p->argc; ++i) p->args[i] = run(p->args[i], arena);
+				return n;
+			}
+			default: // num; fma, shared and ref come from later passes
+				return n;
+		}
+	}
+
+private:
+	struct value {
+		double v = 0.0;
+		bool set = false;
+	};
+	std::vector<value> bound_; // by slot
+};
+
+// ---------- range analysis ----------
+// what a node can evaluate to: the closed interval holding its non-NaN values (zeros compare
+// equal there), whether one of them may be -0, and whether it may be NaN
+struct interval {
+	double lo = -std::numeric_limits<double>::infinity();
+	double hi = std::numeric_limits<double>::infinity();
+	bool neg_zero = true;
+	bool nan = true;
+
+	static interval any() { return interval{}; }
+	// values in [lo, hi]; neg_zero if the interval holds a zero. NaN bounds (inf - inf, 0 * inf)
+	// leave that side open
+	static interval of(double lo, double hi, bool nan) {
+		interval r;
+		r.lo = lo == lo ? lo : -std::numeric_limits<double>::infinity();
+		r.hi = hi == hi ? hi : std::numeric_limits<double>::infinity();
+		r.neg_zero = r.has_zero();
+		r.nan = nan;
+		return r;
+	}
+	static interval point(double v) {
+		if (v != v) return any();
+		interval r = of(v, v, false);
+		r.neg_zero = std::signbit(v) && v == 0.0;
+		return r;
+	}
+	static interval flag(int known) { return known < 0 ? of(0.0, 1.0, false) : point(b2d(known != 0)); }
+
+	bool has_zero() const { return lo <= 0.0 && 0.0 <= hi; }
+	bool infinite() const { return lo == -std::numeric_limits<double>::infinity() || hi == std::numeric_limits<double>::infinity(); }
+	double max_abs() const { return std::max(std::fabs(lo), std::fabs(hi)); }
+	double min_abs() const { return has_zero() ? 0.0 : std::min(std::fabs(lo), std::fabs(hi)); }
+	// truth(v) for every value; NaN is true
+	bool surely_true() const { return !has_zero(); }
+	bool surely_false() const { return lo == 0.0 && hi == 0.0 && !nan; }
+	// the one value it can take, bits included
+	bool constant(double *v) const {
+		if (nan || lo != hi || (lo == 0.0 && neg_zero)) return false;
+		*v = lo == 0.0 ? 0.0 : lo; // a zero bound of either sign stands for +0 here
+		return true;
+	}
+
+	interval join(const interval &o) const {
+		interval r;
+		r.lo = std::min(lo, o.lo);
+		r.hi = std::max(hi, o.hi);
+		r.neg_zero = neg_zero || o.neg_zero;
+		r.nan = nan || o.nan;
+		return r;
+	}
+};
+
+// compile_options::ranges: abstract interpretation of the folded tree over intervals, seeded
+// with the hints. a node the intervals decide becomes a constant: a comparison of disjoint
+// ranges, a ?: && || whose condition cannot be 0 (or can only be 0) loses the arm it rules
+// out, and calls that reduce to an operand are replaced by it (abs(x) -> x for x >= +0,
+// min/max of disjoint operands, fmod(a, b) -> a for |a| < |b|). inside the arms of a
+// comparison between a variable and a constant the variable is narrowed accordingly.
+// every rewrite gives the bits the original would for inputs within the hints; libm
+// results are widened by two ulps, the correctly rounded operators are not.
+class range_pass {
+public:
+	// resolves the hints against the variables compile() will see
+	parse_error bind(const range_hints &hints, const var_schema *vars) {
+		vars_.clear();
+		parse_error e;
+		for (const range_hints::range &r : hints.ranges()) {
+			std::size_t slot = 0;
+			if (!resolve_slot(r.name, vars, slot)) e.expected = "unknown variable";
+			// [+0, -0] is empty too: bounds order -0 below +0
+			const bool zeros = r.lo == 0.0 && r.hi == 0.0 && !std::signbit(r.lo) && std::signbit(r.hi);
+			if (!e.expected && (!(r.lo <= r.hi) || zeros)) e.expected = "empty range for";
+			if (!e.expected) {
+				if (vars_.size() <= slot) vars_.resize(slot + 1);
+				if (vars_[slot].nan) {
+					vars_[slot] = interval::of(r.lo, r.hi, false);
+					vars_[slot].neg_zero = (r.lo < 0.0 || std::signbit(r.lo)) && r.hi >= 0.0;
+				} else {
+					e.expected = "duplicate variable";
+				}
+			}
+			if (e.expected) {
+				e.code = compile_errc::invalid_range;
+				e.ident = r.name;
+				return e;
+			}
+		}
+		return e;
+	}
+
+	// returns the rewritten tree; new nodes come from arena. fast_math: signed zeros may change
+	node *run(node *root, node_arena &arena, bool fast_math) {
+		arena_ = &arena;
+		fast_ = fast_math;
+		interval r;
+		return visit(root, r);
+	}
+
+private:
+	std::vector<interval> vars_; // by slot; any() where no hint applies
+	node_arena *arena_ = nullptr;
+	bool fast_ = false;
+
+	static constexpr double inf = std::numeric_limits<double>::infinity();
+
+	// the variable a ?: && || condition compares against a constant, narrowed for each outcome
+	struct narrowing {
+		int slot = -1;
+		interval when_true, when_false;
+	};
+
+	interval var(int slot) const {
+		return static_cast<std::size_t>(slot) < vars_.size() ? vars_[slot] : interval::any();
+	}
+
+	// two ulps outward: libm results are not always correctly rounded
+	static double down(double v) { return std::nextafter(std::nextafter(v, -inf), -inf); }
+	static double up(double v) { return std::nextafter(std::nextafter(v, inf), inf); }
+
+	static interval clipped(interval v, double lo, double hi, bool nan) {
+		v.lo = std::max(v.lo, lo);
+		v.hi = std::min(v.hi, hi);
+		v.neg_zero = v.neg_zero && v.has_zero();
+		v.nan = nan;
+		return v;
+	}
+
+	narrowing narrow(const node *c) const {
+		narrowing r;
+		if (c->kind != node_kind::binary) return r;
+		const auto *p = static_cast<const binary_node *>(c);
+		bin_op o = p->op;
+		const node *v = p->l, *k = p->r;
+		if (v->kind == node_kind::num) { // k op x as x op' k
+			std::swap(v, k);
+			switch (o) {
+				case bin_op::lt: o = bin_op::gt; break;
+				case bin_op::le: o = bin_op::ge; break;
+				case bin_op::gt: o = bin_op::lt; break;
+				case bin_op::ge: o = bin_op::le; break;
+				default: break;
+			}
+		}
+		double kv = 0.0;
+		if (v->kind != node_kind::var || !is_num(*k, &kv) || kv != kv) return r;
+		const int slot = static_cast<const var_node *>(v)->index;
+		const interval x = var(slot);
+		const double below = std::nextafter(kv, -inf), above = std::nextafter(kv, inf);
+		interval t = x, f = x;
+		switch (o) {
+			case bin_op::lt: t = clipped(x, -inf, below, false); f = clipped(x, kv, inf, x.nan); break;
+			case bin_op::le: t = clipped(x, -inf, kv, false); f = clipped(x, above, inf, x.nan); break;
+			case bin_op::gt: t = clipped(x, above, inf, false); f = clipped(x, -inf, kv, x.nan); break;
+			case bin_op::ge: t = clipped(x, kv, inf, false); f = clipped(x, -inf, below, x.nan); break;
+			case bin_op::eq: t = clipped(x, kv, kv, false); break;
+			case bin_op::ne: f = clipped(x, kv, kv, false); break;
+			default: return r;
+		}
+		if (t.lo > t.hi || f.lo > f.hi) return r; // an arm the analysis could not rule out
+		r.slot = slot;
+		r.when_true = t;
+		r.when_false = f;
+		return r;
+	}
+
+	// visits n with vars_[slot] set to v for the duration
+	node *visit_with(node *n, interval &out, int slot, const interval &v) {
+		if (slot < 0) return visit(n, out);
+		if (vars_.size() <= static_cast<std::size_t>(slot)) vars_.resize(static_cast<std::size_t>(slot) + 1);
+		const interval saved = vars_[slot];
+		vars_[slot] = v;
+		node *r = visit(n, out);
+		vars_[slot] = saved;
+		return r;
+	}
+
+	node *num(double v, std::size_t pos) { return arena_->make<num_node>(v, pos); }
+	node *to_bool(node *a, std::size_t pos) { return arena_->make<unary_node>(un_op::to_bool, pos, a); }
+
+	// out: what n evaluates to. a node out pins down becomes that constant
+	node *visit(node *n, interval &out) {
+		n = rewrite(n, out);
+		double v = 0.0;
+		if (n->kind != node_kind::num && out.constant(&v)) return num(v, n->pos);
+		return n;
+	}
+
+	node *rewrite(node *n, interval &out) {
+		switch (n->kind) {
+			case node_kind::num:
+				out = interval::point(static_cast<num_node *>(n)->n);
+				return n;
+			case node_kind::var:
+				out = var(static_cast<var_node *>(n)->index);
+				return n;
+
+			case node_kind::unary: {
+				auto p = static_cast<unary_node *>(n);
+				interval a;
+				p->a = visit(p->a, a);
+				switch (p->op) {
+					case un_op::plus: out = a; break;
+					case un_op::minus: out = interval::of(-a.hi, -a.lo, a.nan); break;
+					case un_op::logical_not: out = interval::flag(a.surely_true() ? 0 : a.surely_false() ? 1 : -1); break;
+					case un_op::to_bool: out = interval::flag(a.surely_true() ? 1 : a.surely_false() ? 0 : -1); break;
+				}
+				return n;
+			}
+
+			case node_kind::ternary: {
+				auto p = static_cast<ternary_node *>(n);
+				interval c;
+				p->c = visit(p->c, c);
+				if (c.surely_true()) return visit(p->t, out);
+				if (c.surely_false()) return visit(p->f, out);
+				const narrowing k = narrow(p->c);
+				interval t, f;
+				p->t = visit_with(p->t, t, k.slot, k.when_true);
+				p->f = visit_with(p->f, f, k.slot, k.when_false);
+				out = t.join(f);
+				return n;
+			}
+
+			case node_kind::binary: {
+				auto p = static_cast<binary_node *>(n);
+				interval a, b;
+				p->l = visit(p->l, a);
+				if (p->op == bin_op::and_and || p->op == bin_op::or_or) {
+					const bool and_ = p->op == bin_op::and_and;
+					out = interval::flag(-1);
+					// the left operand alone decides it, or leaves it to the right one
+					if (and_ ? a.surely_false() : a.surely_true()) return num(b2d(!and_), p->pos);
+					if (and_ ? a.surely_true() : a.surely_false()) {
+						p->r = visit(p->r, b);
+						out = interval::flag(b.surely_true() ? 1 : b.surely_false() ? 0 : -1);
+						return to_bool(p->r, p->pos);
+					}
+					const narrowing k = narrow(p->l);
+					p->r = visit_with(p->r, b, k.slot, and_ ? k.when_true : k.when_false);
+					// the right operand after an undecided left one: both are pure
+					if (and_ ? b.surely_false() : b.surely_true()) return num(b2d(!and_), p->pos);
+					if (and_ ? b.surely_true() : b.surely_false()) return to_bool(p->l, p->pos);
+					return n;
+				}
+				p->r = visit(p->r, b);
+				out = binary(p->op, a, b);
+				return n;
+			}
+
+			case node_kind::call: {
+				auto p = static_cast<call_node *>(n);
+				interval a, b;
+				p->args[0] = visit(p->args[0], a);
+				if (p->argc == 2) p->args[1] = visit(p->args[1], b);
+				return call(p, a, b, out);
+			}
+
+			case node_kind::fma: {
+				auto p = static_cast<fma_node *>(n);
+				interval a;
+				p->a = visit(p->a, a);
+				p->b = visit(p->b, a);
+				p->c = visit(p->c, a);
+				out = interval::any();
+				return n;
+			}
+
+			case node_kind::shared: // cse_pass runs later
+			case node_kind::ref:
+				break;
+		}
+		out = interval::any();
+		return n;
+	}
+
+	static interval binary(bin_op o, const interval &a, const interval &b) {
+		const bool clean = !a.nan && !b.nan;
+		const bool points = a.lo == a.hi && b.lo == b.hi;
+		switch (o) {
+			case bin_op::add: {
+				const bool opposite = (a.hi == inf && b.lo == -inf) || (a.lo == -inf && b.hi == inf);
+				interval r = interval::of(a.lo + b.lo, a.hi + b.hi, a.nan || b.nan || opposite);
+				r.neg_zero = r.neg_zero && a.neg_zero && b.neg_zero; // -0 + -0 only
+				return r;
+			}
+			case bin_op::sub: {
+				const bool same = (a.hi == inf && b.hi == inf) || (a.lo == -inf && b.lo == -inf);
+				interval r = interval::of(a.lo - b.hi, a.hi - b.lo, a.nan || b.nan || same);
+				r.neg_zero = r.neg_zero && a.neg_zero && b.has_zero(); // -0 - +0 only
+				return r;
+			}
+			case bin_op::mul: {
+				const double c[4] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+				const bool zero_inf = (a.has_zero() && b.infinite()) || (b.has_zero() && a.infinite());
+				if (zero_inf) return interval::any();
+				return interval::of(std::min({c[0], c[1], c[2], c[3]}), std::max({c[0], c[1], c[2], c[3]}), a.nan || b.nan);
+			}
+			case bin_op::div_: {
+				if (b.has_zero() || (a.infinite() && b.infinite())) return interval::any();
+				const double c[4] = {a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi};
+				return interval::of(std::min({c[0], c[1], c[2], c[3]}), std::max({c[0], c[1], c[2], c[3]}), a.nan || b.nan);
+			}
+			case bin_op::mod: return fmod(a, b);
+			case bin_op::pow: return pow(a, b);
+
+			// known < 0: undecided
+			case bin_op::lt: return interval::flag(a.lo >= b.hi ? 0 : clean && a.hi < b.lo ? 1 : -1);
+			case bin_op::le: return interval::flag(a.lo > b.hi ? 0 : clean && a.hi <= b.lo ? 1 : -1);
+			case bin_op::gt: return interval::flag(a.hi <= b.lo ? 0 : clean && a.lo > b.hi ? 1 : -1);
+			case bin_op::ge: return interval::flag(a.hi < b.lo ? 0 : clean && a.lo >= b.hi ? 1 : -1);
+			case bin_op::eq:
+				return interval::flag(a.hi < b.lo || b.hi < a.lo ? 0 : clean && points && a.lo == b.lo ? 1 : -1);
+			case bin_op::ne:
+				return interval::flag(a.hi < b.lo || b.hi < a.lo ? 1 : clean && points && a.lo == b.lo ? 0 : -1);
+
+			case bin_op::and_and:
+			case bin_op::or_or:
+				break;
+		}
+		return interval::flag(-1);
+	}
+
+	// |fmod(a, b)| <= |a|, with the sign of a
+	static interval fmod(const interval &a, const interval &b) {
+		const double m = a.max_abs();
+		interval r = interval::of(a.lo < 0.0 ? -m : 0.0, a.hi > 0.0 ? m : 0.0, a.nan || b.nan || a.infinite() || b.has_zero());
+		r.neg_zero = a.neg_zero || a.lo < 0.0;
+		return r;
+	}
+	static interval pow(const interval &a, const interval &b) {
+		if (a.nan || a.lo < 0.0 || a.neg_zero) return interval::any();
+		interval r = interval::of(0.0, inf, b.nan);
+		r.neg_zero = false;
+		return r;
+	}
+
+	node *call(call_node *p, const interval &a, const interval &b, interval &out) {
+		const bool clean = !a.nan && !b.nan;
+		switch (p->fid) {
+			case 0: case 1: // sin cos
+				out = interval::of(-1.0, 1.0, a.nan || a.infinite());
+				break;
+			case 2: // tan
+				out = interval::of(-inf, inf, a.nan || a.infinite());
+				break;
+			case 3: case 4: // asin acos
+				out = interval::of(p->fid == 3 ? -2.0 : 0.0, p->fid == 3 ? 2.0 : 4.0, a.nan || a.lo < -1.0 || a.hi > 1.0);
+				break;
+			case 5: // atan
+				out = interval::of(-2.0, 2.0, a.nan);
+				break;
+			case 6: { // exp
+				out = interval::of(std::max(0.0, down(std::exp(a.lo))), up(std::exp(a.hi)), a.nan);
+				out.neg_zero = false;
+				break;
+			}
+			case 7: case 8: { // log log10
+				if (a.hi < 0.0) {
+					out = interval::any();
+					break;
+				}
+				const double lo = std::max(a.lo, 0.0);
+				const double l = p->fid == 7 ? std::log(lo) : std::log10(lo), h = p->fid == 7 ? std::log(a.hi) : std::log10(a.hi);
+				out = interval::of(down(l), up(h), a.nan || a.lo < 0.0);
+				break;
+			}
+			case 9: { // sqrt, correctly rounded
+				if (a.hi < 0.0) {
+					out = interval::any();
+					break;
+				}
+				out = interval::of(std::sqrt(std::max(a.lo, 0.0)), std::sqrt(a.hi), a.nan || a.lo < 0.0);
+				out.neg_zero = a.neg_zero;
+				break;
+			}
+			case 10: { // abs
+				out = interval::of(a.lo >= 0.0 ? a.lo : a.hi <= 0.0 ? -a.hi : 0.0, a.max_abs(), a.nan);
+				out.neg_zero = false;
+				if (!a.nan && a.lo >= 0.0 && (!a.neg_zero || fast_)) return p->args[0];
+				if (!a.nan && (a.hi < 0.0 || (fast_ && a.hi <= 0.0))) {
+					return arena_->make<unary_node>(un_op::minus, p->pos, p->args[0]);
+				}
+				break;
+			}
+			case 11: case 12: case 13: // floor ceil round: monotone and exact, sign kept
+				out = interval::of(eval_func(p->fid, a.lo), eval_func(p->fid, a.hi), a.nan);
+				out.neg_zero = out.neg_zero && (a.neg_zero || a.lo < 0.0);
+				break;
+			case 14: // pow
+				out = pow(a, b);
+				break;
+			case 15: // atan2
+				out = interval::of(-4.0, 4.0, a.nan || b.nan);
+				break;
+			case 16: // fmod
+				out = fmod(a, b);
+				if (clean && !a.infinite() && a.max_abs() < b.min_abs()) {
+					out = a;
+					return p->args[0];
+				}
+				break;
+			case 17: // min: a < b ? a : b
+				if (clean && a.hi < b.lo) {
+					out = a;
+					return p->args[0];
+				}
+				if (b.hi <= a.lo) { // a NaN a gives b as well
+					out = b;
+					return p->args[1];
+				}
+				out = interval::of(std::min(a.lo, b.lo), a.nan ? b.hi : std::min(a.hi, b.hi), b.nan);
+				out.neg_zero = a.neg_zero || b.neg_zero;
+				break;
+			case 18: // max: b < a ? a : b
+				if (clean && b.hi < a.lo) {
+					out = a;
+					return p->args[0];
+				}
+				if (a.hi <= b.lo) {
+					out = b;
+					return p->args[1];
+				}
+				out = interval::of(a.nan ? b.lo : std::max(a.lo, b.lo), std::max(a.hi, b.hi), b.nan);
+				out.neg_zero = a.neg_zero || b.neg_zero;
+				break;
+			default:
+				out = interval::any();
+				break;
+		}
+		return p;
+	}
+};
+
+// ---------- derivatives ----------
+// compile_gradient: the partial derivative of a folded tree in one record slot, as a new tree.
+// forward mode done symbolically: each node's derivative is built from its operands' values
+// and derivatives, the values copied from the tree so cse_pass shares them with the value
+// output later. a derivative known to be 0 (a constant, another variable, a comparison, a
+// rounding function) is left out of the sums and products above it instead of multiplied
+// through. at a kink the derivative is one side's: abs at 0 is 0, min and max take the
+// derivative of the operand they return, ?: that of the arm it takes.
+class derivative_pass {
+public:
+	// returns the derivative of root in the variable at slot; new nodes come from arena
+	node *run(const node *root, std::size_t slot, node_arena &arena) {
+		arena_ = &arena;
+		slot_ = slot;
+		node *d = diff(root);
+		return d ? d : num(0.0, root->pos);
+	}
+
+private:
+	node_arena *arena_ = nullptr;
+	std::size_t slot_ = 0;
+
+	static constexpr double ln10 = 2.302585092994045684;
+
+	node *copy(const node *n) { return clone_tree(n, *arena_); }
+	node *num(double v, std::size_t pos) { return arena_->make<num_node>(v, pos); }
+	node *bin(bin_op o, node *l, node *r) { return arena_->make<binary_node>(o, l->pos, l, r); }
+	node *negate(node *a) { return arena_->make<unary_node>(un_op::minus, a->pos, a); }
+	node *call(int fid, node *a) { return arena_->make<call_node>(fid, 1, a->pos, a, nullptr); }
+	node *pick(node *c, node *t, node *f) { return arena_->make<ternary_node>(c->pos, c, t, f); }
+	node *or_zero(node *d, std::size_t pos) { return d ? d : num(0.0, pos); }
+
+	// a + b and a - b of derivatives, where nullptr is 0
+	node *sum(node *a, node *b) { return !a ? b : !b ? a : bin(bin_op::add, a, b); }
+	node *difference(node *a, node *b) { return !b ? a : !a ? negate(b) : bin(bin_op::sub, a, b); }
+
+	// nullptr: the derivative is 0
+	node *diff(const node *n) {
+		switch (n->kind) {
+			case node_kind::var:
+				return static_cast<std::size_t>(static_cast<const var_node *>(n)->index) == slot_ ? num(1.0, n->pos) : nullptr;
+			case node_kind::unary: {
+				auto p = static_cast<const unary_node *>(n);
+				if (p->op == un_op::plus) return diff(p->a);
+				if (p->op != un_op::minus) return nullptr; // ! and to_bool are steps
+				node *da = diff(p->a);
+				return da ? negate(da) : nullptr;
+			}
+			case node_kind::binary: {
+				auto p = static_cast<const binary_node *>(n);
+				switch (p->op) {
+					case bin_op::add: { node *dl = diff(p->l); return sum(dl, diff(p->r)); }
+					case bin_op::sub: { node *dl = diff(p->l); return difference(dl, diff(p->r)); }
+					case bin_op::mul: {
+						node *dl = diff(p->l), *dr = diff(p->r);
+						return sum(dl ? bin(bin_op::mul, dl, copy(p->r)) : nullptr, dr ? bin(bin_op::mul, copy(p->l), dr) : nullptr);
+					}
+					case bin_op::div_: {
+						// (dl - (l / r) * dr) / r
+						node *dl = diff(p->l), *dr = diff(p->r);
+						if (!dl && !dr) return nullptr;
+						return bin(bin_op::div_, difference(dl, dr ? bin(bin_op::mul, copy(n), dr) : nullptr), copy(p->r));
+					}
+					case bin_op::mod: return remainder(n, p->l, p->r);
+					case bin_op::pow: return power(n, p->l, p->r);
+					default: return nullptr; // comparisons, && and || are steps
+				}
+			}
+			case node_kind::ternary: {
+				auto p = static_cast<const ternary_node *>(n);
+				node *dt = diff(p->t), *df = diff(p->f);
+				if (!dt && !df) return nullptr;
+				return pick(copy(p->c), or_zero(dt, n->pos), or_zero(df, n->pos));
+			}
+			case node_kind::call: return diff_call(static_cast<const call_node *>(n));
+			case node_kind::fma: {
+				auto p = static_cast<const fma_node *>(n);
+				node *da = diff(p->a), *db = diff(p->b), *dc = diff(p->c);
+				return sum(sum(da ? bin(bin_op::mul, da, copy(p->b)) : nullptr, db ? bin(bin_op::mul, copy(p->a), db) : nullptr), dc);
+			}
+			default: // num; shared and ref come from cse_pass, which runs later
+				return nullptr;
+		}
+	}
+
+	// fmod(a, b) = a - trunc(a / b) * b, and trunc(a / b) = (a - fmod(a, b)) / b
+	node *remainder(const node *n, const node *a, const node *b) {
+		node *da = diff(a), *db = diff(b);
+		if (!db) return da;
+		node *q = bin(bin_op::div_, bin(bin_op::sub, copy(a), copy(n)), copy(b));
+		return difference(da, bin(bin_op::mul, q, db));
+	}
+
+	// d(a^b) = b * a^(b - 1) * da + a^b * log(a) * db, without the log term for a constant b
+	node *power(const node *n, const node *a, const node *b) {
+		node *da = diff(a), *db = diff(b);
+		node *via_a = nullptr;
+		if (da) {
+			double c = 0.0;
+			if (is_num(*b, &c)) {
+				if (c == 0.0) return nullptr;
+				if (c == 1.0) return da;
+				via_a = bin(bin_op::mul, bin(bin_op::mul, num(c, n->pos), bin(bin_op::pow, copy(a), num(c - 1.0, n->pos))), da);
+			} else {
+				node *b1 = bin(bin_op::sub, copy(b), num(1.0, n->pos));
+				via_a = bin(bin_op::mul, bin(bin_op::mul, copy(b), bin(bin_op::pow, copy(a), b1)), da);
+			}
+		}
+		node *via_b = db ? bin(bin_op::mul, bin(bin_op::mul, copy(n), call(7, copy(a))), db) : nullptr;
+		return sum(via_a, via_b);
+	}
+
+	node *diff_call(const call_node *p) {
+		if (p->argc == 2) return diff_call2(p);
+		const node *a = p->args[0];
+		node *da = diff(a);
+		if (!da) return nullptr;
+		const std::size_t pos = p->pos;
+		switch (p->fid) {
+			case 0: return bin(bin_op::mul, call(1, copy(a)), da);            // sin: cos(a)
+			case 1: return negate(bin(bin_op::mul, call(0, copy(a)), da));    // cos: -sin(a)
+			case 2: {                                                          // tan: 1 + tan(a)^2
+				node *t2 = bin(bin_op::mul, copy(p), copy(p));
+				return bin(bin_op::mul, bin(bin_op::add, num(1.0, pos), t2), da);
+			}
+			case 3:                                                            // asin: 1 / sqrt(1 - a^2)
+			case 4: {                                                          // acos: -1 / sqrt(1 - a^2)
+				node *r = call(9, bin(bin_op::sub, num(1.0, pos), bin(bin_op::mul, copy(a), copy(a))));
+				node *d = bin(bin_op::div_, da, r);
+				return p->fid == 3 ? d : negate(d);
+			}
+			case 5: return bin(bin_op::div_, da, bin(bin_op::add, num(1.0, pos), bin(bin_op::mul, copy(a), copy(a)))); // atan
+			case 6: return bin(bin_op::mul, copy(p), da);                                         // exp: exp(a)
+			case 7: return bin(bin_op::div_, da, copy(a));                                        // log: 1 / a
+			case 8: return bin(bin_op::div_, da, bin(bin_op::mul, copy(a), num(ln10, pos)));     // log10: 1 / (a ln 10)
+			case 9: return bin(bin_op::div_, da, bin(bin_op::mul, num(2.0, pos), copy(p)));     // sqrt: 1 / (2 sqrt(a))
+			case 10: {                                                                            // abs: sign(a)
+				node *neg_side = pick(bin(bin_op::lt, copy(a), num(0.0, pos)), negate(copy(da)), num(0.0, pos));
+				return pick(bin(bin_op::gt, copy(a), num(0.0, pos)), da, neg_side);
+			}
+			default: return nullptr; // floor ceil round are steps
+		}
+	}
+
+	node *diff_call2(const call_node *p) {
+		const node *a = p->args[0], *b = p->args[1];
+		const std::size_t pos = p->pos;
+		switch (p->fid) {
+			case 14: return power(p, a, b);
+			case 15: { // atan2(a, b): (b da - a db) / (a^2 + b^2)
+				node *da = diff(a), *db = diff(b);
+				if (!da && !db) return nullptr;
+				node *top = difference(da ? bin(bin_op::mul, copy(b), da) : nullptr, db ? bin(bin_op::mul, copy(a), db) : nullptr);
+				node *r2 = bin(bin_op::add, bin(bin_op::mul, copy(a), copy(a)), bin(bin_op::mul, copy(b), copy(b)));
+				return bin(bin_op::div_, top, r2);
+			}
+			case 16: return remainder(p, a, b);
+			case 17:   // min(a, b) = a < b ? a : b
+			case 18: { // max(a, b) = b < a ? a : b
+				node *da = diff(a), *db = diff(b);
+				if (!da && !db) return nullptr;
+				node *c = p->fid == 17 ? bin(bin_op::lt, copy(a), copy(b)) : bin(bin_op::lt, copy(b), copy(a));
+				return pick(c, or_zero(da, pos), or_zero(db, pos));
+			}
+			default: return nullptr;
+		}
+	}
+};
+
+// ---------- fast-math rewrites ----------
+// compile_options::fast_math: rewrites of the folded tree that are exact in real arithmetic
+// but not always in IEEE doubles (signed zeros, NaN and inf operands, rounding):
+// - x^2 -> x*x, pow(x, 0.5) -> sqrt(x), abs(abs(x)) -> abs(x)
+// - +/- and * chains are flattened and their constants folded into one, whatever the
+//   association (2*x*3 -> x*6, x+1-y+2 -> x-y+3); x/c joins the chain as x*(1/c) and a
+//   chain whose constant is 0 is 0 (x*0 -> 0)
+// - a*b + c becomes one fma where that does not cost the interpreter an instruction
+// fold_constants runs again afterwards.
+class fast_math_pass {
+public:
+	// returns the rewritten tree; new nodes come from arena
+	node *run(node *root, node_arena &arena) {
+		arena_ = &arena;
+		terms_.clear();
+		return rewrite(root);
+	}
+
+private:
+	struct term {
+		node *n;
+		bool negated; // sum chains: subtracted
+	};
+	// operands of the chains being rebuilt; each chain works above the size it found
+	std::vector<term> terms_;
+	node_arena *arena_ = nullptr;
+
+	static bool is_bin(const node *n, bin_op o) {
+		return n->kind == node_kind::binary && static_cast<const binary_node *>(n)->op == o;
+	}
+	static bool is_leaf(const node *n) { return n->kind == node_kind::num || n->kind == node_kind::var; }
+	static bool is_call(const node *n, int fid) {
+		return n->kind == node_kind::call && static_cast<const call_node *>(n)->fid == fid;
+	}
+
+	node *num(double v, std::size_t pos) { return arena_->make<num_node>(v, pos); }
+	node *bin(bin_op o, node *l, node *r) { return arena_->make<binary_node>(o, l->pos, l, r); }
+	node *negate(node *a) { return arena_->make<unary_node>(un_op::minus, a->pos, a); }
+
+	node *clone(const node *n) { return clone_tree(n, *arena_); }
+
+	node *rewrite(node *n) {
+		switch (n->kind) {
+			case node_kind::unary: {
+				auto p = static_cast<unary_node *>(n);
+				p->a = rewrite(p->a);
+				return n;
+			}
+			case node_kind::binary: {
+				auto p = static_cast<binary_node *>(n);
+				switch (p->op) {
+					case bin_op::add: case bin_op::sub: return sum(n);
+					case bin_op::mul: return product(n);
+					case bin_op::div_: if (is_num(*p->r)) return product(n); break;
+					case bin_op::pow:
+						p->l = rewrite(p->l);
+						p->r = rewrite(p->r);
+						return power(n, p->l, p->r);
+					default: break;
+				}
+				p->l = rewrite(p->l);
+				p->r = rewrite(p->r);
+				return n;
+			}
+			case node_kind::ternary: {
+				auto p = static_cast<ternary_node *>(n);
+				p->c = rewrite(p->c);
+				p->t = rewrite(p->t);
+				p->f = rewrite(p->f);
+				return n;
+			}
+			case node_kind::call: {
+				auto p = static_cast<call_node *>(n);
+				for (int i = 0; i < p->argc; ++i) p->args[i] = rewrite(p->args[i]);
+				if (p->fid == 10 && is_call(p->args[0], 10)) return p->args[0]; // abs(abs(x))
+				if (p->fid == 14) return power(n, p->args[0], p->args[1]);
+				return n;
+			}
+			default:
+				return n;
+		}
+	}
+
+	// n is base^e or pow(base, e)
+	node *power(node *n, node *base, node *e) {
+		double v = 0.0;
+		if (!is_num(*e, &v)) return n;
+		if (v == 2.0) return arena_->make<binary_node>(bin_op::mul, n->pos, base, clone(base));
+		if (v == 0.5) return arena_->make<call_node>(9, 1, n->pos, base, nullptr);
+		return n;
+	}
+
+	void collect_sum(node *n, bool negated) {
+		if (is_bin(n, bin_op::add) || is_bin(n, bin_op::sub)) {
+			auto p = static_cast<binary_node *>(n);
+			collect_sum(p->l, negated);
+			collect_sum(p->r, p->op == bin_op::sub ? !negated : negated);
+		} else if (n->kind == node_kind::unary && static_cast<unary_node *>(n)->op == un_op::minus) {
+			collect_sum(static_cast<unary_node *>(n)->a, !negated);
+		} else {
+			terms_.push_back(term{n, negated});
+		}
+	}
+
+	node *sum(node *n) {
+		const std::size_t base = terms_.size();
+		collect_sum(n, false);
+		double k = 0.0;
+		std::size_t kept = base;
+		for (std::size_t i = base; i < terms_.size(); ++i) {
+			term t = terms_[i];
+			t.n = rewrite(t.n); // nested chains push and pop above terms_.size()
+			double v = 0.0;
+			if (is_num(*t.n, &v)) {
+				k += t.negated ? -v : v;
+			} else {
+				terms_[kept++] = t;
+			}
+		}
+		node *acc = nullptr;
+		for (std::size_t i = base; i < kept; ++i) acc = add_term(acc, terms_[i].n, terms_[i].negated);
+		terms_.resize(base);
+		if (!acc) return num(k, n->pos);
+		return k != 0.0 ? add_term(acc, num(k, n->pos), false) : acc;
+	}
+
+	// instructions fuse() saves on p*q + c that an fma would lose: p*q with a plain q runs as
+	// mul_v/mul_c (mul_vv/... if p is plain too), + c with a plain c as add_v/add_c.
+	// c - p*q becomes fma(-p, q, c) and pays one neg.
+	static bool contraction_pays(const binary_node &m, const node *c, bool negated) {
+		int lost = is_leaf(m.r) ? (is_leaf(m.l) ? 2 : 1) : 0;
+		if (is_leaf(c)) ++lost;
+		if (negated) ++lost;
+		return lost <= 1; // the fma itself saves one
+	}
+
+	// acc + t, or acc - t if negated; acc is null for the first term
+	node *add_term(node *acc, node *t, bool negated) {
+		if (!acc) return negated ? negate(t) : t;
+		if (is_bin(t, bin_op::mul) && contraction_pays(*static_cast<binary_node *>(t), acc, negated)) {
+			auto m = static_cast<binary_node *>(t);
+			return arena_->make<fma_node>(acc->pos, negated ? negate(m->l) : m->l, m->r, acc);
+		}
+		if (is_bin(acc, bin_op::mul) && !negated && contraction_pays(*static_cast<binary_node *>(acc), t, false)) {
+			auto m = static_cast<binary_node *>(acc);
+			return arena_->make<fma_node>(acc->pos, m->l, m->r, t);
+		}
+		return bin(negated ? bin_op::sub : bin_op::add, acc, t);
+	}
+
+	// pushes the factors of a * / unary minus chain, folding constants into k
+	void collect_product(node *n, double &k) {
+		if (is_bin(n, bin_op::mul)) {
+			auto p = static_cast<binary_node *>(n);
+			collect_product(p->l, k);
+			collect_product(p->r, k);
+			return;
+		}
+		double c = 0.0;
+		if (is_bin(n, bin_op::div_) && is_num(*static_cast<binary_node *>(n)->r, &c)) { // x/c -> x*(1/c)
+			collect_product(static_cast<binary_node *>(n)->l, k);
+			k *= 1.0 / c;
+			return;
+		}
+		if (n->kind == node_kind::unary && static_cast<unary_node *>(n)->op == un_op::minus) {
+			collect_product(static_cast<unary_node *>(n)->a, k);
+			k = -k;
+			return;
+		}
+		terms_.push_back(term{n, false});
+	}
+
+	node *product(node *n) {
+		const std::size_t base = terms_.size();
+		double k = 1.0;
+		collect_product(n, k);
+		std::size_t kept = base;
+		for (std::size_t i = base; i < terms_.size(); ++i) {
+			node *t = rewrite(terms_[i].n);
+			double v = 0.0;
+			if (is_num(*t, &v)) {
+				k *= v;
+			} else {
+				terms_[kept++].n = t;
+			}
+		}
+		node *acc = nullptr;
+		for (std::size_t i = base; i < kept; ++i) acc = acc ? bin(bin_op::mul, acc, terms_[i].n) : terms_[i].n;
+		terms_.resize(base);
+		if (!acc || k == 0.0) return num(k, n->pos); // x*0 -> 0
+		if (k == 1.0) return acc;
+		if (k == -1.0) return negate(acc);
+		return bin(bin_op::mul, acc, num(k, n->pos));
+	}
+};
+
+// ---------- common subexpression elimination ----------
+// every operator and whitelisted function is pure, so structurally equal subtrees of the
+// folded tree compute equal values. cse_pass numbers the values bottom-up (hash-consing),
+// then wraps the first occurrence of a repeated, non-trivial subtree in a shared_node and
+// turns the later ones into ref_nodes, which the code generators lower to reads of a local.
+// a ref is only made where its definition has certainly run: the arms of ?: and the right
+// operand of && and || each open a region whose definitions are forgotten when it ends,
+// so no work is hoisted out of an arm that might not be evaluated.
+class cse_pass {
+public:
+	// subtrees cheaper than this are recomputed: a store/load pair costs about as much
+	static constexpr std::uint32_t min_cost = 3;
+
+	// returns the rewritten tree; new nodes come from arena
+	node *run(node *root, node_arena &arena) {
+		run(&root, 1, arena);
+		return root;
+	}
+
+	// rewrites n trees evaluated one after another in place (compile_many): a value computed
+	// by an earlier tree is reused by the later ones
+	void run(node **roots, std::size_t n, node_arena &arena) {
+		for (std::size_t i = 0; i < n; ++i) number(roots[i]);
+		if (!repeated_) return; // nothing worth sharing, the common case
+		arena_ = &arena;
+		open_.push_back(1);
+		for (std::size_t i = 0; i < n; ++i) roots[i] = share(roots[i], 0);
+	}
+
+	// forget the last tree but keep every buffer's capacity
+	void reset() {
+		if (!values_.empty()) std::fill(slots_.begin(), slots_.end(), 0u);
+		values_.clear();
+		open_.clear();
+		n_shared_ = 0;
+		repeated_ = false;
+	}
+
+private:
+	// what a value is computed from: equal signatures mean equal values
+	struct sig {
+		node_kind kind;
+		std::uint8_t op;       // un_op, bin_op or function id
+		std::uint32_t a, b, c; // operand value numbers; c = argc for calls
+		std::uint64_t bits;    // num: bit pattern (so 0.0 and -0.0 stay apart), var: index
+	};
+	struct value {
+		sig s;
+		std::uint32_t cost;         // rough instruction count of the subtree
+		std::uint32_t count;        // occurrences in the tree
+		shared_node *def;           // set by share(): where the value is computed
+		std::uint32_t region;       // region of def
+	};
+
+	std::vector<value> values_;       // by value number
+	std::vector<std::uint32_t> slots_; // open-addressed index of values_ by sig: number + 1, 0 = empty
+	std::vector<char> open_;          // by region: still being walked
+	node_arena *arena_ = nullptr;
+	std::uint32_t n_shared_ = 0;
+	bool repeated_ = false;           // some value worth sharing occurs twice
+
+	static bool same(const sig &x, const sig &y) {
+		return x.kind == y.kind && x.op == y.op && x.a == y.a && x.b == y.b && x.c == y.c && x.bits == y.bits;
+	}
+	static std::size_t hash(const sig &s) {
+		std::uint64_t h = s.bits ^ (std::uint64_t(s.kind) << 56) ^ (std::uint64_t(s.op) << 48);
+		h = (h ^ s.a) * 0x9e3779b97f4a7c15ull;
+		h = (h ^ s.b) * 0x9e3779b97f4a7c15ull;
+		h = (h ^ s.c) * 0x9e3779b97f4a7c15ull;
+		return static_cast<std::size_t>(h >> 32);
+	}
+
+	void grow() {
+		slots_.assign(slots_.empty() ? 64 : 2 * slots_.size(), 0u);
+		values_.reserve(slots_.size() / 2); // fills up together with slots_
+		const std::size_t mask = slots_.size() - 1;
+		for (std::size_t i = 0; i < values_.size(); ++i) {
+			std::size_t h = hash(values_[i].s) & mask;
+			while (slots_[h] != 0) h = (h + 1) & mask;
+			slots_[h] = static_cast<std::uint32_t>(i + 1);
+		}
+	}
+
+	std::uint32_t intern(const sig &s, std::uint32_t cost) {
+		if (2 * (values_.size() + 1) > slots_.size()) grow();
+		const std::size_t mask = slots_.size() - 1;
+		for (std::size_t h = hash(s) & mask;; h = (h + 1) & mask) {
+			const std::uint32_t v = slots_[h];
+			if (v == 0) {
+				values_.push_back(value{s, cost, 1, nullptr, 0});
+				slots_[h] = static_cast<std::uint32_t>(values_.size());
+				return static_cast<std::uint32_t>(values_.size() - 1);
+			}
+			value &e = values_[v - 1];
+			if (same(e.s, s)) {
+				if (++e.count == 2 && e.cost >= min_cost) repeated_ = true;
+				return v - 1;
+			}
+		}
+	}
+
+	// pass 1: value-number every node bottom-up
+	std::uint32_t number(node *n) {
+		sig s{n->kind, 0, 0, 0, 0, 0};
+		std::uint32_t cost = 0;
+		auto cost_of = [&](std::uint32_t v) { return values_[v].cost; };
+		switch (n->kind) {
+			case node_kind::num: {
+				const double v = static_cast<num_node *>(n)->n;
+				std::memcpy(&s.bits, &v, sizeof v);
+				break;
+			}
+			case node_kind::var: s.bits = static_cast<std::uint64_t>(static_cast<var_node *>(n)->index); break;
+			case node_kind::unary: {
+				auto p = static_cast<unary_node *>(n);
+				s.op = static_cast<std::uint8_t>(p->op);
+				s.a = number(p->a);
+				cost = 1 + cost_of(s.a);
+				break;
+			}
+			case node_kind::binary: {
+				auto p = static_cast<binary_node *>(n);
+				s.op = static_cast<std::uint8_t>(p->op);
+				s.a = number(p->l);
+				s.b = number(p->r);
+				cost = 1 + cost_of(s.a) + cost_of(s.b);
+				break;
+			}
+			case node_kind::ternary: {
+				auto p = static_cast<ternary_node *>(n);
+				s.a = number(p->c);
+				s.b = number(p->t);
+				s.c = number(p->f);
+				cost = 2 + cost_of(s.a) + cost_of(s.b) + cost_of(s.c);
+				break;
+			}
+			case node_kind::fma: {
+				auto p = static_cast<fma_node *>(n);
+				s.a = number(p->a);
+				s.b = number(p->b);
+				s.c = number(p->c);
+				cost = 1 + cost_of(s.a) + cost_of(s.b) + cost_of(s.c);
+				break;
+			}
+			case node_kind::call: {
+				auto p = static_cast<call_node *>(n);
+				s.op = static_cast<std::uint8_t>(p->fid);
+				s.a = number(p->args[0]);
+				if (p->argc == 2) s.b = number(p->args[1]);
+				s.c = static_cast<std::uint32_t>(p->argc);
+				cost = 4 + cost_of(s.a) + (p->argc == 2 ? cost_of(s.b) : 0);
+				break;
+			}
+			case node_kind::shared:
+			case node_kind::ref:
+				break; // only made by share()
+		}
+		return n->id = intern(s, cost);
+	}
+
+	std::uint32_t open_region() {
+		open_.push_back(1);
+		return static_cast<std::uint32_t>(open_.size() - 1);
+	}
+	node *share_in_region(node *n) {
+		const std::uint32_t r = open_region();
+		n = share(n, r);
+		open_[r] = 0;
+		return n;
+	}
+
+	// pass 2, in evaluation order: reuse an available definition or walk the children, then
+	// make this the definition of its value if it repeats
+	node *share(node *n, std::uint32_t region) {
+		if (n->kind == node_kind::num || n->kind == node_kind::var) return n;
+		value &v = values_[n->id]; // values_ no longer grows
+		if (v.def && open_[v.region]) {
+			++v.def->uses;
+			return arena_->make<ref_node>(v.def, n->pos);
+		}
+
+		switch (n->kind) {
+			case node_kind::unary: {
+				auto p = static_cast<unary_node *>(n);
+				p->a = share(p->a, region);
+				break;
+			}
+			case node_kind::binary: {
+				auto p = static_cast<binary_node *>(n);
+				p->l = share(p->l, region);
+				const bool lazy = p->op == bin_op::and_and || p->op == bin_op::or_or;
+				p->r = lazy ? share_in_region(p->r) : share(p->r, region);
+				break;
+			}
+			case node_kind::ternary: {
+				auto p = static_cast<ternary_node *>(n);
+				p->c = share(p->c, region);
+				p->t = share_in_region(p->t);
+				p->f = share_in_region(p->f);
+				break;
+			}
+			case node_kind::fma: {
+				auto p = static_cast<fma_node *>(n);
+				p->a = share(p->a, region);
+				p->b = share(p->b, region);
+				p->c = share(p->c, region);
+				break;
+			}
+			case node_kind::call: {
+				auto p = static_cast<call_node *>(n);
+				for (int i = 0; i < p->argc; ++i) p->args[i] = share(p->args[i], region);
+				break;
+			}
+			default:
+				break;
+		}
+
+		if (v.count < 2 || v.cost < min_cost) return n;
+		shared_node *d = arena_->make<shared_node>(n, n_shared_++, n->pos);
+		d->id = n->id;
+		v.def = d;
+		v.region = region;
+		return d;
+	}
+};
+
+// ---------- branchless select ----------
+// decides when a ?:, && or || is lowered to op::select / reg_op::select, which evaluates
+// both arms and keeps one, instead of jz + jmp. a branch on a condition that follows the
+// data mispredicts about every other row; a select instead pays for the arm that is not
+// taken. so both arms are run when they are cheap together: variables, constants, locals,
+// plain arithmetic and the functions that never reach libm (no pow, fmod or
+// transcendentals). costs are in unfused stack instructions.
+// the budget depends on who runs the code. native code spends about a cycle per
+// instruction, so a flush is worth several of them. the interpreters spend several cycles
+// on each dispatch: the register backend still wins with leaf arms (x > y ? x : y is 3
+// instructions instead of 6), while the stack interpreter would lose its compare-and-jump
+// superinstructions and run more dispatches than the branch costs, so it never selects.
+struct select_model {
+	static constexpr int stack = 0;  // interpreted stack bytecode
+	static constexpr int reg = 2;    // x > y ? x : y
+	static constexpr int native = 6; // x > y ? x*2 : y*3, x > 0 && y > 0
+
+	int budget = stack; // both arms together may cost this much
+
+	// cond ? t : f
+	bool speculate(const node &t, const node &f) const {
+		if (budget < 2) return false;
+		const int ct = cost(t, budget);
+		return ct + cost(f, budget - ct) <= budget;
+	}
+	// a && r (arms: r's to_bool and 0) or a || r (arms: 1 and r's to_bool)
+	bool speculate(const node &r) const { return budget > 2 && cost(r, budget - 2) + 2 <= budget; }
+
+	// instructions to evaluate n unconditionally when that is at most left, otherwise
+	// left + 1; the walk gives up as soon as left is spent
+	int cost(const node &n, int left) const {
+		if (left < 1) return left + 1;
+		switch (n.kind) {
+			case node_kind::num:
+			case node_kind::var:
+			case node_kind::ref:
+				return 1;
+			case node_kind::unary: {
+				auto p = static_cast<const unary_node *>(&n);
+				return p->op == un_op::plus ? cost(*p->a, left) : 1 + cost(*p->a, left - 1);
+			}
+			case node_kind::binary: {
+				auto p = static_cast<const binary_node *>(&n);
+				switch (p->op) {
+					case bin_op::mod:
+					case bin_op::pow:
+						return left + 1;
+					case bin_op::and_and:
+					case bin_op::or_or:
+						if (!speculate(*p->r)) return left + 1;
+						return sum(p->l, p->r, nullptr, 4, left); // to_bool, constant, select
+					default:
+						return sum(p->l, p->r, nullptr, 1, left);
+				}
+			}
+			case node_kind::ternary: {
+				auto p = static_cast<const ternary_node *>(&n);
+				if (!speculate(*p->t, *p->f)) return left + 1;
+				return sum(p->c, p->t, p->f, 1, left);
+			}
+			case node_kind::fma: {
+				auto p = static_cast<const fma_node *>(&n);
+				return sum(p->a, p->b, p->c, 1, left);
+			}
+			case node_kind::call: {
+				auto p = static_cast<const call_node *>(&n);
+				const bool inline_fn = (9 <= p->fid && p->fid <= 13) || p->fid == 17 || p->fid == 18; // sqrt..round, min, max
+				if (!inline_fn) return left + 1;
+				return sum(p->args[0], p->argc == 2 ? p->args[1] : nullptr, nullptr, 1, left);
+			}
+			case node_kind::shared:
+				return 1 + cost(*static_cast<const shared_node &>(n).value, left - 1); // + store_local
+		}
+		return left + 1;
+	}
+
+private:
+	// own + the cost of each non-null operand, capped at left + 1
+	int sum(const node *a, const node *b, const node *c, int own, int left) const {
+		int used = own;
+		for (const node *o : {a, b, c}) {
+			if (!o) continue;
+			if (used > left) break;
+			used += cost(*o, left - used);
+		}
+		return used <= left ? used : left + 1;
+	}
+};
+
+// ---------- profile-guided choices ----------
+// how often the condition of each ?: && || held in a profiled run, by the node's cse value
+// number, which compiling the same source with the same options reproduces. a recompile
+// (compiled_expr::reoptimize) reads it to choose select vs branch and the arm order.
+struct branch_hints {
+	struct outcome {
+		std::uint64_t executed = 0;
+		std::uint64_t held = 0;
+	};
+	std::unordered_map<std::uint32_t, outcome> by_node;
+
+	const outcome *find(std::uint32_t id) const {
+		auto it = by_node.find(id);
+		return it == by_node.end() || it->second.executed == 0 ? nullptr : &it->second;
+	}
+};
+
+// ---------- bytecode compiler ----------
+class bytecode_compiler {
+public:
+	using op = compiled_expr::op;
+	using instr = compiled_expr::instr;
+
+	std::vector<instr> code;
+	std::vector<double> consts; // becomes program::consts
+	std::size_t depth = 0;     // stack depth after the last emitted instruction
+	std::size_t max_depth = 0; // high-water mark, becomes program::max_stack
+	std::size_t shift = 0;     // extra lane slots held by enclosing divergent branches
+	std::size_t max_lanes = 0; // high-water mark incl. shift, becomes program::batch_slots
+	std::size_t n_locals = 0;  // local slots live at once at most, becomes program::n_locals
+	select_model select;       // when ?: && || evaluate both arms
+
+	const branch_hints *hints = nullptr; // outcomes of a profiled run, if recompiling one
+	bool layout = false;                 // with hints: the likely arm falls through (native code)
+	std::vector<profile_counters::site> sites; // every conditional jump emitted
+
+	// net number of values an instruction pushes (negative: pops)
+	static int stack_effect(op opcode, int arg) {
+		switch (opcode) {
+			case op::push_const:
+			case op::push_var:
+			case op::load_local:
+				return 1;
+			case op::pop:
+			case op::jz:
+			case op::jnz:
+			case op::store_out:
+				return -1;
+			case op::fma:
+			case op::select:
+				return -2;
+			case op::add: case op::sub: case op::mul: case op::div_: case op::mod: case op::pow:
+			case op::lt: case op::le: case op::gt: case op::ge: case op::eq: case op::ne:
+				return -1;
+			case op::call:
+				return arg < 14 ? 0 : -1; // 1-arg: pop1/push1, 2-arg: pop2/push1
+			case op::to_bool:
+			case op::neg:
+			case op::logical_not:
+			case op::jmp:
+			case op::store_local:
+			case op::end:
+				return 0;
+
+			case op::add_vc: case op::sub_vc: case op::mul_vc: case op::div_vc:
+			case op::add_cv: case op::sub_cv: case op::mul_cv: case op::div_cv:
+			case op::add_vv: case op::sub_vv: case op::mul_vv: case op::div_vv:
+				return 1;
+			case op::add_c: case op::sub_c: case op::mul_c: case op::div_c:
+			case op::add_v: case op::sub_v: case op::mul_v: case op::div_v:
+				return 0;
+			case op::jlt: case op::jle: case op::jgt: case op::jge: case op::jeq: case op::jne:
+				return -2;
+			case op::jlt_vc: case op::jle_vc: case op::jgt_vc: case op::jge_vc: case op::jeq_vc: case op::jne_vc:
+				return 0;
+			case op::call_sin: case op::call_cos: case op::call_tan: case op::call_asin: case op::call_acos:
+			case op::call_atan: case op::call_exp: case op::call_log: case op::call_log10: case op::call_sqrt:
+			case op::call_abs: case op::call_floor: case op::call_ceil: case op::call_round:
+				return 0;
+			case op::call_pow: case op::call_atan2: case op::call_fmod: case op::call_min: case op::call_max:
+				return -1;
+		}
+		return 0;
+	}
+
+	static bool is_jump(op opcode) {
+		return opcode == op::jz || opcode == op::jnz || opcode == op::jmp || (op::jlt <= opcode && opcode <= op::jne_vc);
+	}
+
+	// peephole pass over the finished code: folds common sequences into superinstructions
+	// (push_var; push_const; mul -> mul_vc, lt; to_bool; jz -> jlt, call -> call_sqrt, ...)
+	// and remaps jump targets. a sequence is only fused if no jump lands inside it, so the
+	// layout eval_batch relies on (jmp right before every jz target) is preserved.
+	void fuse() {
+		const std::size_t n = code.size();
+		std::vector<bool> &is_target = is_target_;
+		is_target.assign(n + 1, false);
+		for (const instr &in : code) {
+			if (is_jump(in.opcode)) is_target[static_cast<std::size_t>(in.arg)] = true;
+		}
+
+		auto at = [&](std::size_t i) { return i < n ? code[i].opcode : op::end; };
+		auto free_run = [&](std::size_t pc, std::size_t len) {
+			if (pc + len > n) return false;
+			for (std::size_t i = 1; i < len; ++i) if (is_target[pc + i]) return false;
+			return true;
+		};
+		auto arith_index = [](op o) { return (op::add <= o && o <= op::div_) ? static_cast<int>(o) - static_cast<int>(op::add) : -1; };
+		auto cmp_index = [](op o) { return (op::lt <= o && o <= op::ne) ? static_cast<int>(o) - static_cast<int>(op::lt) : -1; };
+		auto shifted = [](op base, int i) { return static_cast<op>(static_cast<int>(base) + i); };
+		// a push_const whose pool index fits a superinstruction's k
+		auto short_const = [&](std::size_t i) {
+			return at(i) == op::push_const && static_cast<std::size_t>(code[i].arg) <= compiled_expr::max_short_const;
+		};
+		auto k_of = [&](std::size_t i) { return static_cast<std::uint16_t>(code[i].arg); };
+		auto var_of = [&](std::size_t i) { return static_cast<std::uint8_t>(code[i].arg); };
+		// a push_var whose slot fits arg2
+		auto short_var = [&](std::size_t i) { return at(i) == op::push_var && code[i].arg <= 0xff; };
+
+		std::vector<instr> &out = fused_;
+		out.clear();
+		out.reserve(n);
+		std::vector<std::size_t> &remap = remap_;
+		remap.assign(n + 1, 0);
+
+		std::size_t pc = 0;
+		while (pc < n) {
+			const instr &in = code[pc];
+			remap[pc] = out.size();
+			instr f;
+			std::size_t len = 1;
+
+			int ai = -1, ci = -1;
+			if (short_var(pc) && short_const(pc + 1) && (ci = cmp_index(at(pc + 2))) >= 0 &&
+			    at(pc + 3) == op::to_bool && at(pc + 4) == op::jz && free_run(pc, 5)) {
+				f.opcode = shifted(op::jlt_vc, ci); f.arg = code[pc + 4].arg; f.arg2 = var_of(pc); f.k = k_of(pc + 1); len = 5;
+			} else if ((ci = cmp_index(in.opcode)) >= 0 && at(pc + 1) == op::to_bool && at(pc + 2) == op::jz && free_run(pc, 3)) {
+				f.opcode = shifted(op::jlt, ci); f.arg = code[pc + 2].arg; len = 3;
+			} else if (in.opcode == op::to_bool && (at(pc + 1) == op::jz || at(pc + 1) == op::jnz) && free_run(pc, 2)) {
+				f = code[pc + 1]; len = 2; // jz and jnz test truth themselves
+			} else if (in.opcode == op::push_var && short_const(pc + 1) && (ai = arith_index(at(pc + 2))) >= 0 && free_run(pc, 3)) {
+				f.opcode = shifted(op::add_vc, ai); f.arg = in.arg; f.k = k_of(pc + 1); len = 3;
+			} else if (short_const(pc) && at(pc + 1) == op::push_var && (ai = arith_index(at(pc + 2))) >= 0 && free_run(pc, 3)) {
+				f.opcode = shifted(op::add_cv, ai); f.arg = code[pc + 1].arg; f.k = k_of(pc); len = 3;
+			} else if (in.opcode == op::push_var && short_var(pc + 1) && (ai = arith_index(at(pc + 2))) >= 0 && free_run(pc, 3)) {
+				f.opcode = shifted(op::add_vv, ai); f.arg = in.arg; f.arg2 = var_of(pc + 1); len = 3;
+			} else if (short_const(pc) && (ai = arith_index(at(pc + 1))) >= 0 && free_run(pc, 2)) {
+				f.opcode = shifted(op::add_c, ai); f.k = k_of(pc); len = 2;
+			} else if (in.opcode == op::push_var && (ai = arith_index(at(pc + 1))) >= 0 && free_run(pc, 2)) {
+				f.opcode = shifted(op::add_v, ai); f.arg = in.arg; len = 2;
+			} else if (in.opcode == op::call && 0 <= in.arg && in.arg <= 18) {
+				f.opcode = shifted(op::call_sin, in.arg);
+			} else {
+				f = in;
+			}
+
+			for (std::size_t i = 1; i < len; ++i) remap[pc + i] = out.size();
+			out.push_back(f);
+			pc += len;
+		}
+		remap[n] = out.size();
+
+		for (instr &in : out) {
+			if (is_jump(in.opcode)) in.arg = static_cast<int>(remap[static_cast<std::size_t>(in.arg)]);
+		}
+		for (profile_counters::site &st : sites) st.pc = remap[st.pc];
+		code.swap(out); // the old buffer becomes the next fuse()'s scratch
+	}
+
+	// forget the last program but keep every buffer's capacity
+	void reset() {
+		code.clear();
+		if (!consts.empty()) std::fill(const_slots_.begin(), const_slots_.end(), 0u);
+		consts.clear();
+		depth = max_depth = shift = max_lanes = n_locals = 0;
+		free_locals_.clear();
+		sites.clear();
+	}
+
+	void emit(op opcode, int arg = 0) {
+		instr in;
+		in.opcode = opcode;
+		in.arg = arg;
+		code.push_back(in);
+
+		depth = static_cast<std::size_t>(static_cast<long>(depth) + stack_effect(opcode, arg));
+		if (max_depth < depth) max_depth = depth;
+		if (max_lanes < depth + shift) max_lanes = depth + shift;
+	}
+
+	void emit_const(double v) { emit(op::push_const, konst(v)); }
+
+	// pool index of v; equal bit patterns share one entry (so 0.0 and -0.0 stay apart)
+	int konst(double v) {
+		if (2 * (consts.size() + 1) > const_slots_.size()) grow_const_slots();
+		const std::uint64_t bits = bits_of(v);
+		const std::size_t mask = const_slots_.size() - 1;
+		for (std::size_t h = slot_hash(bits) & mask;; h = (h + 1) & mask) {
+			const std::uint32_t s = const_slots_[h];
+			if (s != 0 && bits_of(consts[s - 1]) == bits) return static_cast<int>(s - 1);
+			if (s == 0) {
+				consts.push_back(v);
+				const_slots_[h] = static_cast<std::uint32_t>(consts.size());
+				return static_cast<int>(consts.size() - 1);
+			}
+		}
+	}
+
+	std::size_t emit_placeholder(op opcode) {
+		emit(opcode);
+		return code.size() - 1;
+	}
+
+	void patch_target(std::size_t at, std::size_t target) {
+		code[at].arg = static_cast<int>(target);
+	}
+
+	void compile(const node &n) {
+		switch (n.kind) {
+			case node_kind::num: emit_const(static_cast<const num_node &>(n).n); return;
+			case node_kind::var: emit(op::push_var, static_cast<const var_node &>(n).index); return;
+
+			case node_kind::unary: {
+				auto p = static_cast<const unary_node *>(&n);
+				compile(*p->a);
+				switch (p->op) {
+					case un_op::plus: break;
+					case un_op::minus: emit(op::neg); break;
+					case un_op::logical_not: emit(op::logical_not); break;
+					case un_op::to_bool: emit(op::to_bool); break;
+				}
+				return;
+			}
+
+			case node_kind::call: {
+				auto p = static_cast<const call_node *>(&n);
+				for (int i = 0; i < p->argc; ++i) compile(*p->args[i]);
+				emit(op::call, p->fid);
+				return;
+			}
+
+			case node_kind::fma: {
+				auto p = static_cast<const fma_node *>(&n);
+				compile(*p->a);
+				compile(*p->b);
+				compile(*p->c);
+				emit(op::fma);
+				return;
+			}
+
+			case node_kind::ternary: {
+				auto p = static_cast<const ternary_node *>(&n);
+				if (select_for(n).speculate(*p->t, *p->f)) {
+					compile(*p->c);
+					compile(*p->t);
+					compile(*p->f);
+					emit(op::select);
+					return;
+				}
+				compile(*p->c);
+				emit(op::to_bool);
+				emit_branch(n, [&] { compile(*p->t); }, [&] { compile(*p->f); });
+				return;
+			}
+
+			case node_kind::binary: compile_binary(static_cast<const binary_node &>(n)); return;
+
+			case node_kind::shared: {
+				auto p = static_cast<const shared_node *>(&n);
+				compile(*p->value);
+				if (p->uses == 0) return;
+				if (locals_.size() <= p->index) locals_.resize(p->index + 1);
+				local &l = locals_[p->index];
+				l.slot = alloc_local();
+				l.pending = p->uses;
+				emit(op::store_local, l.slot);
+				return;
+			}
+			case node_kind::ref: {
+				local &l = locals_[static_cast<const ref_node &>(n).def->index];
+				emit(op::load_local, l.slot);
+				// no jump goes backwards, so the last read in code order is the last one at run time
+				if (--l.pending == 0) free_locals_.push_back(l.slot);
+				return;
+			}
+		}
+
+		emit_const(std::numeric_limits<double>::quiet_NaN());
+	}
+
+private:
+	// fuse() scratch, kept across reset()
+	std::vector<bool> is_target_;
+	std::vector<instr> fused_;
+	std::vector<std::size_t> remap_;
+
+	// open-addressed index of consts by bit pattern: pool index + 1, 0 = empty.
+	// kept at most half full; unlike a node-based map, reset() frees nothing.
+	std::vector<std::uint32_t> const_slots_;
+
+	// local slot and reads still to come of each shared_node, by shared_node::index
+	struct local { int slot = 0; int pending = 0; };
+	std::vector<local> locals_;
+	std::vector<int> free_locals_;
+
+	int alloc_local() {
+		if (!free_locals_.empty()) {
+			const int s = free_locals_.back();
+			free_locals_.pop_back();
+			return s;
+		}
+		return static_cast<int>(n_locals++);
+	}
+
+	static std::uint64_t bits_of(double v) {
+		std::uint64_t bits;
+		std::memcpy(&bits, &v, sizeof bits);
+		return bits;
+	}
+	static std::size_t slot_hash(std::uint64_t bits) {
+		return static_cast<std::size_t>(((bits ^ (bits >> 29)) * 0x9e3779b97f4a7c15ull) >> 32);
+	}
+
+	void grow_const_slots() {
+		const_slots_.assign(const_slots_.empty() ? 64 : 2 * const_slots_.size(), 0u);
+		const std::size_t mask = const_slots_.size() - 1;
+		for (std::size_t i = 0; i < consts.size(); ++i) {
+			std::size_t h = slot_hash(bits_of(consts[i])) & mask;
+			while (const_slots_[h] != 0) h = (h + 1) & mask;
+			const_slots_[h] = static_cast<std::uint32_t>(i + 1);
+		}
+	}
+
+	// the select_model for node n: with hints, a condition that nearly always goes one way
+	// predicts well, so both arms are not worth running; one that often goes either way
+	// mispredicts, so a select may cost twice as much
+	select_model select_for(const node &n) const {
+		select_model m = select;
+		const branch_hints::outcome *o = hints ? hints->find(n.id) : nullptr;
+		if (!o) return m;
+		const double held = static_cast<double>(o->held) / static_cast<double>(o->executed);
+		if (held < 0.02 || held > 0.98) m.budget = select_model::stack;
+		else if (held > 0.1 && held < 0.9) m.budget *= 2;
+		return m;
+	}
+
+	// the condition is on the stack: then_arm runs when it holds, else_arm otherwise.
+	// cond jz else; then arm; jmp end; else: else arm; end: (see compiled_expr::vm_eval_block)
+	// with layout and hints saying the condition mostly fails, the arms swap places behind
+	// a jnz, so the likely one falls through.
+	template <class Then, class Else>
+	void emit_branch(const node &n, Then &&then_arm, Else &&else_arm) {
+		const branch_hints::outcome *o = layout && hints ? hints->find(n.id) : nullptr;
+		const bool flip = o && 2 * o->held < o->executed;
+		sites.push_back({code.size(), n.id});
+		const std::size_t jump = emit_placeholder(flip ? op::jnz : op::jz);
+		const std::size_t base = depth;
+		shift += 1;
+		if (flip) else_arm();
+		else then_arm();
+		const std::size_t jmp_end = emit_placeholder(op::jmp);
+		shift -= 1;
+		patch_target(jump, code.size());
+		depth = base; // each arm starts from the depth left by the jump
+		shift += 2;
+		if (flip) then_arm();
+		else else_arm();
+		shift -= 2;
+		patch_target(jmp_end, code.size());
+	}
+
+	void compile_binary(const binary_node &b) {
+		if ((b.op == bin_op::and_and || b.op == bin_op::or_or) && select_for(b).speculate(*b.r)) {
+			compile(*b.l);
+			if (b.op == bin_op::or_or) emit_const(1.0);
+			compile(*b.r);
+			emit(op::to_bool);
+			if (b.op == bin_op::and_and) emit_const(0.0);
+			emit(op::select);
+			return;
+		}
+
+		if (b.op == bin_op::and_and) {
+			compile(*b.l);
+			emit(op::to_bool);
+			emit_branch(b, [&] { compile(*b.r); emit(op::to_bool); }, [&] { emit_const(0.0); });
+			return;
+		}
+
+		if (b.op == bin_op::or_or) {
+			compile(*b.l);
+			emit(op::to_bool);
+			emit_branch(b, [&] { emit_const(1.0); }, [&] { compile(*b.r); emit(op::to_bool); });
+			return;
+		}
+
+		compile(*b.l);
+		compile(*b.r);
+
+		switch (b.op) {
+			case bin_op::add: emit(op::add); break;
+			case bin_op::sub: emit(op::sub); break;
+			case bin_op::mul: emit(op::mul); break;
+			case bin_op::div_: emit(op::div_); break;
+			case bin_op::mod: emit(op::mod); break;
+			case bin_op::pow: emit(op::pow); break;
+
+			case bin_op::lt: emit(op::lt); break;
+			case bin_op::le: emit(op::le); break;
+			case bin_op::gt: emit(op::gt); break;
+			case bin_op::ge: emit(op::ge); break;
+			case bin_op::eq: emit(op::eq); break;
+			case bin_op::ne: emit(op::ne); break;
+
+			case bin_op::and_and:
+			case bin_op::or_or:
+				break;
+		}
+	}
+};
+
+// ---------- register compiler ----------
+// lowers the folded AST to three-address code for the register backend.
+// every temporary is used exactly once, so registers are freed at their single use and
+// handed out again in program order: linear-scan allocation over the tree walk. the value
+// of a shared_node is the exception: its register is held until its last ref_node.
+class register_compiler {
+public:
+	using rop = compiled_expr::reg_op;
+	using rinstr = compiled_expr::reg_instr;
+
+	std::vector<rinstr> code;
+	std::vector<double> consts;
+	std::size_t n_regs = 0;
+	bool ok = true; // false if the program does not fit the 16-bit operand encoding
+	select_model select{select_model::reg};
+
+	void compile_root(const node &n) {
+		const std::uint16_t o = compile(n, -1);
+		emit(rop::ret, 0, o);
+	}
+
+	// forget the last program but keep every buffer's capacity
+	void reset() {
+		code.clear();
+		consts.clear();
+		n_regs = 0;
+		ok = true;
+		free_.clear();
+		held_.clear();
+		const_slot_.clear();
+	}
+
+private:
+	static constexpr std::size_t bank_size = std::size_t(1) << compiled_expr::operand_bits;
+
+	std::vector<std::uint16_t> free_;
+	std::vector<int> held_;              // by register: releases to ignore before it is free
+	std::vector<std::uint16_t> shared_;  // operand of each shared_node, by shared_node::index
+	std::unordered_map<std::uint64_t, std::uint16_t> const_slot_;
+
+	static std::uint16_t operand(std::uint16_t bank, std::size_t index) {
+		return static_cast<std::uint16_t>((bank << compiled_expr::operand_bits) | (index & (bank_size - 1)));
+	}
+	static bool is_reg(std::uint16_t o) { return (o >> compiled_expr::operand_bits) == compiled_expr::reg_bank; }
+
+	std::uint16_t alloc() {
+		if (!free_.empty()) {
+			const std::uint16_t r = free_.back();
+			free_.pop_back();
+			return r;
+		}
+		if (n_regs + 1 >= bank_size) ok = false;
+		return static_cast<std::uint16_t>(n_regs++ & (bank_size - 1));
+	}
+	void release(std::uint16_t o) {
+		if (!is_reg(o)) return;
+		if (o < held_.size() && held_[o] > 0) {
+			--held_[o];
+			return;
+		}
+		free_.push_back(o);
+	}
+
+	std::uint16_t konst(double v) {
+		std::uint64_t bits = 0;
+		static_assert(sizeof bits == sizeof v, "double must be 64-bit");
+		std::memcpy(&bits, &v, sizeof v);
+		auto it = const_slot_.find(bits);
+		if (it != const_slot_.end()) return it->second;
+		if (consts.size() + 1 >= bank_size) ok = false;
+		const std::uint16_t o = operand(compiled_expr::const_bank, consts.size());
+		consts.push_back(v);
+		const_slot_.emplace(bits, o);
+		return o;
+	}
+
+	void emit(rop opcode, std::uint16_t dst, std::uint16_t a = 0, std::uint16_t b = 0, int fid = 0) {
+		rinstr in;
+		in.opcode = opcode;
+		in.fid = static_cast<std::uint8_t>(fid);
+		in.dst = dst;
+		in.a = a;
+		in.b = b;
+		code.push_back(in);
+	}
+
+	std::size_t emit_jump(rop opcode, std::uint16_t cond = 0) {
+		emit(opcode, 0, cond);
+		return code.size() - 1;
+	}
+
+	void patch_target(std::size_t at) {
+		if (code.size() > 0xffff) ok = false;
+		code[at].dst = static_cast<std::uint16_t>(code.size());
+	}
+
+	// destination: the caller's register, or a fresh one
+	std::uint16_t dest(int hint) { return hint >= 0 ? static_cast<std::uint16_t>(hint) : alloc(); }
+
+	// evaluate n into register dst
+	void compile_into(const node &n, std::uint16_t dst) {
+		const std::uint16_t o = compile(n, dst);
+		if (o != dst) {
+			release(o);
+			emit(rop::mov, dst, o);
+		}
+	}
+
+	// returns the operand holding the value of n; hint >= 0 asks for that register
+	std::uint16_t compile(const node &n, int hint) {
+		switch (n.kind) {
+			case node_kind::num: return konst(static_cast<const num_node &>(n).n);
+			case node_kind::var: return operand(compiled_expr::var_bank, static_cast<std::size_t>(static_cast<const var_node &>(n).index));
+
+			case node_kind::unary: {
+				auto p = static_cast<const unary_node *>(&n);
+				if (p->op == un_op::plus) return compile(*p->a, hint);
+				const std::uint16_t a = compile(*p->a, -1);
+				release(a);
+				const std::uint16_t d = dest(hint);
+				switch (p->op) {
+					case un_op::minus: emit(rop::neg, d, a); break;
+					case un_op::logical_not: emit(rop::logical_not, d, a); break;
+					case un_op::to_bool: emit(rop::to_bool, d, a); break;
+					case un_op::plus: break;
+				}
+				return d;
+			}
+
+			case node_kind::call: {
+				auto p = static_cast<const call_node *>(&n);
+				const std::uint16_t a = compile(*p->args[0], -1);
+				const std::uint16_t b = (p->argc == 2) ? compile(*p->args[1], -1) : 0;
+				release(a);
+				if (p->argc == 2) release(b);
+				const std::uint16_t d = dest(hint);
+				emit(rop::call, d, a, b, p->fid);
+				return d;
+			}
+
+			case node_kind::fma: {
+				auto p = static_cast<const fma_node *>(&n);
+				const std::uint16_t a = compile(*p->a, -1);
+				const std::uint16_t b = compile(*p->b, -1);
+				const std::uint16_t d = dest(hint); // taken while a and b are live, so it is neither
+				compile_into(*p->c, d);
+				release(a);
+				release(b);
+				emit(rop::fma, d, a, b);
+				return d;
+			}
+
+			case node_kind::ternary: {
+				auto p = static_cast<const ternary_node *>(&n);
+				if (select.speculate(*p->t, *p->f)) {
+					const std::uint16_t d = dest(hint);
+					compile_into(*p->c, d);
+					const std::uint16_t t = compile(*p->t, -1);
+					const std::uint16_t f = compile(*p->f, -1);
+					release(t);
+					release(f);
+					emit(rop::select, d, t, f);
+					return d;
+				}
+				const std::uint16_t c = compile(*p->c, -1);
+				release(c);
+				const std::size_t jz_else = emit_jump(rop::jz, c);
+				const std::uint16_t d = dest(hint);
+				compile_into(*p->t, d);
+				const std::size_t jmp_end = emit_jump(rop::jmp);
+				patch_target(jz_else);
+				compile_into(*p->f, d);
+				patch_target(jmp_end);
+				return d;
+			}
+
+			case node_kind::binary: return compile_binary(static_cast<const binary_node &>(n), hint);
+
+			case node_kind::shared: {
+				auto p = static_cast<const shared_node *>(&n);
+				// a value read again later must not land in the consumer's register
+				const std::uint16_t o = compile(*p->value, p->uses > 0 ? -1 : hint);
+				if (p->uses > 0 && is_reg(o)) {
+					if (held_.size() <= o) held_.resize(o + 1u, 0);
+					held_[o] = p->uses; // every ref_node releases it once more
+				}
+				if (shared_.size() <= p->index) shared_.resize(p->index + 1);
+				shared_[p->index] = o;
+				return o;
+			}
+			case node_kind::ref: return shared_[static_cast<const ref_node &>(n).def->index];
+		}
+
+		return konst(std::numeric_limits<double>::quiet_NaN());
+	}
+
+	std::uint16_t compile_binary(const binary_node &b, int hint) {
+		if ((b.op == bin_op::and_and || b.op == bin_op::or_or) && select.speculate(*b.r)) {
+			const std::uint16_t d = dest(hint);
+			compile_into(*b.l, d);
+			const std::uint16_t r = to_bool_operand(*b.r);
+			release(r);
+			if (b.op == bin_op::and_and) emit(rop::select, d, r, konst(0.0));
+			else emit(rop::select, d, konst(1.0), r);
+			return d;
+		}
+
+		if (b.op == bin_op::and_and || b.op == bin_op::or_or) {
+			const std::uint16_t c = compile(*b.l, -1);
+			release(c);
+			const std::size_t jz_other = emit_jump(rop::jz, c);
+			const std::uint16_t d = dest(hint);
+			if (b.op == bin_op::and_and) {
+				to_bool_into(*b.r, d);
+			} else {
+				emit(rop::mov, d, konst(1.0));
+			}
+			const std::size_t jmp_end = emit_jump(rop::jmp);
+			patch_target(jz_other);
+			if (b.op == bin_op::and_and) {
+				emit(rop::mov, d, konst(0.0));
+			} else {
+				to_bool_into(*b.r, d);
+			}
+			patch_target(jmp_end);
+			return d;
+		}
+
+		const std::uint16_t l = compile(*b.l, -1);
+		const std::uint16_t r = compile(*b.r, -1);
+		release(l);
+		release(r);
+		const std::uint16_t d = dest(hint);
+
+		switch (b.op) {
+			case bin_op::add: emit(rop::add, d, l, r); break;
+			case bin_op::sub: emit(rop::sub, d, l, r); break;
+			case bin_op::mul: emit(rop::mul, d, l, r); break;
+			case bin_op::div_: emit(rop::div_, d, l, r); break;
+			case bin_op::mod: emit(rop::mod, d, l, r); break;
+			case bin_op::pow: emit(rop::pow, d, l, r); break;
+
+			case bin_op::lt: emit(rop::lt, d, l, r); break;
+			case bin_op::le: emit(rop::le, d, l, r); break;
+			case bin_op::gt: emit(rop::gt, d, l, r); break;
+			case bin_op::ge: emit(rop::ge, d, l, r); break;
+			case bin_op::eq: emit(rop::eq, d, l, r); break;
+			case bin_op::ne: emit(rop::ne, d, l, r); break;
+
+			case bin_op::and_and:
+			case bin_op::or_or:
+				break;
+		}
+		return d;
+	}
+
+	// comparisons and logical operators already produce 0/1, so they skip the to_bool
+	static bool yields_bool(const node &n) {
+		switch (n.kind) {
+			case node_kind::unary: {
+				const un_op o = static_cast<const unary_node &>(n).op;
+				return o == un_op::logical_not || o == un_op::to_bool;
+			}
+			case node_kind::binary: return bin_op::lt <= static_cast<const binary_node &>(n).op;
+			case node_kind::shared: return yields_bool(*static_cast<const shared_node &>(n).value);
+			case node_kind::ref: return yields_bool(*static_cast<const ref_node &>(n).def->value);
+			default: return false;
+		}
+	}
+
+	// operand holding n normalized to 0/1
+	std::uint16_t to_bool_operand(const node &n) {
+		const std::uint16_t o = compile(n, -1);
+		if (yields_bool(n)) return o;
+		release(o);
+		const std::uint16_t d = alloc();
+		emit(rop::to_bool, d, o);
+		return d;
+	}
+
+	void to_bool_into(const node &n, std::uint16_t d) {
+		if (yields_bool(n)) {
+			compile_into(n, d);
+			return;
+		}
+		const std::uint16_t o = compile(n, -1);
+		release(o);
+		emit(rop::to_bool, d, o);
+	}
+};
+
+#if defined(BBB_EXPRDSL_JIT)
+// lowers the fused stack bytecode to x86-64 System V code. stack depth is static at every pc,
+// so each slot gets a fixed frame offset; the top of stack stays in xmm0 and everything below
+// it lives in the frame, which leaves nothing to spill around libm calls.
+// the code at offset 0 takes the record in rdi and keeps it in rbx (callee-saved, so it
+// survives libm calls): variables are [rbx + 8 * slot], [rsp + 8 * i] is stack slot i, the
+// last n_locals of them holding the locals. records of at most x y z w also get an entry at
+// args_entry taking them in xmm0..3: it stores them past the stack slots, points rbx there
+// and joins the same body. with outputs (compile_many), the entry also takes the output
+// array in rsi and keeps it past the stack slots for store_out; there is no args entry.
+class jit_compiler {
+public:
+	using op = compiled_expr::op;
+	using instr = compiled_expr::instr;
+	using as = x64_assembler;
+
+	// deeper programs stay on the interpreter rather than take a huge native frame
+	static constexpr std::size_t max_slots = 4096;
+
+	// offset of the (x, y, z, w) entry in the last compiled code; 0 if it has none
+	std::size_t args_entry = 0;
+
+	std::shared_ptr<const exec_memory> compile(const_span<instr> code, const_span<double> consts,
+	                                           std::size_t max_stack, std::size_t n_locals, std::size_t record_size,
+	                                           bool outputs = false) {
+		if (code.empty() || max_stack > max_slots) return nullptr;
+		pool_ = consts.data();
+		locals_ = static_cast<long>(max_stack - n_locals);
+
+		// depth before each instruction; a jump target inherits the depth at its jump
+		std::vector<long> depth(code.size() + 1, -1);
+		std::vector<bool> is_target(code.size() + 1, false);
+		depth[0] = 0;
+		for (std::size_t pc = 0; pc < code.size(); ++pc) {
+			if (depth[pc] < 0) return nullptr; // unreachable code: not something the compiler emits
+			const long after = depth[pc] + bytecode_compiler::stack_effect(code[pc].opcode, code[pc].arg);
+			if (bytecode_compiler::is_jump(code[pc].opcode)) {
+				depth[static_cast<std::size_t>(code[pc].arg)] = after;
+				is_target[static_cast<std::size_t>(code[pc].arg)] = true;
+			}
+			if (code[pc].opcode != op::jmp && code[pc].opcode != op::end) depth[pc + 1] = after;
+		}
+
+		// keep rsp 16-byte aligned at call sites: on entry it is 8 off, push rbx fixes that
+		const bool args = record_size <= 4 && !outputs;
+		const std::int32_t record_at = static_cast<std::int32_t>(8 * max_stack); // x, y, z, w of the args entry
+		out_at_ = record_at;                                                      // or the output array
+		frame_ = static_cast<std::int32_t>((8 * max_stack + (args ? 32 : outputs ? 8 : 0) + 15) / 16 * 16);
+		sse41_ = __builtin_cpu_supports("sse4.1");
+		fma3_ = __builtin_cpu_supports("fma");
+
+		a_.push_rbx();
+		a_.mov_rbx_rdi();
+		a_.sub_rsp(frame_);
+		if (outputs) a_.mov_store_rsi(out_at_);
+		const std::size_t body = a_.here();
+
+		std::vector<std::size_t> at(code.size());
+		for (std::size_t pc = 0; pc < code.size(); ++pc) {
+			at[pc] = a_.here();
+			const op o = code[pc].opcode;
+			if (op::lt <= o && o <= op::ne && pc + 1 < code.size() && code[pc + 1].opcode == op::jnz && !is_target[pc + 1]) {
+				// a cmp b; jnz: one ucomisd and a jump when it holds, as jlt..jne do for jz
+				lower_jump_if(static_cast<int>(o) - static_cast<int>(op::lt), code[pc + 1].arg, depth[pc]);
+				at[++pc] = a_.here();
+				continue;
+			}
+			lower(code[pc], depth[pc]);
+		}
+		for (const auto &f : fixups_) a_.patch(f.first, at[f.second]);
+
+		args_entry = 0;
+		if (args) {
+			args_entry = a_.here();
+			a_.push_rbx();
+			a_.sub_rsp(frame_);
+			for (int v = 0; v < 4; ++v) a_.movsd_store(record_at + 8 * v, v);
+			a_.lea_rbx_rsp(record_at);
+			a_.patch(a_.jmp(), body);
 		}
-		return n;
+		return exec_memory::map(a_.buf);
 	}
 
-	node_ptr parse_equality() {
-		auto n = parse_relational();
-		while (true) {
-			if (accept(tok_kind::eq_eq)) {
-				std::size_t p = lex_.peek().pos;
-				auto r = parse_relational();
-				n = std::make_unique<binary_node>(bin_op::eq, p, std::move(n), std::move(r));
-			} else if (accept(tok_kind::bang_eq)) {
-				std::size_t p = lex_.peek().pos;
-				auto r = parse_relational();
-				n = std::make_unique<binary_node>(bin_op::ne, p, std::move(n), std::move(r));
-			} else break;
-		}
-		return n;
+private:
+	as a_;
+	std::int32_t frame_ = 0;
+	std::int32_t out_at_ = 0; // frame offset of the output array
+	bool sse41_ = false;
+	bool fma3_ = false;
+	const double *pool_ = nullptr; // constants are baked into the code as immediates
+	long locals_ = 0;              // stack slot of local 0
+	std::vector<std::pair<std::size_t, std::size_t>> fixups_; // rel32 offset, target pc
+
+	static std::int32_t var(int i) { return 8 * i; } // from rbx
+	static std::int32_t slot(long i) { return static_cast<std::int32_t>(8 * i); }
+
+	// make room for a push: the old top of stack goes to its frame slot
+	void spill(long d) { if (d > 0) a_.movsd_store(slot(d - 1), 0); }
+	// the stack shrank to depth d: bring the new top into xmm0
+	void reload(long d) { if (d > 0) a_.movsd_load(0, slot(d - 1)); }
+	// xmm1 = b (old top), xmm0 = a, for a binary op at depth d
+	void operands(long d) {
+		a_.movapd(1, 0);
+		a_.movsd_load(0, slot(d - 2));
 	}
+	// x = x & 1.0: turns a cmpsd mask into 0/1
+	void mask_to_one(int x) {
+		a_.load_imm(7, 1.0);
+		a_.andpd(x, 7);
+	}
+	void jump_to(std::size_t fixup, int target) { fixups_.emplace_back(fixup, static_cast<std::size_t>(target)); }
 
-	node_ptr parse_relational() {
-		auto n = parse_additive();
-		while (true) {
-			if (accept(tok_kind::less)) {
-				std::size_t p = lex_.peek().pos;
-				auto r = parse_additive();
-				n = std::make_unique<binary_node>(bin_op::lt, p, std::move(n), std::move(r));
-			} else if (accept(tok_kind::less_eq)) {
-				std::size_t p = lex_.peek().pos;
-				auto r = parse_additive();
-				n = std::make_unique<binary_node>(bin_op::le, p, std::move(n), std::move(r));
-			} else if (accept(tok_kind::greater)) {
-				std::size_t p = lex_.peek().pos;
-				auto r = parse_additive();
-				n = std::make_unique<binary_node>(bin_op::gt, p, std::move(n), std::move(r));
-			} else if (accept(tok_kind::greater_eq)) {
-				std::size_t p = lex_.peek().pos;
-				auto r = parse_additive();
-				n = std::make_unique<binary_node>(bin_op::ge, p, std::move(n), std::move(r));
-			} else break;
-		}
-		return n;
+	// SSE arith opcode for add/sub/mul/div, k = 0..3
+	static std::uint8_t arith(int k) {
+		static const std::uint8_t opc[4] = {0x58, 0x5c, 0x59, 0x5e};
+		return opc[k];
 	}
 
-	node_ptr parse_additive() {
-		auto n = parse_multiplicative();
-		while (true) {
-			if (accept(tok_kind::plus)) {
-				std::size_t p = lex_.peek().pos;
-				auto r = parse_multiplicative();
-				n = std::make_unique<binary_node>(bin_op::add, p, std::move(n), std::move(r));
-			} else if (accept(tok_kind::minus)) {
-				std::size_t p = lex_.peek().pos;
-				auto r = parse_multiplicative();
-				n = std::make_unique<binary_node>(bin_op::sub, p, std::move(n), std::move(r));
-			} else break;
+	// flags for "a cmp b" (k: lt, le, gt, ge, eq, ne), then a jump taken when it is false.
+	// the 'above' forms make unordered operands compare false like the C++ operators.
+	void compare(int k, int xa, int xb) {
+		if (k <= 1) a_.ucomisd(xb, xa); // a < b  <=>  b above a
+		else a_.ucomisd(xa, xb);
+	}
+	void jump_unless(int k, int target) {
+		switch (k) {
+			case 0: case 2: jump_to(a_.jcc(as::be), target); break;
+			case 1: case 3: jump_to(a_.jcc(as::b), target); break;
+			case 4:
+				jump_to(a_.jcc(as::p), target);
+				jump_to(a_.jcc(as::ne), target);
+				break;
+			default: { // a != b is false only when ordered and equal
+				const std::size_t skip = a_.jcc(as::p);
+				jump_to(a_.jcc(as::e), target);
+				a_.patch(skip, a_.here());
+				break;
+			}
 		}
-		return n;
 	}
 
-	node_ptr parse_multiplicative() {
-		auto n = parse_unary();
-		while (true) {
-			if (accept(tok_kind::star)) {
-				std::size_t p = lex_.peek().pos;
-				auto r = parse_unary();
-				n = std::make_unique<binary_node>(bin_op::mul, p, std::move(n), std::move(r));
-			} else if (accept(tok_kind::slash)) {
-				std::size_t p = lex_.peek().pos;
-				auto r = parse_unary();
-				n = std::make_unique<binary_node>(bin_op::div_, p, std::move(n), std::move(r));
-			} else if (accept(tok_kind::percent)) {
-				std::size_t p = lex_.peek().pos;
-				auto r = parse_unary();
-				n = std::make_unique<binary_node>(bin_op::mod, p, std::move(n), std::move(r));
-			} else break;
+	// the complement of jump_unless: taken when "a cmp b" holds
+	void jump_if(int k, int target) {
+		switch (k) {
+			case 0: case 2: jump_to(a_.jcc(as::a), target); break;
+			case 1: case 3: jump_to(a_.jcc(as::ae), target); break;
+			case 4: {
+				const std::size_t skip = a_.jcc(as::p);
+				jump_to(a_.jcc(as::e), target);
+				a_.patch(skip, a_.here());
+				break;
+			}
+			default:
+				jump_to(a_.jcc(as::p), target);
+				jump_to(a_.jcc(as::ne), target);
+				break;
 		}
-		return n;
+	}
+	// comparison k (lt..ne) at depth d followed by a jnz to target
+	void lower_jump_if(int k, int target, long d) {
+		a_.movapd(1, 0);
+		a_.movsd_load(2, slot(d - 2));
+		compare(k, 2, 1);
+		reload(d - 2);
+		jump_if(k, target);
 	}
 
-	node_ptr parse_unary() {
-		if (accept(tok_kind::plus))  return std::make_unique<unary_node>(un_op::plus, lex_.peek().pos, parse_unary());
-		if (accept(tok_kind::minus)) return std::make_unique<unary_node>(un_op::minus, lex_.peek().pos, parse_unary());
-		if (accept(tok_kind::bang))  return std::make_unique<unary_node>(un_op::logical_not, lex_.peek().pos, parse_unary());
-		return parse_power();
+	template <class F>
+	static std::uintptr_t addr(F f) { return reinterpret_cast<std::uintptr_t>(f); }
+
+	// libm entry points in find_func() id order
+	static std::uintptr_t func(int fid) {
+		using f1 = double (*)(double);
+		using f2 = double (*)(double, double);
+		switch (fid) {
+			case 0: return addr(f1([](double a) { return std::sin(a); }));
+			case 1: return addr(f1([](double a) { return std::cos(a); }));
+			case 2: return addr(f1([](double a) { return std::tan(a); }));
+			case 3: return addr(f1([](double a) { return std::asin(a); }));
+			case 4: return addr(f1([](double a) { return std::acos(a); }));
+			case 5: return addr(f1([](double a) { return std::atan(a); }));
+			case 6: return addr(f1([](double a) { return std::exp(a); }));
+			case 7: return addr(f1([](double a) { return std::log(a); }));
+			case 8: return addr(f1([](double a) { return std::log10(a); }));
+			case 9: return addr(f1([](double a) { return std::sqrt(a); }));
+			case 10: return addr(f1([](double a) { return std::fabs(a); }));
+			case 11: return addr(f1([](double a) { return std::floor(a); }));
+			case 12: return addr(f1([](double a) { return std::ceil(a); }));
+			case 13: return addr(f1([](double a) { return std::round(a); }));
+			case 14: return addr(f2([](double a, double b) { return std::pow(a, b); }));
+			case 15: return addr(f2([](double a, double b) { return std::atan2(a, b); }));
+			case 16: return addr(f2([](double a, double b) { return std::fmod(a, b); }));
+			case 17: return addr(f2([](double a, double b) { return a < b ? a : b; }));
+			default: return addr(f2([](double a, double b) { return b < a ? a : b; }));
+		}
 	}
 
-	node_ptr parse_power() {
-		auto n = parse_primary();
-		if (accept(tok_kind::caret)) {
-			std::size_t p = lex_.peek().pos;
-			auto r = parse_unary();
-			n = std::make_unique<binary_node>(bin_op::pow, p, std::move(n), std::move(r));
+	// function fid at depth d, result in xmm0
+	void call(int fid, long d) {
+		switch (fid) {
+			case 9: a_.sd(0x51, 0, 0); return; // sqrtsd
+			case 10: a_.load_bits(1, 0x7fffffffffffffffull); a_.andpd(0, 1); return;
+			case 11: if (sse41_) { a_.roundsd(0, 0, 9); return; } break;
+			case 12: if (sse41_) { a_.roundsd(0, 0, 10); return; } break;
+			case 17: operands(d); a_.sd(0x5d, 0, 1); return; // minsd: a < b ? a : b
+			case 18: operands(d); a_.sd(0x5f, 0, 1); return; // maxsd: b < a ? a : b
+			default: break;
 		}
-		return n;
+		if (fid >= 14) operands(d);
+		a_.call(func(fid));
 	}
 
-	node_ptr parse_primary() {
-		const token &t = lex_.peek();
-		switch (t.kind) {
-			case tok_kind::number: {
-				token tt = lex_.next();
-				return std::make_unique<num_node>(tt.number, tt.pos);
+	void lower(const instr &in, long d) {
+		switch (in.opcode) {
+			case op::push_const: spill(d); a_.load_imm(0, pool_[in.arg]); break;
+			case op::push_var: spill(d); a_.movsd_load_rec(0, var(in.arg)); break;
+			case op::pop: reload(d - 1); break;
+			case op::to_bool: a_.xorpd(1, 1); a_.cmpsd(0, 1, 4); mask_to_one(0); break;
+			case op::neg: a_.load_bits(1, 0x8000000000000000ull); a_.xorpd(0, 1); break;
+			case op::logical_not: a_.xorpd(1, 1); a_.cmpsd(0, 1, 0); mask_to_one(0); break;
+
+			case op::add: case op::sub: case op::mul: case op::div_:
+				operands(d);
+				a_.sd(arith(static_cast<int>(in.opcode) - static_cast<int>(op::add)), 0, 1);
+				break;
+			case op::mod: call(16, d); break;
+			case op::pow: call(14, d); break;
+
+			// cmpsd predicates: 0 = eq, 1 = lt, 2 = le, 4 = neq (true when unordered)
+			case op::lt: operands(d); a_.cmpsd(0, 1, 1); mask_to_one(0); break;
+			case op::le: operands(d); a_.cmpsd(0, 1, 2); mask_to_one(0); break;
+			case op::gt: operands(d); a_.cmpsd(1, 0, 1); mask_to_one(1); a_.movapd(0, 1); break;
+			case op::ge: operands(d); a_.cmpsd(1, 0, 2); mask_to_one(1); a_.movapd(0, 1); break;
+			case op::eq: operands(d); a_.cmpsd(0, 1, 0); mask_to_one(0); break;
+			case op::ne: operands(d); a_.cmpsd(0, 1, 4); mask_to_one(0); break;
+
+			case op::jz: { // false is ordered and equal to zero
+				a_.xorpd(1, 1);
+				a_.ucomisd(0, 1);
+				reload(d - 1); // movsd leaves the flags alone
+				const std::size_t skip = a_.jcc(as::p);
+				jump_to(a_.jcc(as::e), in.arg);
+				a_.patch(skip, a_.here());
+				break;
 			}
-			case tok_kind::var: {
-				token tt = lex_.next();
-				if (tt.var_index < 0 || 3 < tt.var_index) fail(tt.pos, "Invalid variable index");
-				return std::make_unique<var_node>(tt.var_index, tt.pos);
+			case op::jnz: // true is unordered or not equal to zero
+				a_.xorpd(1, 1);
+				a_.ucomisd(0, 1);
+				reload(d - 1);
+				jump_to(a_.jcc(as::p), in.arg);
+				jump_to(a_.jcc(as::ne), in.arg);
+				break;
+			case op::jmp: jump_to(a_.jmp(), in.arg); break;
+			case op::call: call(in.arg, d); break;
+
+			case op::store_local: a_.movsd_store(slot(locals_ + in.arg), 0); break;
+			case op::load_local: spill(d); a_.movsd_load(0, slot(locals_ + in.arg)); break;
+			case op::fma: // xmm0 = c
+				if (fma3_) {
+					a_.movsd_load(1, slot(d - 3));
+					a_.movsd_load(2, slot(d - 2));
+					a_.vfmadd231sd(0, 1, 2);
+				} else {
+					a_.movapd(2, 0);
+					a_.movsd_load(0, slot(d - 3));
+					a_.movsd_load(1, slot(d - 2));
+					a_.call(addr(static_cast<double (*)(double, double, double)>([](double a, double b, double c) { return std::fma(a, b, c); })));
+				}
+				break;
+
+			case op::select: { // xmm0 = f; xmm1 = all ones where cond is true (unordered included)
+				a_.movsd_load(1, slot(d - 3));
+				a_.xorpd(2, 2);
+				a_.cmpsd(1, 2, 4);
+				a_.movsd_load(2, slot(d - 2));
+				a_.andpd(2, 1);
+				a_.andnpd(1, 0);
+				a_.orpd(1, 2);
+				a_.movapd(0, 1);
+				break;
 			}
-			case tok_kind::ident: {
-				token id = lex_.next();
-				if (!accept(tok_kind::lparen)) fail(id.pos, "Identifier must be a function call like name(...)");
-				auto it = func_table().find(id.ident);
-				if (it == func_table().end()) fail(id.pos, "Unknown or disallowed function: " + id.ident);
 
-				func_spec spec = it->second;
-				std::vector<node_ptr> args;
+			case op::store_out:
+				a_.mov_load_rax(out_at_);
+				a_.movsd_store_rax(8 * in.arg, 0);
+				reload(d - 1);
+				break;
 
-				if (!accept(tok_kind::rparen)) {
-					args.push_back(parse_expr());
-					while (accept(tok_kind::comma)) args.push_back(parse_expr());
-					expect(tok_kind::rparen, "')' to close function call");
-				}
+			case op::end:
+				if (d == 0) a_.xorpd(0, 0);
+				a_.add_rsp(frame_);
+				a_.pop_rbx();
+				a_.ret();
+				break;
 
-				if (static_cast<int>(args.size()) != spec.argc) {
-					fail(id.pos, "Function '" + id.ident + "' expects " + std::to_string(spec.argc) +
-											 " args, got " + std::to_string(args.size()));
-				}
-				return std::make_unique<call_node>(spec.fid, spec.argc, id.pos, std::move(args));
+			case op::add_vc: case op::sub_vc: case op::mul_vc: case op::div_vc:
+				spill(d);
+				a_.movsd_load_rec(0, var(in.arg));
+				a_.load_imm(1, pool_[in.k]);
+				a_.sd(arith(static_cast<int>(in.opcode) - static_cast<int>(op::add_vc)), 0, 1);
+				break;
+			case op::add_cv: case op::sub_cv: case op::mul_cv: case op::div_cv:
+				spill(d);
+				a_.load_imm(0, pool_[in.k]);
+				a_.sd_rec(arith(static_cast<int>(in.opcode) - static_cast<int>(op::add_cv)), 0, var(in.arg));
+				break;
+			case op::add_vv: case op::sub_vv: case op::mul_vv: case op::div_vv:
+				spill(d);
+				a_.movsd_load_rec(0, var(in.arg));
+				a_.sd_rec(arith(static_cast<int>(in.opcode) - static_cast<int>(op::add_vv)), 0, var(in.arg2));
+				break;
+			case op::add_c: case op::sub_c: case op::mul_c: case op::div_c:
+				a_.load_imm(1, pool_[in.k]);
+				a_.sd(arith(static_cast<int>(in.opcode) - static_cast<int>(op::add_c)), 0, 1);
+				break;
+			case op::add_v: case op::sub_v: case op::mul_v: case op::div_v:
+				a_.sd_rec(arith(static_cast<int>(in.opcode) - static_cast<int>(op::add_v)), 0, var(in.arg));
+				break;
+
+			case op::jlt: case op::jle: case op::jgt: case op::jge: case op::jeq: case op::jne: {
+				const int k = static_cast<int>(in.opcode) - static_cast<int>(op::jlt);
+				a_.movapd(1, 0);
+				a_.movsd_load(2, slot(d - 2));
+				compare(k, 2, 1);
+				reload(d - 2);
+				jump_unless(k, in.arg);
+				break;
 			}
-			case tok_kind::lparen: {
-				(void)lex_.next();
-				auto n = parse_expr();
-				expect(tok_kind::rparen, "')'");
-				return n;
+			case op::jlt_vc: case op::jle_vc: case op::jgt_vc: case op::jge_vc: case op::jeq_vc: case op::jne_vc: {
+				const int k = static_cast<int>(in.opcode) - static_cast<int>(op::jlt_vc);
+				a_.movsd_load_rec(2, var(in.arg2));
+				a_.load_imm(1, pool_[in.k]);
+				compare(k, 2, 1);
+				jump_unless(k, in.arg);
+				break;
 			}
-			default:
-				fail(t.pos, "Expected primary expression");
+
+			case op::call_sin: case op::call_cos: case op::call_tan: case op::call_asin: case op::call_acos:
+			case op::call_atan: case op::call_exp: case op::call_log: case op::call_log10: case op::call_sqrt:
+			case op::call_abs: case op::call_floor: case op::call_ceil: case op::call_round:
+			case op::call_pow: case op::call_atan2: case op::call_fmod: case op::call_min: case op::call_max:
+				call(static_cast<int>(in.opcode) - static_cast<int>(op::call_sin), d);
+				break;
 		}
 	}
 };
+#endif // BBB_EXPRDSL_JIT
+} // namespace detail
 
-inline compile_error to_compile_error(const std::runtime_error &e) {
-	std::string s = e.what();
-	auto p = s.find(':');
-	if (p == std::string::npos) return compile_error{0, s};
-	std::size_t pos = 0;
-	try { pos = static_cast<std::size_t>(std::stoull(s.substr(0, p))); }
-	catch (...) { pos = 0; }
-	return compile_error{pos, s.substr(p + 1)};
-}
-
-// ---------- constant folding (safe set) ----------
-inline bool is_num(const node &n, double *out = nullptr) {
-	if (auto p = dynamic_cast<const num_node *>(&n)) {
-		if (out) *out = p->n;
-		return true;
+inline void compiled_expr::link(program &p, const detail::bytecode_compiler &bc, const compile_options &opts) {
+	p.own(bc.code, bc.consts); // copies: the context keeps its buffers
+	p.max_stack = bc.max_depth + bc.n_locals;
+	p.batch_slots = bc.max_lanes + bc.n_locals;
+	p.n_locals = bc.n_locals;
+	p.opts = opts;
+	p.opts.vars = nullptr;
+	p.opts.ranges = nullptr;
+	p.opts.bound = nullptr;
+	if (opts.ranges) p.ranges = *opts.ranges;
+	if (opts.bound) p.bound = *opts.bound;
+	const bool profile = opts.profile || opts.tier_up;
+	if (profile) {
+		p.counters = std::make_unique<detail::profile_counters>(p.code.size());
+		p.counters->sites = bc.sites;
+		p.tier = std::make_unique<tier_state>();
+		p.tier->after = opts.tier_up;
+		p.detour = true;
 	}
-	return false;
+	bind(p, opts.jit && !profile); // native code would run past the counters
 }
 
-inline double b2d(bool v) { return v ? 1.0 : 0.0; }
-inline bool truth(double v) { return v != 0.0; }
+inline void compiled_expr::bind(program &p, bool jit) {
+	resolve_dispatch(p);
 
-inline double eval_func(int fid, double a) {
-	switch (fid) {
-		case 0: return std::sin(a);
-		case 1: return std::cos(a);
-		case 2: return std::tan(a);
-		case 3: return std::asin(a);
-		case 4: return std::acos(a);
-		case 5: return std::atan(a);
-		case 6: return std::exp(a);
-		case 7: return std::log(a);
-		case 8: return std::log10(a);
-		case 9: return std::sqrt(a);
-		case 10: return std::fabs(a);
-		case 11: return std::floor(a);
-		case 12: return std::ceil(a);
-		case 13: return std::round(a);
-		default: return std::numeric_limits<double>::quiet_NaN();
+#if defined(BBB_EXPRDSL_JIT)
+	if (jit) {
+		detail::jit_compiler jc;
+		if (auto mem = jc.compile(p.code, p.consts, p.max_stack, p.n_locals, p.record_size, p.multi)) { // otherwise interpret
+			const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(mem->data());
+			if (p.multi) {
+				p.native_outputs = reinterpret_cast<native_outputs_fn>(base);
+			} else {
+				p.native_record = reinterpret_cast<native_record_fn>(base);
+				if (jc.args_entry) p.native = reinterpret_cast<native_fn>(base + jc.args_entry);
+			}
+			p.native_code = std::move(mem);
+		}
 	}
+#else
+	(void)jit;
+#endif
 }
 
-inline double eval_func(int fid, double a, double b) {
-	switch (fid) {
-		case 14: return std::pow(a,b);
-		case 15: return std::atan2(a,b);
-		case 16: return std::fmod(a,b);
-		case 17: return (a<b) ? a : b;
-		case 18: return (b < a) ? a : b;
-		default: return std::numeric_limits<double>::quiet_NaN();
+inline expr_profile compiled_expr::profile() const {
+	static constexpr const char *funcs[] = {
+		"sin", "cos", "tan", "asin", "acos", "atan", "exp", "log", "log10", "sqrt",
+		"abs", "floor", "ceil", "round", "pow", "atan2", "fmod", "min", "max",
+	};
+	constexpr std::size_t n_funcs = sizeof(funcs) / sizeof(funcs[0]);
+	static_assert(n_funcs == static_cast<std::size_t>(op::call_max) - static_cast<std::size_t>(op::call_sin) + 1,
+	              "function names out of sync with op::call_*");
+
+	expr_profile r;
+	const program &p = *prog_;
+	if (!p.counters) return r;
+	const detail::profile_counters &k = *p.counters;
+	r.evals = k.evals.load(std::memory_order_relaxed);
+	r.max_depth = k.max_depth.load(std::memory_order_relaxed);
+
+	std::uint64_t by_op[op_count] = {}, by_func[n_funcs] = {};
+	for (std::size_t pc = 0; pc < p.code.size(); ++pc) {
+		const instr &in = p.code[pc];
+		const std::uint64_t h = k.hits[pc].load(std::memory_order_relaxed);
+		r.instructions += h;
+		by_op[static_cast<std::size_t>(in.opcode)] += h;
+		if (in.opcode == op::call && in.arg >= 0 && static_cast<std::size_t>(in.arg) < n_funcs) by_func[in.arg] += h;
+		if (in.opcode >= op::call_sin) by_func[static_cast<std::size_t>(in.opcode) - static_cast<std::size_t>(op::call_sin)] += h;
+		if (is_cond_jump(in.opcode)) {
+			r.branches.push_back({pc, op_name(in.opcode), h, k.taken[pc].load(std::memory_order_relaxed)});
+		}
 	}
+	for (std::size_t o = 0; o < op_count; ++o) {
+		if (by_op[o]) r.ops.push_back({op_name(static_cast<op>(o)), by_op[o]});
+	}
+	for (std::size_t f = 0; f < n_funcs; ++f) {
+		if (by_func[f]) r.calls.push_back({funcs[f], by_func[f]});
+	}
+	// stable: ties keep op and function id order
+	std::stable_sort(r.ops.begin(), r.ops.end(), [](const auto &a, const auto &b) { return a.count > b.count; });
+	std::stable_sort(r.calls.begin(), r.calls.end(), [](const auto &a, const auto &b) { return a.count > b.count; });
+	return r;
 }
 
-inline node_ptr fold_constants(node_ptr n) {
-	if (!n) return n;
+// =============================
+// compile_context
+// =============================
+namespace detail {
+struct front_end;
+} // namespace detail
 
-	if (dynamic_cast<num_node *>(n.get()) || dynamic_cast<var_node *>(n.get())) return n;
+// scratch that compile() can reuse across calls: the ast arena and the code generators'
+// buffers keep their capacity, so compiling many expressions through one context only
+// allocates the finished program. a context is used by one thread at a time.
+class compile_context {
+public:
+	compile_context() = default;
+	compile_context(const compile_context &) = delete;
+	compile_context &operator=(const compile_context &) = delete;
 
-	if (auto p = dynamic_cast<unary_node *>(n.get())) {
-		p->a = fold_constants(std::move(p->a));
+private:
+	friend std::pair<compiled_expr, std::optional<compile_error>>
+	compile(std::string_view input, compile_context &ctx, const compile_options &opts);
+	friend std::pair<compiled_multi_expr, std::optional<compile_error>>
+	compile_many(const std::vector<std::string_view> &inputs, compile_context &ctx, const compile_options &opts);
+	friend std::pair<compiled_multi_expr, std::optional<compile_error>>
+	compile_gradient(std::string_view input, compile_context &ctx, const compile_options &opts);
+	friend std::optional<compile_error> validate(std::string_view input, compile_context &ctx, const var_schema *vars);
+	friend struct compiled_expr;
+	friend class compiled_multi_expr;
+	friend class expr_session;
+	friend struct detail::front_end;
+
+	const detail::branch_hints *hints_ = nullptr; // set by compiled_expr::tier_up only
+	detail::node_arena arena_;
+	std::vector<detail::node *> roots_; // compile_many, compile_gradient
+	detail::bind_pass bind_;
+	detail::range_pass ranges_;
+	detail::derivative_pass diff_;
+	detail::fast_math_pass fast_;
+	detail::cse_pass cse_;
+	detail::bytecode_compiler bc_;
+	detail::register_compiler rc_;
+};
 
-		double av = 0.0;
-		if (is_num(*p->a, &av)) {
-			switch (p->op) {
-				case un_op::plus:  return std::make_unique<num_node>(+av, p->pos);
-				case un_op::minus: return std::make_unique<num_node>(-av, p->pos);
-				case un_op::logical_not: return std::make_unique<num_node>(b2d(!truth(av)), p->pos);
-				case un_op::to_bool: return std::make_unique<num_node>(b2d(truth(av)), p->pos);
-			}
+namespace detail {
+// the compile_options steps compile(), compile_many(), compile_gradient() and expr_session
+// share ahead of code generation: begin() once, then parse() and lower() per input. each
+// entry point resets what it uses of ctx, and applies fast_math after lower() itself
+struct front_end {
+	// checks opts.vars and resolves opts.ranges and opts.bound against it
+	static parse_error begin(compile_context &ctx, const compile_options &opts) {
+		if (opts.vars) {
+			const parse_error e = check_schema(*opts.vars);
+			if (e) return e;
+		}
+		if (opts.ranges) {
+			const parse_error e = ctx.ranges_.bind(*opts.ranges, opts.vars);
+			if (e) return e;
 		}
+		if (opts.bound) return ctx.bind_.bind(*opts.bound, opts.vars);
+		return parse_error{};
+	}
 
-		if (p->op == un_op::plus) return std::move(p->a); // +x -> x
-		return n;
+	// input as a tree in ctx's arena; nullptr with e set if it does not parse
+	static node *parse(compile_context &ctx, std::string_view input, const compile_options &opts, parse_error &e) {
+		parser p(input, ctx.arena_, opts.vars);
+		node *ast = p.parse_all();
+		if (!ast) e = p.error();
+		return ast;
 	}
 
-	if (auto p = dynamic_cast<call_node *>(n.get())) {
-		for (auto &a : p->args) a = fold_constants(std::move(a));
+	// ast with the bound variables literals, constants folded and what the ranges decide
+	// folded too
+	static node *lower(compile_context &ctx, node *ast, const compile_options &opts) {
+		if (opts.bound) ast = ctx.bind_.run(ast, ctx.arena_);
+		ast = fold_constants(ast, ctx.arena_);
+		if (opts.ranges) ast = fold_constants(ctx.ranges_.run(ast, ctx.arena_, opts.fast_math), ctx.arena_);
+		return ast;
+	}
+};
+} // namespace detail
 
-		if (p->argc == 1) {
-			double a0 = 0.0;
-			if (is_num(*p->args[0], &a0)) {
-				return std::make_unique<num_node>(eval_func(p->fid, a0), p->pos);
-			}
-		} else if (p->argc == 2) {
-			double a0 = 0.0, a1 = 0.0;
-			if (is_num(*p->args[0], &a0) && is_num(*p->args[1], &a1)) {
-				return std::make_unique<num_node>(eval_func(p->fid, a0, a1), p->pos);
+// =============================
+// compile()
+// =============================
+inline std::pair<compiled_expr, std::optional<compile_error>>
+compile(std::string_view input, compile_context &ctx, const compile_options &opts) {
+	ctx.arena_.reset();
+	ctx.cse_.reset();
+	ctx.bc_.reset();
+	ctx.rc_.reset();
+
+	try {
+		detail::parse_error e = detail::front_end::begin(ctx, opts);
+		if (e) return {compiled_expr{}, e.to_compile_error()};
+		detail::node *ast = detail::front_end::parse(ctx, input, opts, e);
+		if (!ast) return {compiled_expr{}, e.to_compile_error()};
+
+		auto prog = std::make_shared<compiled_expr::program>();
+		prog->expr = std::string(input);
+		if (opts.vars) {
+			prog->record_size = opts.vars->record_size();
+			prog->record_stride = opts.vars->stride();
+			prog->vars = opts.vars->vars();
+			prog->has_schema = true;
+		}
+
+		// safe optimizations:
+		// - fold pure constant subexpressions
+		// - short-circuit simplifications for &&, ||, ?: when condition is constant
+		// - the same where compile_options::ranges decide a comparison or condition
+		// - compute repeated subexpressions once (never hoisted out of a short-circuited arm)
+		// compile_options::bound variables are literals by then
+		ast = detail::front_end::lower(ctx, ast, opts);
+		if (opts.fast_math) ast = detail::fold_constants(ctx.fast_.run(ast, ctx.arena_), ctx.arena_);
+		ast = ctx.cse_.run(ast, ctx.arena_);
+
+		detail::bytecode_compiler &bc = ctx.bc_;
+		bc.hints = ctx.hints_;
+		bc.layout = opts.jit;
+#if defined(BBB_EXPRDSL_JIT)
+		// a profiled program is interpreted, and every ?: && || a branch it can count
+		const bool native = opts.jit && !opts.profile && !opts.tier_up;
+		bc.select.budget = native ? detail::select_model::native : detail::select_model::stack;
+#endif
+		bc.compile(*ast);
+		bc.emit(compiled_expr::op::end);
+		bc.fuse();
+		compiled_expr::link(*prog, bc, opts);
+
+		if (opts.backend == vm_backend::reg) {
+			detail::register_compiler &rc = ctx.rc_;
+			rc.compile_root(*ast);
+			if (rc.ok) { // otherwise keep the stack backend
+				prog->reg_code = rc.code;
+				prog->reg_consts = rc.consts;
+				prog->n_regs = rc.n_regs;
+				prog->backend = vm_backend::reg;
+				prog->detour = true;
 			}
 		}
-		return n;
+		compiled_expr out;
+		out.prog_ = std::move(prog);
+		return {std::move(out), std::nullopt};
+	} catch (...) { // nothing above throws but std::bad_alloc
+		return {compiled_expr{}, compile_error{0, "Unknown error", compile_errc::internal}};
 	}
+}
 
-	if (auto p = dynamic_cast<ternary_node *>(n.get())) {
-		p->c = fold_constants(std::move(p->c));
+inline std::pair<compiled_expr, std::optional<compile_error>>
+compile(std::string_view input, compile_context &ctx) {
+	return compile(input, ctx, compile_options{});
+}
+
+inline std::pair<compiled_expr, std::optional<compile_error>>
+compile(std::string_view input, const compile_options &opts) {
+	compile_context ctx;
+	return compile(input, ctx, opts);
+}
+
+inline std::pair<compiled_expr, std::optional<compile_error>>
+compile(std::string_view input) {
+	return compile(input, compile_options{});
+}
 
-		double cv = 0.0;
-		if (is_num(*p->c, &cv)) {
-			if (truth(cv)) return fold_constants(std::move(p->t));
-			return fold_constants(std::move(p->f));
+inline bool compiled_expr::tier_up(const program &p) {
+	tier_state &t = *p.tier;
+	if (t.started.exchange(true, std::memory_order_acq_rel)) return t.next.load(std::memory_order_acquire) != nullptr;
+	if (p.multi) return false;
+	try {
+		detail::branch_hints hints;
+		const detail::profile_counters &k = *p.counters;
+		for (const detail::profile_counters::site &st : k.sites) {
+			const std::uint64_t n = k.hits[st.pc].load(std::memory_order_relaxed);
+			const std::uint64_t taken = std::min(n, k.taken[st.pc].load(std::memory_order_relaxed));
+			detail::branch_hints::outcome &o = hints.by_node[st.node];
+			o.executed += n;
+			o.held += p.code[st.pc].opcode == op::jnz ? taken : n - taken;
 		}
 
-		p->t = fold_constants(std::move(p->t));
-		p->f = fold_constants(std::move(p->f));
-		return n;
+		auto [e, err] = recompile(p, &hints, nullptr, [](compile_options &opts) {
+			opts.profile = false;
+			opts.tier_up = 0;
+		});
+		if (err) return false;
+		t.keep = std::move(e.prog_);
+		t.next.store(t.keep.get(), std::memory_order_release);
+		return true;
+	} catch (...) { // std::bad_alloc: stay on the profiled program
+		return false;
 	}
+}
 
-	if (auto p = dynamic_cast<binary_node *>(n.get())) {
-		p->l = fold_constants(std::move(p->l));
+template <class Adjust>
+inline std::pair<compiled_expr, std::optional<compile_error>>
+compiled_expr::recompile(const program &p, const detail::branch_hints *hints, const var_bindings *also_bound, Adjust &&adjust) {
+	var_schema vars; // compile() only reads the schema, rebuilt from what the program kept
+	for (const var_schema::var &v : p.vars) vars.add(v.name, v.slot);
+	vars.set_stride(p.record_stride);
+	var_bindings bound = p.bound;
+	if (also_bound) {
+		for (const var_bindings::binding &b : also_bound->bindings()) bound.add(b.name, b.value);
+	}
+	compile_options opts = p.opts;
+	opts.vars = p.has_schema ? &vars : nullptr;
+	opts.ranges = p.ranges.size() ? &p.ranges : nullptr;
+	opts.bound = bound.size() ? &bound : nullptr;
+	adjust(opts);
+
+	compile_context ctx;
+	ctx.hints_ = hints;
+	return compile(p.expr, ctx, opts);
+}
 
-		if (p->op == bin_op::and_and) {
-			double lv = 0.0;
-			if (is_num(*p->l, &lv)) {
-				if (!truth(lv)) {
-					return std::make_unique<num_node>(0.0, p->pos);
-				} else {
-					p->r = fold_constants(std::move(p->r));
-					return std::make_unique<unary_node>(un_op::to_bool, p->pos, std::move(p->r));
-				}
-			}
-			p->r = fold_constants(std::move(p->r));
-			return n;
+inline std::pair<compiled_expr, std::optional<compile_error>> compiled_expr::specialize(const var_bindings &b) const {
+	const program &p = *prog_;
+	if (p.multi) return {compiled_expr{}, compile_error{0, "Unknown error", compile_errc::internal}};
+	try {
+		// size#name=bits, ... in name order: the same values bound in any order hit
+		std::vector<const var_bindings::binding *> order;
+		for (const var_bindings::binding &v : b.bindings()) order.push_back(&v);
+		std::sort(order.begin(), order.end(), [](const auto *l, const auto *r) { return l->name < r->name; });
+		std::string key;
+		for (const var_bindings::binding *v : order) {
+			std::uint64_t bits;
+			std::memcpy(&bits, &v->value, sizeof bits);
+			key.append(std::to_string(v->name.size())).append("#").append(v->name).append("=");
+			key.append(std::to_string(bits)).append(",");
 		}
 
-		if (p->op == bin_op::or_or) {
-			double lv = 0.0;
-			if (is_num(*p->l, &lv)) {
-				if (truth(lv)) {
-					return std::make_unique<num_node>(1.0, p->pos);
-				} else {
-					p->r = fold_constants(std::move(p->r));
-					return std::make_unique<unary_node>(un_op::to_bool, p->pos, std::move(p->r));
-				}
+		std::call_once(p.specs_once, [&p] { p.specs = std::make_unique<specializations>(); });
+		specializations &s = *p.specs;
+		{
+			std::shared_lock<std::shared_mutex> lk(s.mutex);
+			if (const std::shared_ptr<const program> *hit = s.map.find(key)) {
+				compiled_expr out;
+				out.prog_ = *hit;
+				return {std::move(out), std::nullopt};
 			}
-			p->r = fold_constants(std::move(p->r));
-			return n;
 		}
 
-		p->r = fold_constants(std::move(p->r));
-
-		double a = 0.0, b = 0.0;
-		if (is_num(*p->l, &a) && is_num(*p->r, &b)) {
-			double res = std::numeric_limits<double>::quiet_NaN();
-			switch (p->op) {
-				case bin_op::add: res = a + b; break;
-				case bin_op::sub: res = a - b; break;
-				case bin_op::mul: res = a * b; break;
-				case bin_op::div_: res = a / b; break;
-				case bin_op::mod: res = std::fmod(a, b); break;
-				case bin_op::pow: res = std::pow(a, b); break;
-
-				case bin_op::lt: res = b2d(a <  b); break;
-				case bin_op::le: res = b2d(a <= b); break;
-				case bin_op::gt: res = b2d(b <  a); break;
-				case bin_op::ge: res = b2d(b <= a); break;
-				case bin_op::eq: res = b2d(a == b); break;
-				case bin_op::ne: res = b2d(a != b); break;
-
-				case bin_op::and_and:
-				case bin_op::or_or:
-					break;
-			}
-			return std::make_unique<num_node>(res, p->pos);
-		}
+		auto [e, err] = recompile(p, nullptr, &b, [](compile_options &) {}); // outside the lock
+		if (err) return {compiled_expr{}, std::move(err)};
 
-		return n;
+		std::unique_lock<std::shared_mutex> lk(s.mutex);
+		e.prog_ = *s.map.insert(std::move(key), e.prog_).value; // another thread may have specialized it first
+		return {std::move(e), std::nullopt};
+	} catch (...) { // nothing above throws but std::bad_alloc
+		return {compiled_expr{}, compile_error{0, "Unknown error", compile_errc::internal}};
 	}
-
-	return n;
 }
 
-// ---------- bytecode compiler ----------
-class bytecode_compiler {
-public:
-	using op = compiled_expr::op;
-	using instr = compiled_expr::instr;
+inline void compiled_expr::clear_specializations() const {
+	const program &p = *prog_;
+	std::call_once(p.specs_once, [&p] { p.specs = std::make_unique<specializations>(); });
+	std::unique_lock<std::shared_mutex> lk(p.specs->mutex);
+	p.specs->map.clear();
+}
 
-	std::vector<instr> code;
+// =============================
+// compile_many()
+// =============================
+// compiles inputs into one program that evaluates all of them per record, in order: output
+// i is inputs[i]. subexpressions shared between inputs are computed once per record (the
+// same rules as within one expression: never hoisted out of a short-circuited arm), and
+// each record runs one dispatch loop. vm_backend::reg does not apply; jit does.
+// an error carries the index of the input it is in; an empty list compiles to no outputs.
+inline std::pair<compiled_multi_expr, std::optional<compile_error>>
+compile_many(const std::vector<std::string_view> &inputs, compile_context &ctx, const compile_options &opts) {
+	ctx.arena_.reset();
+	ctx.cse_.reset();
+	ctx.bc_.reset();
 
-	void emit(op opcode, int arg = 0, double imm = 0.0) {
-		instr in;
-		in.opcode = opcode;
-		in.arg = arg;
-		in.imm = imm;
-		code.push_back(in);
+	try {
+		detail::parse_error e = detail::front_end::begin(ctx, opts);
+		if (e) return {compiled_multi_expr{}, e.to_compile_error()};
+
+		std::vector<detail::node *> &roots = ctx.roots_;
+		roots.clear();
+		for (std::size_t i = 0; i < inputs.size(); ++i) {
+			detail::node *ast = detail::front_end::parse(ctx, inputs[i], opts, e);
+			if (!ast) {
+				compile_error err = e.to_compile_error();
+				err.index = i;
+				return {compiled_multi_expr{}, std::move(err)};
+			}
+			ast = detail::front_end::lower(ctx, ast, opts);
+			if (opts.fast_math) ast = detail::fold_constants(ctx.fast_.run(ast, ctx.arena_), ctx.arena_);
+			roots.push_back(ast);
+		}
+		return {compiled_multi_expr::build(ctx, std::vector<std::string>(inputs.begin(), inputs.end()), opts), std::nullopt};
+	} catch (...) { // nothing above throws but std::bad_alloc
+		return {compiled_multi_expr{}, compile_error{0, "Unknown error", compile_errc::internal}};
 	}
+}
 
-	std::size_t emit_placeholder(op opcode) {
-		emit(opcode, 0, 0.0);
-		return code.size() - 1;
+inline compiled_multi_expr compiled_multi_expr::build(compile_context &ctx, std::vector<std::string> outputs,
+                                                      const compile_options &opts) {
+	std::vector<detail::node *> &roots = ctx.roots_;
+	ctx.cse_.run(roots.data(), roots.size(), ctx.arena_);
+
+	auto prog = std::make_shared<compiled_expr::program>();
+	prog->multi = true;
+	prog->outputs = std::move(outputs);
+	if (opts.vars) {
+		prog->record_size = opts.vars->record_size();
+		prog->record_stride = opts.vars->stride();
+		prog->vars = opts.vars->vars();
+		prog->has_schema = true;
 	}
 
-	void patch_target(std::size_t at, std::size_t target) {
-		code[at].arg = static_cast<int>(target);
+	detail::bytecode_compiler &bc = ctx.bc_;
+	bc.hints = nullptr;
+	bc.layout = false;
+#if defined(BBB_EXPRDSL_JIT)
+	const bool native = opts.jit && !opts.profile && !opts.tier_up;
+	bc.select.budget = native ? detail::select_model::native : detail::select_model::stack;
+#endif
+	for (std::size_t i = 0; i < roots.size(); ++i) {
+		bc.compile(*roots[i]);
+		bc.emit(compiled_expr::op::store_out, static_cast<int>(i));
 	}
+	bc.emit(compiled_expr::op::end);
+	bc.fuse();
+	compiled_expr::link(*prog, bc, opts);
 
-	void compile(const node &n) {
-		if (auto p = dynamic_cast<const num_node *>(&n)) { emit(op::push_const, 0, p->n); return; }
-		if (auto p = dynamic_cast<const var_node *>(&n)) { emit(op::push_var, p->index); return; }
-
-		if (auto p = dynamic_cast<const unary_node *>(&n)) {
-			compile(*p->a);
-			switch (p->op) {
-				case un_op::plus: break;
-				case un_op::minus: emit(op::neg); break;
-				case un_op::logical_not: emit(op::logical_not); break;
-				case un_op::to_bool: emit(op::to_bool); break;
-			}
-			return;
-		}
+	compiled_multi_expr out;
+	out.e_.prog_ = std::move(prog);
+	return out;
+}
 
-		if (auto p = dynamic_cast<const call_node *>(&n)) {
-			for (auto &a : p->args) compile(*a);
-			emit(op::call, p->fid);
-			return;
-		}
+inline std::pair<compiled_multi_expr, std::optional<compile_error>>
+compile_many(const std::vector<std::string_view> &inputs, const compile_options &opts) {
+	compile_context ctx;
+	return compile_many(inputs, ctx, opts);
+}
 
-		if (auto p = dynamic_cast<const ternary_node *>(&n)) {
-			compile(*p->c);
-			emit(op::to_bool);
-			std::size_t jz_else = emit_placeholder(op::jz);
-			compile(*p->t);
-			std::size_t jmp_end = emit_placeholder(op::jmp);
-			std::size_t else_pc = code.size();
-			patch_target(jz_else, else_pc);
-			compile(*p->f);
-			std::size_t end_pc = code.size();
-			patch_target(jmp_end, end_pc);
-			return;
-		}
+inline std::pair<compiled_multi_expr, std::optional<compile_error>>
+compile_many(const std::vector<std::string_view> &inputs) {
+	return compile_many(inputs, compile_options{});
+}
 
-		if (auto p = dynamic_cast<const binary_node *>(&n)) { compile_binary(*p); return; }
+inline std::pair<compiled_multi_expr, std::optional<compile_error>>
+compile_many(const std::vector<std::string> &inputs, const compile_options &opts = compile_options{}) {
+	return compile_many(std::vector<std::string_view>(inputs.begin(), inputs.end()), opts);
+}
 
-		emit(op::push_const, 0, std::numeric_limits<double>::quiet_NaN());
-	}
+// compile_many({"x + y", "x * y"})
+inline std::pair<compiled_multi_expr, std::optional<compile_error>>
+compile_many(std::initializer_list<std::string_view> inputs, const compile_options &opts = compile_options{}) {
+	return compile_many(std::vector<std::string_view>(inputs), opts);
+}
 
-private:
-	void compile_binary(const binary_node &b) {
-		if (b.op == bin_op::and_and) {
-			compile(*b.l);
-			emit(op::to_bool);
-			std::size_t jz_false = emit_placeholder(op::jz);
-			compile(*b.r);
-			emit(op::to_bool);
-			std::size_t jmp_end = emit_placeholder(op::jmp);
-			std::size_t false_pc = code.size();
-			patch_target(jz_false, false_pc);
-			emit(op::push_const, 0, 0.0);
-			std::size_t end_pc = code.size();
-			patch_target(jmp_end, end_pc);
-			return;
-		}
+// =============================
+// compile_gradient()
+// =============================
+// input and its partial derivatives in every variable, compiled into one program as by
+// compile_many: output 0 is the value, output 1 + i the derivative in variable i, x y z w or
+// the var_schema's variables in order (expr(1 + i) is "d/d" and its name). each record runs one
+// dispatch loop for all of them, and cse shares the value's subexpressions with the
+// derivatives, so a gradient costs a fraction of the extra evaluations finite differences
+// need. derivatives are exact up to rounding wherever input is differentiable; steps (!, the
+// comparisons, && ||, floor ceil round) have derivative 0 and kinks take one side (see
+// detail::derivative_pass). bound variables and range hints apply to the derivatives as to
+// the value: a variable fixed by compile_options::bound is differentiated at its value.
+inline std::pair<compiled_multi_expr, std::optional<compile_error>>
+compile_gradient(std::string_view input, compile_context &ctx, const compile_options &opts) {
+	ctx.arena_.reset();
+	ctx.cse_.reset();
+	ctx.bc_.reset();
 
-		if (b.op == bin_op::or_or) {
-			compile(*b.l);
-			emit(op::to_bool);
-			std::size_t jz_eval_b = emit_placeholder(op::jz);
-			emit(op::push_const, 0, 1.0);
-			std::size_t jmp_end = emit_placeholder(op::jmp);
-			std::size_t eval_b_pc = code.size();
-			patch_target(jz_eval_b, eval_b_pc);
-			compile(*b.r);
-			emit(op::to_bool);
-			std::size_t end_pc = code.size();
-			patch_target(jmp_end, end_pc);
-			return;
+	try {
+		detail::parse_error e = detail::front_end::begin(ctx, opts);
+		if (e) return {compiled_multi_expr{}, e.to_compile_error()};
+		detail::node *ast = detail::front_end::parse(ctx, input, opts, e);
+		if (!ast) return {compiled_multi_expr{}, e.to_compile_error()};
+
+		// differentiated as parsed: binding or a point range first would make a variable a
+		// constant, and its derivative 0. the derivatives copy what they use of ast, so each
+		// root is then bound, folded and range-decided on its own
+		std::vector<std::string> outputs{std::string(input)};
+		std::vector<detail::node *> &roots = ctx.roots_;
+		roots.assign(1, ast);
+		static const char *const xyzw[4] = {"x", "y", "z", "w"};
+		const std::size_t n_vars = opts.vars ? opts.vars->vars().size() : 4;
+		for (std::size_t i = 0; i < n_vars; ++i) {
+			const std::size_t slot = opts.vars ? opts.vars->vars()[i].slot : i;
+			outputs.push_back("d/d" + (opts.vars ? opts.vars->vars()[i].name : std::string(xyzw[i])));
+			roots.push_back(ctx.diff_.run(ast, slot, ctx.arena_));
 		}
-
-		compile(*b.l);
-		compile(*b.r);
-
-		switch (b.op) {
-			case bin_op::add: emit(op::add); break;
-			case bin_op::sub: emit(op::sub); break;
-			case bin_op::mul: emit(op::mul); break;
-			case bin_op::div_: emit(op::div_); break;
-			case bin_op::mod: emit(op::mod); break;
-			case bin_op::pow: emit(op::pow); break;
-
-			case bin_op::lt: emit(op::lt); break;
-			case bin_op::le: emit(op::le); break;
-			case bin_op::gt: emit(op::gt); break;
-			case bin_op::ge: emit(op::ge); break;
-			case bin_op::eq: emit(op::eq); break;
-			case bin_op::ne: emit(op::ne); break;
-
-			case bin_op::and_and:
-			case bin_op::or_or:
-				break;
+		for (detail::node *&r : roots) {
+			r = detail::front_end::lower(ctx, r, opts);
+			if (opts.fast_math) r = detail::fold_constants(ctx.fast_.run(r, ctx.arena_), ctx.arena_);
 		}
+		return {compiled_multi_expr::build(ctx, std::move(outputs), opts), std::nullopt};
+	} catch (...) { // nothing above throws but std::bad_alloc
+		return {compiled_multi_expr{}, compile_error{0, "Unknown error", compile_errc::internal}};
 	}
-};
+}
 
-} // namespace detail
+inline std::pair<compiled_multi_expr, std::optional<compile_error>>
+compile_gradient(std::string_view input, const compile_options &opts = compile_options{}) {
+	compile_context ctx;
+	return compile_gradient(input, ctx, opts);
+}
 
 // =============================
-// compile()
+// validate()
 // =============================
-inline std::pair<compiled_expr, std::optional<compile_error>>
-compile(std::string_view input) {
-	compiled_expr out;
-	out.expr = std::string(input);
-
-	try {
-		detail::parser p(input);
-		auto ast = p.parse_all();
+// checks input without generating code: returns the error compile() would report, if any.
+// vars is the schema compile_options::vars would name (nullptr: x y z w).
+inline std::optional<compile_error> validate(std::string_view input, compile_context &ctx, const var_schema *vars) {
+	if (vars) {
+		const detail::parse_error e = detail::check_schema(*vars);
+		if (e) return e.to_compile_error();
+	}
+	ctx.arena_.reset();
+	detail::parser p(input, ctx.arena_, vars);
+	if (p.parse_all()) return std::nullopt;
+	return p.error().to_compile_error();
+}
 
-		// safe optimizations:
-		// - fold pure constant subexpressions
-		// - short-circuit simplifications for &&, ||, ?: when condition is constant
-		ast = detail::fold_constants(std::move(ast));
+inline std::optional<compile_error> validate(std::string_view input, compile_context &ctx) {
+	return validate(input, ctx, nullptr);
+}
 
-		detail::bytecode_compiler bc;
-		bc.compile(*ast);
-		bc.emit(compiled_expr::op::end);
+inline std::optional<compile_error> validate(std::string_view input, const var_schema *vars) {
+	compile_context ctx;
+	return validate(input, ctx, vars);
+}
 
-		out.code_ = std::move(bc.code);
-		return {std::move(out), std::nullopt};
-	} catch (const std::runtime_error &e) {
-		return {compiled_expr{}, detail::to_compile_error(e)};
-	} catch (...) {
-		return {compiled_expr{}, compile_error{0, "Unknown error"}};
-	}
+inline std::optional<compile_error> validate(std::string_view input) {
+	compile_context ctx;
+	return validate(input, ctx, nullptr);
 }
 
 } // namespace bbb
@@ -0,0 +1,172 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+// native code generation for compile_options::jit: x86-64 System V targets only, everything
+// else (and BBB_EXPRDSL_NO_JIT) keeps the interpreter
+#if !defined(BBB_EXPRDSL_NO_JIT) && (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__) && \
+	(defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#	define BBB_EXPRDSL_JIT 1
+#	include <sys/mman.h>
+#endif
+
+namespace bbb {
+namespace detail {
+
+class exec_memory;
+
+#if defined(BBB_EXPRDSL_JIT)
+
+// finished machine code in its own mapping; written while read+write, then flipped to read+exec
+class exec_memory {
+public:
+	static std::shared_ptr<const exec_memory> map(const std::vector<std::uint8_t> &bytes) {
+		if (bytes.empty()) return nullptr;
+		void *p = ::mmap(nullptr, bytes.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+		if (p == MAP_FAILED) return nullptr;
+		std::memcpy(p, bytes.data(), bytes.size());
+		if (::mprotect(p, bytes.size(), PROT_READ | PROT_EXEC) != 0) { // W^X policy refused us
+			::munmap(p, bytes.size());
+			return nullptr;
+		}
+		return std::shared_ptr<const exec_memory>(new exec_memory(p, bytes.size()));
+	}
+
+	exec_memory(const exec_memory &) = delete;
+	exec_memory &operator=(const exec_memory &) = delete;
+	~exec_memory() { ::munmap(p_, size_); }
+
+	const void *data() const { return p_; }
+	std::size_t size() const { return size_; }
+
+private:
+	exec_memory(void *p, std::size_t size) : p_(p), size_(size) {}
+
+	void *p_;
+	std::size_t size_;
+};
+
+// just enough of an x86-64 encoder for scalar double code: xmm0..xmm7, rax as a
+// scratch GPR, rbx as the record pointer and memory operands of the form [rsp + disp],
+// [rbx + disp] or [rax + disp]
+class x64_assembler {
+public:
+	// condition codes as encoded in jcc (0f 80+cc)
+	enum cond : std::uint8_t { b = 0x2, ae = 0x3, e = 0x4, ne = 0x5, be = 0x6, a = 0x7, p = 0xa, np = 0xb };
+
+	std::vector<std::uint8_t> buf;
+
+	std::size_t here() const { return buf.size(); }
+
+	// F2 0F op: scalar double op with a register source
+	void sd(std::uint8_t opc, int dst, int src) { put({0xf2, 0x0f, opc}); modrm_rr(dst, src); }
+	// F2 0F op: scalar double op with a [rsp + disp] operand
+	void sd_mem(std::uint8_t opc, int x, std::int32_t disp) { put({0xf2, 0x0f, opc}); modrm_rsp(x, disp); }
+	// F2 0F op: scalar double op with a [rbx + disp] operand
+	void sd_rec(std::uint8_t opc, int x, std::int32_t disp) { put({0xf2, 0x0f, opc}); modrm_rbx(x, disp); }
+	// 66 0F op: packed double op with a register source
+	void pd(std::uint8_t opc, int dst, int src) { put({0x66, 0x0f, opc}); modrm_rr(dst, src); }
+
+	void movsd_load(int x, std::int32_t disp) { sd_mem(0x10, x, disp); }
+	void movsd_store(std::int32_t disp, int x) { sd_mem(0x11, x, disp); }
+	void movsd_load_rec(int x, std::int32_t disp) { sd_rec(0x10, x, disp); }
+	void movapd(int dst, int src) { pd(0x28, dst, src); }
+	void xorpd(int dst, int src) { pd(0x57, dst, src); }
+	void andpd(int dst, int src) { pd(0x54, dst, src); }
+	void andnpd(int dst, int src) { pd(0x55, dst, src); } // dst = ~dst & src
+	void orpd(int dst, int src) { pd(0x56, dst, src); }
+	void ucomisd(int x, int y) { pd(0x2e, x, y); }
+	void cmpsd(int dst, int src, std::uint8_t pred) { sd(0xc2, dst, src); buf.push_back(pred); }
+	// SSE4.1 roundsd; mode 9 = floor, 10 = ceil (exceptions suppressed)
+	void roundsd(int dst, int src, std::uint8_t mode) { put({0x66, 0x0f, 0x3a, 0x0b}); modrm_rr(dst, src); buf.push_back(mode); }
+	// FMA3 vfmadd231sd dst, a, b: dst = a * b + dst with one rounding (VEX.LIG.66.0F38.W1 B9)
+	void vfmadd231sd(int dst, int a, int b) {
+		put({0xc4, 0xe2, static_cast<std::uint8_t>(0x81 | ((~a & 0xf) << 3)), 0xb9});
+		modrm_rr(dst, b);
+	}
+
+	// x = bit pattern v (through rax)
+	void load_bits(int x, std::uint64_t v) {
+		if (v == 0) {
+			xorpd(x, x);
+			return;
+		}
+		mov_rax(v);
+		put({0x66, 0x48, 0x0f, 0x6e}); // movq x, rax
+		modrm_rr(x, 0);
+	}
+	void load_imm(int x, double v) {
+		std::uint64_t bits;
+		std::memcpy(&bits, &v, sizeof bits);
+		load_bits(x, bits);
+	}
+
+	void call(std::uintptr_t fn) {
+		mov_rax(fn);
+		put({0xff, 0xd0}); // call rax
+	}
+	void sub_rsp(std::int32_t n) { put({0x48, 0x81, 0xec}); imm32(n); }
+	void add_rsp(std::int32_t n) { put({0x48, 0x81, 0xc4}); imm32(n); }
+	void push_rbx() { buf.push_back(0x53); }
+	void pop_rbx() { buf.push_back(0x5b); }
+	void mov_rbx_rdi() { put({0x48, 0x89, 0xfb}); }
+	void lea_rbx_rsp(std::int32_t disp) { put({0x48, 0x8d, 0x9c, 0x24}); imm32(disp); } // rbx = rsp + disp
+	void mov_store_rsi(std::int32_t disp) { put({0x48, 0x89, 0xb4, 0x24}); imm32(disp); } // [rsp + disp] = rsi
+	void mov_load_rax(std::int32_t disp) { put({0x48, 0x8b, 0x84, 0x24}); imm32(disp); }  // rax = [rsp + disp]
+	// movsd [rax + disp], x
+	void movsd_store_rax(std::int32_t disp, int x) {
+		put({0xf2, 0x0f, 0x11, static_cast<std::uint8_t>(0x80 | (x << 3))});
+		imm32(disp);
+	}
+	void ret() { buf.push_back(0xc3); }
+
+	// jumps with a rel32 displacement to be patched; return the displacement's offset
+	std::size_t jmp() { buf.push_back(0xe9); return rel32(); }
+	std::size_t jcc(cond c) { put({0x0f, static_cast<std::uint8_t>(0x80 | c)}); return rel32(); }
+	void patch(std::size_t at, std::size_t target) {
+		const std::int32_t rel = static_cast<std::int32_t>(static_cast<std::int64_t>(target) - static_cast<std::int64_t>(at + 4));
+		std::memcpy(&buf[at], &rel, sizeof rel);
+	}
+
+private:
+	void put(std::initializer_list<std::uint8_t> bytes) { buf.insert(buf.end(), bytes); }
+	void modrm_rr(int reg, int rm) { buf.push_back(static_cast<std::uint8_t>(0xc0 | (reg << 3) | rm)); }
+	void modrm_rsp(int reg, std::int32_t disp) {
+		if (-128 <= disp && disp <= 127) {
+			put({static_cast<std::uint8_t>(0x44 | (reg << 3)), 0x24, static_cast<std::uint8_t>(disp)});
+		} else {
+			put({static_cast<std::uint8_t>(0x84 | (reg << 3)), 0x24});
+			imm32(disp);
+		}
+	}
+	void modrm_rbx(int reg, std::int32_t disp) {
+		if (-128 <= disp && disp <= 127) {
+			put({static_cast<std::uint8_t>(0x43 | (reg << 3)), static_cast<std::uint8_t>(disp)});
+		} else {
+			buf.push_back(static_cast<std::uint8_t>(0x83 | (reg << 3)));
+			imm32(disp);
+		}
+	}
+	void mov_rax(std::uint64_t v) {
+		put({0x48, 0xb8});
+		for (int i = 0; i < 8; ++i) buf.push_back(static_cast<std::uint8_t>(v >> (8 * i)));
+	}
+	void imm32(std::int32_t v) {
+		const std::uint32_t u = static_cast<std::uint32_t>(v);
+		for (int i = 0; i < 4; ++i) buf.push_back(static_cast<std::uint8_t>(u >> (8 * i)));
+	}
+	std::size_t rel32() {
+		const std::size_t at = buf.size();
+		imm32(0);
+		return at;
+	}
+};
+
+#endif // BBB_EXPRDSL_JIT
+
+} // namespace detail
+} // namespace bbb
@@ -0,0 +1,731 @@
+#pragma once
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if !defined(BBB_EXPRDSL_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#	define BBB_EXPRDSL_X86_SIMD 1
+#	include <immintrin.h>
+#	define BBB_EXPRDSL_TARGET(isa) __attribute__((target(isa)))
+#elif !defined(BBB_EXPRDSL_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+#	define BBB_EXPRDSL_NEON_SIMD 1
+#	include <arm_neon.h>
+#endif
+
+namespace bbb {
+
+// instruction set used by compiled_expr::eval_batch kernels
+enum class simd_isa : std::uint8_t { generic, avx2, avx512, neon };
+
+namespace detail {
+
+// lanes per stack slot in the batched evaluator (compiled_expr::batch_block)
+constexpr std::size_t lane_block = 64;
+
+// kernels over one lane slot of Ts; binary ops work in place: a[i] = a[i] op b[i].
+// every kernel matches the scalar vm_eval result (of the same T) bit for bit.
+template <class T>
+struct basic_lane_kernels {
+	using bin_fn = void (*)(T *a, const T *b);
+	using un_fn = void (*)(T *a);
+
+	simd_isa isa;
+	bin_fn add, sub, mul, div_;
+	bin_fn lt, le, gt, ge, eq, ne;
+	bin_fn min, max;
+	un_fn to_bool, neg, logical_not;
+	un_fn sqrt, abs, floor, ceil, round;
+	// c[i] = (c[i] != 0) ? t[i] : f[i]
+	void (*blend)(T *c, const T *t, const T *f);
+	// a[i] = std::fma(a[i], b[i], c[i]): one rounding
+	void (*fma)(T *a, const T *b, const T *c);
+};
+using lane_kernels = basic_lane_kernels<double>;
+// single precision, for compiled_expr_f32: a vector holds twice the lanes
+using lane_kernels_f32 = basic_lane_kernels<float>;
+
+// element-wise loops over one lane slot
+template <class T, class F>
+inline void lanes1(T *a, F f) {
+	for (std::size_t i = 0; i < lane_block; ++i) a[i] = f(a[i]);
+}
+template <class T, class F>
+inline void lanes2(T *a, const T *b, F f) {
+	for (std::size_t i = 0; i < lane_block; ++i) a[i] = f(a[i], b[i]);
+}
+
+// ---------- generic (auto-vectorized loops) ----------
+namespace lanes_generic {
+
+// templates: the tables below take the double or the float instantiation
+template <class T> inline void add(T *a, const T *b)  { lanes2(a, b, [](T u, T v) { return u + v; }); }
+template <class T> inline void sub(T *a, const T *b)  { lanes2(a, b, [](T u, T v) { return u - v; }); }
+template <class T> inline void mul(T *a, const T *b)  { lanes2(a, b, [](T u, T v) { return u * v; }); }
+template <class T> inline void div_(T *a, const T *b) { lanes2(a, b, [](T u, T v) { return u / v; }); }
+
+template <class T> inline void lt(T *a, const T *b) { lanes2(a, b, [](T u, T v) { return u < v  ? T(1) : T(0); }); }
+template <class T> inline void le(T *a, const T *b) { lanes2(a, b, [](T u, T v) { return u <= v ? T(1) : T(0); }); }
+template <class T> inline void gt(T *a, const T *b) { lanes2(a, b, [](T u, T v) { return v < u  ? T(1) : T(0); }); }
+template <class T> inline void ge(T *a, const T *b) { lanes2(a, b, [](T u, T v) { return v <= u ? T(1) : T(0); }); }
+template <class T> inline void eq(T *a, const T *b) { lanes2(a, b, [](T u, T v) { return u == v ? T(1) : T(0); }); }
+template <class T> inline void ne(T *a, const T *b) { lanes2(a, b, [](T u, T v) { return u != v ? T(1) : T(0); }); }
+
+template <class T> inline void min(T *a, const T *b) { lanes2(a, b, [](T u, T v) { return u < v ? u : v; }); }
+template <class T> inline void max(T *a, const T *b) { lanes2(a, b, [](T u, T v) { return v < u ? u : v; }); }
+
+template <class T> inline void to_bool(T *a)     { lanes1(a, [](T u) { return u != T(0) ? T(1) : T(0); }); }
+template <class T> inline void neg(T *a)         { lanes1(a, [](T u) { return -u; }); }
+template <class T> inline void logical_not(T *a) { lanes1(a, [](T u) { return u == T(0) ? T(1) : T(0); }); }
+
+template <class T> inline void sqrt(T *a)  { lanes1(a, [](T u) { return std::sqrt(u); }); }
+template <class T> inline void abs(T *a)   { lanes1(a, [](T u) { return std::fabs(u); }); }
+template <class T> inline void floor(T *a) { lanes1(a, [](T u) { return std::floor(u); }); }
+template <class T> inline void ceil(T *a)  { lanes1(a, [](T u) { return std::ceil(u); }); }
+template <class T> inline void round(T *a) { lanes1(a, [](T u) { return std::round(u); }); }
+
+template <class T>
+inline void blend(T *c, const T *t, const T *f) {
+	for (std::size_t i = 0; i < lane_block; ++i) c[i] = (c[i] != T(0)) ? t[i] : f[i];
+}
+
+template <class T>
+inline void fma(T *a, const T *b, const T *c) {
+	for (std::size_t i = 0; i < lane_block; ++i) a[i] = std::fma(a[i], b[i], c[i]);
+}
+
+template <class T>
+inline const basic_lane_kernels<T> &table() {
+	static const basic_lane_kernels<T> k = {
+		simd_isa::generic,
+		add<T>, sub<T>, mul<T>, div_<T>,
+		lt<T>, le<T>, gt<T>, ge<T>, eq<T>, ne<T>,
+		min<T>, max<T>,
+		to_bool<T>, neg<T>, logical_not<T>,
+		sqrt<T>, abs<T>, floor<T>, ceil<T>, round<T>,
+		blend<T>,
+		fma<T>,
+	};
+	return k;
+}
+
+} // namespace lanes_generic
+
+#if defined(BBB_EXPRDSL_X86_SIMD)
+
+// ---------- AVX2 (4 lanes) ----------
+namespace lanes_avx2 {
+
+#define BBB_EXPRDSL_BIN(name, expr)                                                  \
+	BBB_EXPRDSL_TARGET("avx2") inline void name(double *a, const double *b) {          \
+		const __m256d one = _mm256_set1_pd(1.0); (void)one;                              \
+		for (std::size_t i = 0; i < lane_block; i += 4) {                                \
+			const __m256d u = _mm256_loadu_pd(a + i), v = _mm256_loadu_pd(b + i);          \
+			_mm256_storeu_pd(a + i, expr);                                                 \
+		}                                                                                \
+	}
+#define BBB_EXPRDSL_UN(name, expr)                                                   \
+	BBB_EXPRDSL_TARGET("avx2") inline void name(double *a) {                           \
+		const __m256d one = _mm256_set1_pd(1.0); (void)one;                              \
+		const __m256d zero = _mm256_setzero_pd(); (void)zero;                            \
+		for (std::size_t i = 0; i < lane_block; i += 4) {                                \
+			const __m256d u = _mm256_loadu_pd(a + i);                                      \
+			_mm256_storeu_pd(a + i, expr);                                                 \
+		}                                                                                \
+	}
+
+BBB_EXPRDSL_BIN(add,  _mm256_add_pd(u, v))
+BBB_EXPRDSL_BIN(sub,  _mm256_sub_pd(u, v))
+BBB_EXPRDSL_BIN(mul,  _mm256_mul_pd(u, v))
+BBB_EXPRDSL_BIN(div_, _mm256_div_pd(u, v))
+
+BBB_EXPRDSL_BIN(lt, _mm256_and_pd(_mm256_cmp_pd(u, v, _CMP_LT_OQ), one))
+BBB_EXPRDSL_BIN(le, _mm256_and_pd(_mm256_cmp_pd(u, v, _CMP_LE_OQ), one))
+BBB_EXPRDSL_BIN(gt, _mm256_and_pd(_mm256_cmp_pd(u, v, _CMP_GT_OQ), one))
+BBB_EXPRDSL_BIN(ge, _mm256_and_pd(_mm256_cmp_pd(u, v, _CMP_GE_OQ), one))
+BBB_EXPRDSL_BIN(eq, _mm256_and_pd(_mm256_cmp_pd(u, v, _CMP_EQ_OQ), one))
+BBB_EXPRDSL_BIN(ne, _mm256_and_pd(_mm256_cmp_pd(u, v, _CMP_NEQ_UQ), one))
+
+// minpd/maxpd return the second operand on NaN or equality: exactly u < v ? u : v and v < u ? u : v
+BBB_EXPRDSL_BIN(min, _mm256_min_pd(u, v))
+BBB_EXPRDSL_BIN(max, _mm256_max_pd(u, v))
+
+BBB_EXPRDSL_UN(to_bool,     _mm256_and_pd(_mm256_cmp_pd(u, zero, _CMP_NEQ_UQ), one))
+BBB_EXPRDSL_UN(neg,         _mm256_xor_pd(u, _mm256_set1_pd(-0.0)))
+BBB_EXPRDSL_UN(logical_not, _mm256_and_pd(_mm256_cmp_pd(u, zero, _CMP_EQ_OQ), one))
+
+BBB_EXPRDSL_UN(sqrt,  _mm256_sqrt_pd(u))
+BBB_EXPRDSL_UN(abs,   _mm256_andnot_pd(_mm256_set1_pd(-0.0), u))
+BBB_EXPRDSL_UN(floor, _mm256_round_pd(u, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC))
+BBB_EXPRDSL_UN(ceil,  _mm256_round_pd(u, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC))
+
+#undef BBB_EXPRDSL_BIN
+#undef BBB_EXPRDSL_UN
+
+// std::round: half away from zero. u - trunc(u) is exact, and the blend keeps the sign of -0
+BBB_EXPRDSL_TARGET("avx2") inline void round(double *a) {
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	const __m256d half = _mm256_set1_pd(0.5);
+	const __m256d one = _mm256_set1_pd(1.0);
+	for (std::size_t i = 0; i < lane_block; i += 4) {
+		const __m256d u = _mm256_loadu_pd(a + i);
+		const __m256d t = _mm256_round_pd(u, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+		const __m256d frac = _mm256_andnot_pd(sign, _mm256_sub_pd(u, t));
+		const __m256d step = _mm256_or_pd(one, _mm256_and_pd(sign, u));
+		const __m256d away = _mm256_cmp_pd(frac, half, _CMP_GE_OQ);
+		_mm256_storeu_pd(a + i, _mm256_blendv_pd(t, _mm256_add_pd(t, step), away));
+	}
+}
+
+BBB_EXPRDSL_TARGET("avx2") inline void blend(double *c, const double *t, const double *f) {
+	const __m256d zero = _mm256_setzero_pd();
+	for (std::size_t i = 0; i < lane_block; i += 4) {
+		const __m256d m = _mm256_cmp_pd(_mm256_loadu_pd(c + i), zero, _CMP_NEQ_UQ);
+		_mm256_storeu_pd(c + i, _mm256_blendv_pd(_mm256_loadu_pd(f + i), _mm256_loadu_pd(t + i), m));
+	}
+}
+
+// the avx2 tier is only selected together with fma (see detect_simd_isa)
+BBB_EXPRDSL_TARGET("avx2,fma") inline void fma(double *a, const double *b, const double *c) {
+	for (std::size_t i = 0; i < lane_block; i += 4) {
+		_mm256_storeu_pd(a + i, _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), _mm256_loadu_pd(c + i)));
+	}
+}
+
+inline const lane_kernels &table() {
+	static const lane_kernels k = {
+		simd_isa::avx2,
+		add, sub, mul, div_,
+		lt, le, gt, ge, eq, ne,
+		min, max,
+		to_bool, neg, logical_not,
+		sqrt, abs, floor, ceil, round,
+		blend,
+		fma,
+	};
+	return k;
+}
+
+// single precision: 8 lanes, float overloads of the kernels above
+#define BBB_EXPRDSL_BIN(name, expr)                                                  \
+	BBB_EXPRDSL_TARGET("avx2") inline void name(float *a, const float *b) {            \
+		const __m256 one = _mm256_set1_ps(1.0f); (void)one;                              \
+		for (std::size_t i = 0; i < lane_block; i += 8) {                                \
+			const __m256 u = _mm256_loadu_ps(a + i), v = _mm256_loadu_ps(b + i);           \
+			_mm256_storeu_ps(a + i, expr);                                                 \
+		}                                                                                \
+	}
+#define BBB_EXPRDSL_UN(name, expr)                                                   \
+	BBB_EXPRDSL_TARGET("avx2") inline void name(float *a) {                            \
+		const __m256 one = _mm256_set1_ps(1.0f); (void)one;                              \
+		const __m256 zero = _mm256_setzero_ps(); (void)zero;                             \
+		for (std::size_t i = 0; i < lane_block; i += 8) {                                \
+			const __m256 u = _mm256_loadu_ps(a + i);                                       \
+			_mm256_storeu_ps(a + i, expr);                                                 \
+		}                                                                                \
+	}
+
+BBB_EXPRDSL_BIN(add,  _mm256_add_ps(u, v))
+BBB_EXPRDSL_BIN(sub,  _mm256_sub_ps(u, v))
+BBB_EXPRDSL_BIN(mul,  _mm256_mul_ps(u, v))
+BBB_EXPRDSL_BIN(div_, _mm256_div_ps(u, v))
+
+BBB_EXPRDSL_BIN(lt, _mm256_and_ps(_mm256_cmp_ps(u, v, _CMP_LT_OQ), one))
+BBB_EXPRDSL_BIN(le, _mm256_and_ps(_mm256_cmp_ps(u, v, _CMP_LE_OQ), one))
+BBB_EXPRDSL_BIN(gt, _mm256_and_ps(_mm256_cmp_ps(u, v, _CMP_GT_OQ), one))
+BBB_EXPRDSL_BIN(ge, _mm256_and_ps(_mm256_cmp_ps(u, v, _CMP_GE_OQ), one))
+BBB_EXPRDSL_BIN(eq, _mm256_and_ps(_mm256_cmp_ps(u, v, _CMP_EQ_OQ), one))
+BBB_EXPRDSL_BIN(ne, _mm256_and_ps(_mm256_cmp_ps(u, v, _CMP_NEQ_UQ), one))
+
+BBB_EXPRDSL_BIN(min, _mm256_min_ps(u, v))
+BBB_EXPRDSL_BIN(max, _mm256_max_ps(u, v))
+
+BBB_EXPRDSL_UN(to_bool,     _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_NEQ_UQ), one))
+BBB_EXPRDSL_UN(neg,         _mm256_xor_ps(u, _mm256_set1_ps(-0.0f)))
+BBB_EXPRDSL_UN(logical_not, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_EQ_OQ), one))
+
+BBB_EXPRDSL_UN(sqrt,  _mm256_sqrt_ps(u))
+BBB_EXPRDSL_UN(abs,   _mm256_andnot_ps(_mm256_set1_ps(-0.0f), u))
+BBB_EXPRDSL_UN(floor, _mm256_round_ps(u, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC))
+BBB_EXPRDSL_UN(ceil,  _mm256_round_ps(u, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC))
+
+#undef BBB_EXPRDSL_BIN
+#undef BBB_EXPRDSL_UN
+
+BBB_EXPRDSL_TARGET("avx2") inline void round(float *a) {
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	for (std::size_t i = 0; i < lane_block; i += 8) {
+		const __m256 u = _mm256_loadu_ps(a + i);
+		const __m256 t = _mm256_round_ps(u, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+		const __m256 frac = _mm256_andnot_ps(sign, _mm256_sub_ps(u, t));
+		const __m256 step = _mm256_or_ps(one, _mm256_and_ps(sign, u));
+		const __m256 away = _mm256_cmp_ps(frac, half, _CMP_GE_OQ);
+		_mm256_storeu_ps(a + i, _mm256_blendv_ps(t, _mm256_add_ps(t, step), away));
+	}
+}
+
+BBB_EXPRDSL_TARGET("avx2") inline void blend(float *c, const float *t, const float *f) {
+	const __m256 zero = _mm256_setzero_ps();
+	for (std::size_t i = 0; i < lane_block; i += 8) {
+		const __m256 m = _mm256_cmp_ps(_mm256_loadu_ps(c + i), zero, _CMP_NEQ_UQ);
+		_mm256_storeu_ps(c + i, _mm256_blendv_ps(_mm256_loadu_ps(f + i), _mm256_loadu_ps(t + i), m));
+	}
+}
+
+BBB_EXPRDSL_TARGET("avx2,fma") inline void fma(float *a, const float *b, const float *c) {
+	for (std::size_t i = 0; i < lane_block; i += 8) {
+		_mm256_storeu_ps(a + i, _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), _mm256_loadu_ps(c + i)));
+	}
+}
+
+inline const lane_kernels_f32 &table_f32() {
+	static const lane_kernels_f32 k = {
+		simd_isa::avx2,
+		add, sub, mul, div_,
+		lt, le, gt, ge, eq, ne,
+		min, max,
+		to_bool, neg, logical_not,
+		sqrt, abs, floor, ceil, round,
+		blend,
+		fma,
+	};
+	return k;
+}
+
+} // namespace lanes_avx2
+
+// ---------- AVX-512F (8 lanes) ----------
+#if defined(__GNUC__) && !defined(__clang__)
+#	pragma GCC diagnostic push
+#	pragma GCC diagnostic ignored "-Wuninitialized" // _mm512_undefined_pd() inside GCC's own intrinsics
+#endif
+namespace lanes_avx512 {
+
+#define BBB_EXPRDSL_BIN(name, expr)                                                  \
+	BBB_EXPRDSL_TARGET("avx512f") inline void name(double *a, const double *b) {       \
+		const __m512d one = _mm512_set1_pd(1.0); (void)one;                              \
+		for (std::size_t i = 0; i < lane_block; i += 8) {                                \
+			const __m512d u = _mm512_loadu_pd(a + i), v = _mm512_loadu_pd(b + i);          \
+			_mm512_storeu_pd(a + i, expr);                                                 \
+		}                                                                                \
+	}
+#define BBB_EXPRDSL_UN(name, expr)                                                   \
+	BBB_EXPRDSL_TARGET("avx512f") inline void name(double *a) {                        \
+		const __m512d one = _mm512_set1_pd(1.0); (void)one;                              \
+		const __m512d zero = _mm512_setzero_pd(); (void)zero;                            \
+		for (std::size_t i = 0; i < lane_block; i += 8) {                                \
+			const __m512d u = _mm512_loadu_pd(a + i);                                      \
+			_mm512_storeu_pd(a + i, expr);                                                 \
+		}                                                                                \
+	}
+
+BBB_EXPRDSL_BIN(add,  _mm512_add_pd(u, v))
+BBB_EXPRDSL_BIN(sub,  _mm512_sub_pd(u, v))
+BBB_EXPRDSL_BIN(mul,  _mm512_mul_pd(u, v))
+BBB_EXPRDSL_BIN(div_, _mm512_div_pd(u, v))
+
+BBB_EXPRDSL_BIN(lt, _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(u, v, _CMP_LT_OQ), one))
+BBB_EXPRDSL_BIN(le, _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(u, v, _CMP_LE_OQ), one))
+BBB_EXPRDSL_BIN(gt, _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(u, v, _CMP_GT_OQ), one))
+BBB_EXPRDSL_BIN(ge, _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(u, v, _CMP_GE_OQ), one))
+BBB_EXPRDSL_BIN(eq, _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(u, v, _CMP_EQ_OQ), one))
+BBB_EXPRDSL_BIN(ne, _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(u, v, _CMP_NEQ_UQ), one))
+
+BBB_EXPRDSL_BIN(min, _mm512_min_pd(u, v))
+BBB_EXPRDSL_BIN(max, _mm512_max_pd(u, v))
+
+BBB_EXPRDSL_UN(to_bool,     _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(u, zero, _CMP_NEQ_UQ), one))
+BBB_EXPRDSL_UN(neg,         _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(u), _mm512_set1_epi64(INT64_MIN))))
+BBB_EXPRDSL_UN(logical_not, _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(u, zero, _CMP_EQ_OQ), one))
+
+BBB_EXPRDSL_UN(sqrt,  _mm512_sqrt_pd(u))
+BBB_EXPRDSL_UN(abs,   _mm512_abs_pd(u))
+BBB_EXPRDSL_UN(floor, _mm512_roundscale_pd(u, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC))
+BBB_EXPRDSL_UN(ceil,  _mm512_roundscale_pd(u, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC))
+
+#undef BBB_EXPRDSL_BIN
+#undef BBB_EXPRDSL_UN
+
+BBB_EXPRDSL_TARGET("avx512f") inline void round(double *a) {
+	const __m512i sign = _mm512_set1_epi64(INT64_MIN);
+	const __m512d half = _mm512_set1_pd(0.5);
+	const __m512i one = _mm512_castpd_si512(_mm512_set1_pd(1.0));
+	for (std::size_t i = 0; i < lane_block; i += 8) {
+		const __m512d u = _mm512_loadu_pd(a + i);
+		const __m512d t = _mm512_roundscale_pd(u, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+		const __m512d frac = _mm512_abs_pd(_mm512_sub_pd(u, t));
+		const __m512d step = _mm512_castsi512_pd(_mm512_or_si512(one, _mm512_and_si512(sign, _mm512_castpd_si512(u))));
+		const __mmask8 away = _mm512_cmp_pd_mask(frac, half, _CMP_GE_OQ);
+		_mm512_storeu_pd(a + i, _mm512_mask_add_pd(t, away, t, step));
+	}
+}
+
+BBB_EXPRDSL_TARGET("avx512f") inline void blend(double *c, const double *t, const double *f) {
+	const __m512d zero = _mm512_setzero_pd();
+	for (std::size_t i = 0; i < lane_block; i += 8) {
+		const __mmask8 m = _mm512_cmp_pd_mask(_mm512_loadu_pd(c + i), zero, _CMP_NEQ_UQ);
+		_mm512_storeu_pd(c + i, _mm512_mask_blend_pd(m, _mm512_loadu_pd(f + i), _mm512_loadu_pd(t + i)));
+	}
+}
+
+BBB_EXPRDSL_TARGET("avx512f") inline void fma(double *a, const double *b, const double *c) {
+	for (std::size_t i = 0; i < lane_block; i += 8) {
+		_mm512_storeu_pd(a + i, _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), _mm512_loadu_pd(c + i)));
+	}
+}
+
+inline const lane_kernels &table() {
+	static const lane_kernels k = {
+		simd_isa::avx512,
+		add, sub, mul, div_,
+		lt, le, gt, ge, eq, ne,
+		min, max,
+		to_bool, neg, logical_not,
+		sqrt, abs, floor, ceil, round,
+		blend,
+		fma,
+	};
+	return k;
+}
+
+// single precision: 16 lanes
+#define BBB_EXPRDSL_BIN(name, expr)                                                  \
+	BBB_EXPRDSL_TARGET("avx512f") inline void name(float *a, const float *b) {         \
+		const __m512 one = _mm512_set1_ps(1.0f); (void)one;                              \
+		for (std::size_t i = 0; i < lane_block; i += 16) {                               \
+			const __m512 u = _mm512_loadu_ps(a + i), v = _mm512_loadu_ps(b + i);           \
+			_mm512_storeu_ps(a + i, expr);                                                 \
+		}                                                                                \
+	}
+#define BBB_EXPRDSL_UN(name, expr)                                                   \
+	BBB_EXPRDSL_TARGET("avx512f") inline void name(float *a) {                         \
+		const __m512 one = _mm512_set1_ps(1.0f); (void)one;                              \
+		const __m512 zero = _mm512_setzero_ps(); (void)zero;                             \
+		for (std::size_t i = 0; i < lane_block; i += 16) {                               \
+			const __m512 u = _mm512_loadu_ps(a + i);                                       \
+			_mm512_storeu_ps(a + i, expr);                                                 \
+		}                                                                                \
+	}
+
+BBB_EXPRDSL_BIN(add,  _mm512_add_ps(u, v))
+BBB_EXPRDSL_BIN(sub,  _mm512_sub_ps(u, v))
+BBB_EXPRDSL_BIN(mul,  _mm512_mul_ps(u, v))
+BBB_EXPRDSL_BIN(div_, _mm512_div_ps(u, v))
+
+BBB_EXPRDSL_BIN(lt, _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(u, v, _CMP_LT_OQ), one))
+BBB_EXPRDSL_BIN(le, _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(u, v, _CMP_LE_OQ), one))
+BBB_EXPRDSL_BIN(gt, _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(u, v, _CMP_GT_OQ), one))
+BBB_EXPRDSL_BIN(ge, _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(u, v, _CMP_GE_OQ), one))
+BBB_EXPRDSL_BIN(eq, _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(u, v, _CMP_EQ_OQ), one))
+BBB_EXPRDSL_BIN(ne, _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(u, v, _CMP_NEQ_UQ), one))
+
+BBB_EXPRDSL_BIN(min, _mm512_min_ps(u, v))
+BBB_EXPRDSL_BIN(max, _mm512_max_ps(u, v))
+
+BBB_EXPRDSL_UN(to_bool,     _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(u, zero, _CMP_NEQ_UQ), one))
+BBB_EXPRDSL_UN(neg,         _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(u), _mm512_set1_epi32(INT32_MIN))))
+BBB_EXPRDSL_UN(logical_not, _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(u, zero, _CMP_EQ_OQ), one))
+
+BBB_EXPRDSL_UN(sqrt,  _mm512_sqrt_ps(u))
+BBB_EXPRDSL_UN(abs,   _mm512_abs_ps(u))
+BBB_EXPRDSL_UN(floor, _mm512_roundscale_ps(u, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC))
+BBB_EXPRDSL_UN(ceil,  _mm512_roundscale_ps(u, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC))
+
+#undef BBB_EXPRDSL_BIN
+#undef BBB_EXPRDSL_UN
+
+BBB_EXPRDSL_TARGET("avx512f") inline void round(float *a) {
+	const __m512i sign = _mm512_set1_epi32(INT32_MIN);
+	const __m512 half = _mm512_set1_ps(0.5f);
+	const __m512i one = _mm512_castps_si512(_mm512_set1_ps(1.0f));
+	for (std::size_t i = 0; i < lane_block; i += 16) {
+		const __m512 u = _mm512_loadu_ps(a + i);
+		const __m512 t = _mm512_roundscale_ps(u, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+		const __m512 frac = _mm512_abs_ps(_mm512_sub_ps(u, t));
+		const __m512 step = _mm512_castsi512_ps(_mm512_or_si512(one, _mm512_and_si512(sign, _mm512_castps_si512(u))));
+		const __mmask16 away = _mm512_cmp_ps_mask(frac, half, _CMP_GE_OQ);
+		_mm512_storeu_ps(a + i, _mm512_mask_add_ps(t, away, t, step));
+	}
+}
+
+BBB_EXPRDSL_TARGET("avx512f") inline void blend(float *c, const float *t, const float *f) {
+	const __m512 zero = _mm512_setzero_ps();
+	for (std::size_t i = 0; i < lane_block; i += 16) {
+		const __mmask16 m = _mm512_cmp_ps_mask(_mm512_loadu_ps(c + i), zero, _CMP_NEQ_UQ);
+		_mm512_storeu_ps(c + i, _mm512_mask_blend_ps(m, _mm512_loadu_ps(f + i), _mm512_loadu_ps(t + i)));
+	}
+}
+
+BBB_EXPRDSL_TARGET("avx512f") inline void fma(float *a, const float *b, const float *c) {
+	for (std::size_t i = 0; i < lane_block; i += 16) {
+		_mm512_storeu_ps(a + i, _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), _mm512_loadu_ps(c + i)));
+	}
+}
+
+inline const lane_kernels_f32 &table_f32() {
+	static const lane_kernels_f32 k = {
+		simd_isa::avx512,
+		add, sub, mul, div_,
+		lt, le, gt, ge, eq, ne,
+		min, max,
+		to_bool, neg, logical_not,
+		sqrt, abs, floor, ceil, round,
+		blend,
+		fma,
+	};
+	return k;
+}
+
+} // namespace lanes_avx512
+#if defined(__GNUC__) && !defined(__clang__)
+#	pragma GCC diagnostic pop
+#endif
+
+#endif // BBB_EXPRDSL_X86_SIMD
+
+#if defined(BBB_EXPRDSL_NEON_SIMD)
+
+// ---------- NEON (2 lanes, AArch64 baseline) ----------
+namespace lanes_neon {
+
+#define BBB_EXPRDSL_BIN(name, expr)                                                  \
+	inline void name(double *a, const double *b) {                                     \
+		const float64x2_t one = vdupq_n_f64(1.0), zero = vdupq_n_f64(0.0);               \
+		(void)one; (void)zero;                                                           \
+		for (std::size_t i = 0; i < lane_block; i += 2) {                                \
+			const float64x2_t u = vld1q_f64(a + i), v = vld1q_f64(b + i);                  \
+			vst1q_f64(a + i, expr);                                                        \
+		}                                                                                \
+	}
+#define BBB_EXPRDSL_UN(name, expr)                                                   \
+	inline void name(double *a) {                                                      \
+		const float64x2_t one = vdupq_n_f64(1.0), zero = vdupq_n_f64(0.0);               \
+		(void)one; (void)zero;                                                           \
+		for (std::size_t i = 0; i < lane_block; i += 2) {                                \
+			const float64x2_t u = vld1q_f64(a + i);                                        \
+			vst1q_f64(a + i, expr);                                                        \
+		}                                                                                \
+	}
+
+BBB_EXPRDSL_BIN(add,  vaddq_f64(u, v))
+BBB_EXPRDSL_BIN(sub,  vsubq_f64(u, v))
+BBB_EXPRDSL_BIN(mul,  vmulq_f64(u, v))
+BBB_EXPRDSL_BIN(div_, vdivq_f64(u, v))
+
+BBB_EXPRDSL_BIN(lt, vbslq_f64(vcltq_f64(u, v), one, zero))
+BBB_EXPRDSL_BIN(le, vbslq_f64(vcleq_f64(u, v), one, zero))
+BBB_EXPRDSL_BIN(gt, vbslq_f64(vcgtq_f64(u, v), one, zero))
+BBB_EXPRDSL_BIN(ge, vbslq_f64(vcgeq_f64(u, v), one, zero))
+BBB_EXPRDSL_BIN(eq, vbslq_f64(vceqq_f64(u, v), one, zero))
+BBB_EXPRDSL_BIN(ne, vbslq_f64(vceqq_f64(u, v), zero, one))
+
+// fminq/fmaxq propagate NaN differently; select explicitly to keep u < v ? u : v
+BBB_EXPRDSL_BIN(min, vbslq_f64(vcltq_f64(u, v), u, v))
+BBB_EXPRDSL_BIN(max, vbslq_f64(vcltq_f64(v, u), u, v))
+
+BBB_EXPRDSL_UN(to_bool,     vbslq_f64(vceqq_f64(u, zero), zero, one))
+BBB_EXPRDSL_UN(neg,         vnegq_f64(u))
+BBB_EXPRDSL_UN(logical_not, vbslq_f64(vceqq_f64(u, zero), one, zero))
+
+BBB_EXPRDSL_UN(sqrt,  vsqrtq_f64(u))
+BBB_EXPRDSL_UN(abs,   vabsq_f64(u))
+BBB_EXPRDSL_UN(floor, vrndmq_f64(u))
+BBB_EXPRDSL_UN(ceil,  vrndpq_f64(u))
+BBB_EXPRDSL_UN(round, vrndaq_f64(u)) // ties away from zero, same as std::round
+
+#undef BBB_EXPRDSL_BIN
+#undef BBB_EXPRDSL_UN
+
+inline void blend(double *c, const double *t, const double *f) {
+	const float64x2_t zero = vdupq_n_f64(0.0);
+	for (std::size_t i = 0; i < lane_block; i += 2) {
+		const uint64x2_t is_zero = vceqq_f64(vld1q_f64(c + i), zero);
+		vst1q_f64(c + i, vbslq_f64(is_zero, vld1q_f64(f + i), vld1q_f64(t + i)));
+	}
+}
+
+inline void fma(double *a, const double *b, const double *c) {
+	for (std::size_t i = 0; i < lane_block; i += 2) {
+		vst1q_f64(a + i, vfmaq_f64(vld1q_f64(c + i), vld1q_f64(a + i), vld1q_f64(b + i)));
+	}
+}
+
+inline const lane_kernels &table() {
+	static const lane_kernels k = {
+		simd_isa::neon,
+		add, sub, mul, div_,
+		lt, le, gt, ge, eq, ne,
+		min, max,
+		to_bool, neg, logical_not,
+		sqrt, abs, floor, ceil, round,
+		blend,
+		fma,
+	};
+	return k;
+}
+
+// single precision: 4 lanes
+#define BBB_EXPRDSL_BIN(name, expr)                                                  \
+	inline void name(float *a, const float *b) {                                       \
+		const float32x4_t one = vdupq_n_f32(1.0f), zero = vdupq_n_f32(0.0f);             \
+		(void)one; (void)zero;                                                           \
+		for (std::size_t i = 0; i < lane_block; i += 4) {                                \
+			const float32x4_t u = vld1q_f32(a + i), v = vld1q_f32(b + i);                  \
+			vst1q_f32(a + i, expr);                                                        \
+		}                                                                                \
+	}
+#define BBB_EXPRDSL_UN(name, expr)                                                   \
+	inline void name(float *a) {                                                       \
+		const float32x4_t one = vdupq_n_f32(1.0f), zero = vdupq_n_f32(0.0f);             \
+		(void)one; (void)zero;                                                           \
+		for (std::size_t i = 0; i < lane_block; i += 4) {                                \
+			const float32x4_t u = vld1q_f32(a + i);                                        \
+			vst1q_f32(a + i, expr);                                                        \
+		}                                                                                \
+	}
+
+BBB_EXPRDSL_BIN(add,  vaddq_f32(u, v))
+BBB_EXPRDSL_BIN(sub,  vsubq_f32(u, v))
+BBB_EXPRDSL_BIN(mul,  vmulq_f32(u, v))
+BBB_EXPRDSL_BIN(div_, vdivq_f32(u, v))
+
+BBB_EXPRDSL_BIN(lt, vbslq_f32(vcltq_f32(u, v), one, zero))
+BBB_EXPRDSL_BIN(le, vbslq_f32(vcleq_f32(u, v), one, zero))
+BBB_EXPRDSL_BIN(gt, vbslq_f32(vcgtq_f32(u, v), one, zero))
+BBB_EXPRDSL_BIN(ge, vbslq_f32(vcgeq_f32(u, v), one, zero))
+BBB_EXPRDSL_BIN(eq, vbslq_f32(vceqq_f32(u, v), one, zero))
+BBB_EXPRDSL_BIN(ne, vbslq_f32(vceqq_f32(u, v), zero, one))
+
+BBB_EXPRDSL_BIN(min, vbslq_f32(vcltq_f32(u, v), u, v))
+BBB_EXPRDSL_BIN(max, vbslq_f32(vcltq_f32(v, u), u, v))
+
+BBB_EXPRDSL_UN(to_bool,     vbslq_f32(vceqq_f32(u, zero), zero, one))
+BBB_EXPRDSL_UN(neg,         vnegq_f32(u))
+BBB_EXPRDSL_UN(logical_not, vbslq_f32(vceqq_f32(u, zero), one, zero))
+
+BBB_EXPRDSL_UN(sqrt,  vsqrtq_f32(u))
+BBB_EXPRDSL_UN(abs,   vabsq_f32(u))
+BBB_EXPRDSL_UN(floor, vrndmq_f32(u))
+BBB_EXPRDSL_UN(ceil,  vrndpq_f32(u))
+BBB_EXPRDSL_UN(round, vrndaq_f32(u))
+
+#undef BBB_EXPRDSL_BIN
+#undef BBB_EXPRDSL_UN
+
+inline void blend(float *c, const float *t, const float *f) {
+	const float32x4_t zero = vdupq_n_f32(0.0f);
+	for (std::size_t i = 0; i < lane_block; i += 4) {
+		const uint32x4_t is_zero = vceqq_f32(vld1q_f32(c + i), zero);
+		vst1q_f32(c + i, vbslq_f32(is_zero, vld1q_f32(f + i), vld1q_f32(t + i)));
+	}
+}
+
+inline void fma(float *a, const float *b, const float *c) {
+	for (std::size_t i = 0; i < lane_block; i += 4) {
+		vst1q_f32(a + i, vfmaq_f32(vld1q_f32(c + i), vld1q_f32(a + i), vld1q_f32(b + i)));
+	}
+}
+
+inline const lane_kernels_f32 &table_f32() {
+	static const lane_kernels_f32 k = {
+		simd_isa::neon,
+		add, sub, mul, div_,
+		lt, le, gt, ge, eq, ne,
+		min, max,
+		to_bool, neg, logical_not,
+		sqrt, abs, floor, ceil, round,
+		blend,
+		fma,
+	};
+	return k;
+}
+
+} // namespace lanes_neon
+
+#endif // BBB_EXPRDSL_NEON_SIMD
+
+// ---------- runtime selection ----------
+inline simd_isa detect_simd_isa() {
+#if defined(BBB_EXPRDSL_X86_SIMD)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return simd_isa::avx512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return simd_isa::avx2;
+	return simd_isa::generic;
+#elif defined(BBB_EXPRDSL_NEON_SIMD)
+	return simd_isa::neon;
+#else
+	return simd_isa::generic;
+#endif
+}
+
+inline const lane_kernels *lane_kernels_for(simd_isa isa) {
+	switch (isa) {
+		case simd_isa::generic: return &lanes_generic::table<double>();
+#if defined(BBB_EXPRDSL_X86_SIMD)
+		case simd_isa::avx2:    return &lanes_avx2::table();
+		case simd_isa::avx512:  return &lanes_avx512::table();
+#endif
+#if defined(BBB_EXPRDSL_NEON_SIMD)
+		case simd_isa::neon:    return &lanes_neon::table();
+#endif
+		default: return nullptr;
+	}
+}
+
+// the float tables of the same ISAs
+inline const lane_kernels_f32 *lane_kernels_f32_for(simd_isa isa) {
+	switch (isa) {
+		case simd_isa::generic: return &lanes_generic::table<float>();
+#if defined(BBB_EXPRDSL_X86_SIMD)
+		case simd_isa::avx2:    return &lanes_avx2::table_f32();
+		case simd_isa::avx512:  return &lanes_avx512::table_f32();
+#endif
+#if defined(BBB_EXPRDSL_NEON_SIMD)
+		case simd_isa::neon:    return &lanes_neon::table_f32();
+#endif
+		default: return nullptr;
+	}
+}
+
+inline std::atomic<const lane_kernels *> &active_lane_kernels_slot() {
+	static std::atomic<const lane_kernels *> slot{lane_kernels_for(detect_simd_isa())};
+	return slot;
+}
+
+// the kernels of T for the ISA set_simd_isa() selected
+template <class T = double>
+inline const basic_lane_kernels<T> &active_lane_kernels() {
+	const lane_kernels *k = active_lane_kernels_slot().load(std::memory_order_acquire);
+	if constexpr (std::is_same<T, double>::value) {
+		return *k;
+	} else {
+		return *lane_kernels_f32_for(k->isa);
+	}
+}
+
+} // namespace detail
+
+// best instruction set supported by this CPU (detected once)
+inline simd_isa detected_simd_isa() {
+	static const simd_isa isa = detail::detect_simd_isa();
+	return isa;
+}
+
+// instruction set currently used by eval_batch (and compiled_expr_f32::eval_batch)
+inline simd_isa active_simd_isa() { return detail::active_lane_kernels().isa; }
+
+// force a kernel set, e.g. to compare ISAs; returns false if the CPU or build lacks it
+inline bool set_simd_isa(simd_isa isa) {
+	if (isa == simd_isa::avx512 && detected_simd_isa() != simd_isa::avx512) return false;
+	if (isa == simd_isa::avx2 && detected_simd_isa() != simd_isa::avx2 && detected_simd_isa() != simd_isa::avx512) return false;
+	if (isa == simd_isa::neon && detected_simd_isa() != simd_isa::neon) return false;
+	const detail::lane_kernels *k = detail::lane_kernels_for(isa);
+	if (!k) return false;
+	detail::active_lane_kernels_slot().store(k, std::memory_order_release);
+	return true;
+}
+
+} // namespace bbb
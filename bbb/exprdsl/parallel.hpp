@@ -0,0 +1,299 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "./exprdsl.hpp"
+
+namespace bbb {
+
+// fixed set of worker threads. submit() queues a task for whichever thread is free first;
+// submit_to(i) queues it for thread i alone, so a caller can place the same work on the
+// same thread every time. parallel_eval runs its worker i on thread i - 1 this way; the
+// load balancing happens between those workers (see parallel_options), so each queue stays
+// a plain FIFO.
+class thread_pool {
+public:
+	// threads == 0: one per hardware thread, less the caller's
+	explicit thread_pool(std::size_t threads = 0) {
+		if (threads == 0) {
+			const unsigned hw = std::thread::hardware_concurrency();
+			threads = hw > 1 ? hw - 1 : 1;
+		}
+		queues_.reserve(threads);
+		for (std::size_t i = 0; i < threads; ++i) queues_.push_back(std::make_unique<queue>());
+		workers_.reserve(threads);
+		for (std::size_t i = 0; i < threads; ++i) workers_.emplace_back([this, i] { work(i); });
+	}
+
+	thread_pool(const thread_pool &) = delete;
+	thread_pool &operator=(const thread_pool &) = delete;
+
+	// finishes the queued tasks, then joins
+	~thread_pool() {
+		{
+			std::lock_guard<std::mutex> lk(mutex_);
+			stop_ = true;
+			for (const std::unique_ptr<queue> &q : queues_) q->cv.notify_all();
+		}
+		for (std::thread &t : workers_) t.join();
+	}
+
+	std::size_t size() const { return workers_.size(); }
+
+	void submit(std::function<void()> task) {
+		std::lock_guard<std::mutex> lk(mutex_);
+		tasks_.push_back(std::move(task));
+		for (const std::unique_ptr<queue> &q : queues_) {
+			if (!q->idle) continue;
+			q->idle = false; // so the next submit wakes another thread
+			q->cv.notify_one();
+			break;
+		}
+	}
+
+	// runs task on thread i (below size()), after the tasks already queued for it there.
+	// a thread takes its own tasks before the shared ones
+	void submit_to(std::size_t i, std::function<void()> task) {
+		std::lock_guard<std::mutex> lk(mutex_);
+		queue &q = *queues_[i];
+		q.tasks.push_back(std::move(task));
+		q.idle = false;
+		q.cv.notify_one();
+	}
+
+private:
+	struct queue {
+		std::deque<std::function<void()>> tasks; // submit_to this thread
+		std::condition_variable cv;
+		bool idle = false; // waiting on cv
+	};
+
+	std::vector<std::thread> workers_;
+	std::vector<std::unique_ptr<queue>> queues_; // one per thread; guarded by mutex_
+	std::deque<std::function<void()>> tasks_;    // submit(), for any thread
+	std::mutex mutex_;
+	bool stop_ = false;
+
+	void work(std::size_t self) {
+		queue &q = *queues_[self];
+		for (;;) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lk(mutex_);
+				for (;;) {
+					std::deque<std::function<void()>> &from = !q.tasks.empty() ? q.tasks : tasks_;
+					if (!from.empty()) {
+						task = std::move(from.front());
+						from.pop_front();
+						break;
+					}
+					if (stop_) return;
+					q.idle = true;
+					q.cv.wait(lk);
+					q.idle = false;
+				}
+			}
+			task();
+		}
+	}
+};
+
+// the pool parallel_eval uses when parallel_options names none; started on first use
+inline thread_pool &default_thread_pool() {
+	static thread_pool pool;
+	return pool;
+}
+
+struct parallel_options {
+	// rows per chunk, rounded up to compiled_expr::batch_block; 0 sizes chunks so that one
+	// chunk's inputs and outputs stay in a core's L2 (chunk_bytes)
+	std::size_t chunk_rows = 0;
+	std::size_t chunk_bytes = 256 * 1024;
+
+	// workers, the calling thread included; 0: pool size + 1 (or hardware threads with an
+	// executor)
+	std::size_t threads = 0;
+
+	// runs the workers; nullptr: default_thread_pool()
+	thread_pool *pool = nullptr;
+
+	// hands a worker to someone else's scheduler instead of a thread_pool. parallel_eval
+	// returns once every row is written, even if some worker has not started by then (it
+	// then finds nothing left to do), so an executor that runs tasks later or inline is fine.
+	std::function<void(std::function<void()>)> executor;
+};
+
+namespace detail {
+
+// rows [0, n) cut into chunks; worker i starts on the i-th contiguous share of them, front to
+// back, and once it runs dry steals chunks from the back of the other shares. worker 0 is
+// the caller and worker i runs on pool thread i - 1 (see parallel_rows), so repeated calls
+// from one thread over the same rows start each share on the same thread: with
+// first-touch page placement the pages a share writes tend to stay on that thread's node.
+// only stolen chunks move. an executor places workers as it likes.
+class parallel_job {
+public:
+	using kernel = std::function<void(std::size_t begin, std::size_t count, double *scratch)>;
+
+	parallel_job(std::size_t n, std::size_t chunk, std::size_t workers, std::size_t scratch_size, kernel k)
+		: n_(n), chunk_(chunk), scratch_size_(scratch_size), shares_(workers), scratch_(workers * scratch_size),
+		  kernel_(std::move(k)) {
+		const std::size_t chunks = (n + chunk - 1) / chunk;
+		remaining_.store(chunks, std::memory_order_relaxed);
+		for (std::size_t i = 0; i < workers; ++i) {
+			const std::uint64_t front = chunks * i / workers, back = chunks * (i + 1) / workers;
+			shares_[i].range.store(front << 32 | back, std::memory_order_relaxed);
+		}
+	}
+
+	void run_worker(std::size_t self) {
+		double *scratch = scratch_.data() + self * scratch_size_;
+		std::size_t c;
+		while (take_front(self, c)) run_chunk(c, scratch);
+		for (std::size_t i = 1; i < shares_.size(); ++i) {
+			const std::size_t victim = (self + i) % shares_.size();
+			while (take_back(victim, c)) run_chunk(c, scratch);
+		}
+	}
+
+	// blocks until every chunk has been written
+	void wait() {
+		std::unique_lock<std::mutex> lk(mutex_);
+		cv_.wait(lk, [this] { return done_; });
+	}
+
+private:
+	// chunk indices [front, back) packed as front << 32 | back
+	struct alignas(64) share { std::atomic<std::uint64_t> range{0}; };
+
+	std::size_t n_, chunk_, scratch_size_;
+	std::vector<share> shares_;
+	std::vector<double> scratch_; // a lane stack per worker
+	kernel kernel_;
+	std::atomic<std::size_t> remaining_{0};
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	bool done_ = false;
+
+	bool take_front(std::size_t i, std::size_t &c) {
+		std::atomic<std::uint64_t> &r = shares_[i].range;
+		std::uint64_t v = r.load(std::memory_order_relaxed);
+		for (;;) {
+			const std::uint64_t front = v >> 32, back = v & 0xffffffffu;
+			if (front >= back) return false;
+			if (r.compare_exchange_weak(v, (front + 1) << 32 | back, std::memory_order_relaxed)) {
+				c = static_cast<std::size_t>(front);
+				return true;
+			}
+		}
+	}
+	bool take_back(std::size_t i, std::size_t &c) {
+		std::atomic<std::uint64_t> &r = shares_[i].range;
+		std::uint64_t v = r.load(std::memory_order_relaxed);
+		for (;;) {
+			const std::uint64_t front = v >> 32, back = v & 0xffffffffu;
+			if (front >= back) return false;
+			if (r.compare_exchange_weak(v, front << 32 | (back - 1), std::memory_order_relaxed)) {
+				c = static_cast<std::size_t>(back - 1);
+				return true;
+			}
+		}
+	}
+
+	void run_chunk(std::size_t c, double *scratch) {
+		const std::size_t begin = c * chunk_;
+		kernel_(begin, std::min(chunk_, n_ - begin), scratch);
+		// acq_rel: the last worker publishes every chunk's rows to the waiting caller
+		if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			std::lock_guard<std::mutex> lk(mutex_);
+			done_ = true;
+			cv_.notify_all();
+		}
+	}
+};
+
+// row_bytes: what one row reads and writes, to size chunks from parallel_options::chunk_bytes
+inline void parallel_rows(std::size_t n, std::size_t row_bytes, std::size_t scratch_size,
+                          const parallel_options &opts, parallel_job::kernel k) {
+	if (n == 0) return;
+	std::size_t chunk = opts.chunk_rows;
+	if (chunk == 0) chunk = opts.chunk_bytes / (row_bytes ? row_bytes : 1);
+	const std::size_t block = compiled_expr::batch_block;
+	chunk = std::max<std::size_t>((chunk + block - 1) / block * block, block);
+	// chunk indices must fit the 32-bit halves of a share
+	chunk = std::max<std::size_t>(chunk, n / 0xffffffffu + 1);
+
+	thread_pool *pool = opts.executor ? nullptr : opts.pool ? opts.pool : &default_thread_pool();
+	std::size_t workers = opts.threads;
+	if (workers == 0) workers = pool ? pool->size() + 1 : std::max(1u, std::thread::hardware_concurrency());
+	workers = std::min(workers, (n + chunk - 1) / chunk);
+
+	if (workers <= 1) { // one chunk's worth: no point waking anyone
+		std::vector<double> scratch(scratch_size);
+		for (std::size_t begin = 0; begin < n; begin += chunk) k(begin, std::min(chunk, n - begin), scratch.data());
+		return;
+	}
+
+	// shared with workers that may start after the last row is written
+	auto job = std::make_shared<parallel_job>(n, chunk, workers, scratch_size, std::move(k));
+	for (std::size_t i = 1; i < workers; ++i) {
+		auto task = [job, i] { job->run_worker(i); };
+		if (pool) pool->submit_to((i - 1) % pool->size(), task); // the same thread every call
+		else opts.executor(task);
+	}
+	job->run_worker(0);
+	job->wait();
+}
+
+} // namespace detail
+
+// =============================
+// parallel_eval()
+// =============================
+// eval_batch over n rows split into chunks that run on several threads at once (see
+// parallel_options); out is the same as eval_batch writes. rows are independent, so this
+// scales with cores until memory bandwidth runs out. inputs and outputs must stay valid and
+// unmodified until it returns. not to be called from a task of the pool it runs on.
+
+// structure-of-arrays columns, as compiled_expr::eval_batch(x, y, z, w, out, n)
+inline void parallel_eval(const compiled_expr &e, const double *x, const double *y, const double *z, const double *w,
+                          double *out, std::size_t n, const parallel_options &opts = parallel_options{}) {
+	const std::size_t cols = (x != nullptr) + (y != nullptr) + (z != nullptr) + (w != nullptr);
+	auto at = [](const double *c, std::size_t i) { return c ? c + i : nullptr; };
+	detail::parallel_rows(n, 8 * (cols + 1), e.batch_scratch_size(), opts,
+	                      [&e, x, y, z, w, out, at](std::size_t begin, std::size_t count, double *scratch) {
+		                      e.eval_batch(at(x, begin), at(y, begin), at(z, begin), at(w, begin), out + begin, count, scratch);
+	                      });
+}
+
+// array-of-structures records, as compiled_expr::eval_batch(records, out, n)
+inline void parallel_eval(const compiled_expr &e, const double *records, double *out, std::size_t n,
+                          const parallel_options &opts = parallel_options{}) {
+	const std::size_t stride = e.record_stride();
+	detail::parallel_rows(n, 8 * (stride + 1), e.batch_scratch_size(), opts,
+	                      [&e, records, out, stride](std::size_t begin, std::size_t count, double *scratch) {
+		                      e.eval_batch(records + begin * stride, out + begin, count, scratch);
+	                      });
+}
+
+// every output of a compile_many program: out is the n x m.size() row-major block
+inline void parallel_eval(const compiled_multi_expr &m, const double *records, double *out, std::size_t n,
+                          const parallel_options &opts = parallel_options{}) {
+	const std::size_t stride = m.record_stride(), outs = m.size();
+	detail::parallel_rows(n, 8 * (stride + outs), m.batch_scratch_size(), opts,
+	                      [&m, records, out, stride, outs](std::size_t begin, std::size_t count, double *scratch) {
+		                      m.eval_batch(records + begin * stride, out + begin * outs, count, scratch);
+	                      });
+}
+
+} // namespace bbb
@@ -0,0 +1,654 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "./exprdsl.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#	define BBB_EXPRDSL_MMAP 1
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+namespace bbb {
+
+// =============================
+// saved programs
+// =============================
+// a bundle is a binary file of compiled programs that loads without compile(): the
+// bytecode and constant pool are read where they lie (an mmap'ed file is evaluated in
+// place), after a verifier has checked that the code cannot take any backend out of
+// bounds. the format is tied to the bytecode, so a file from a build with another
+// format version is rejected, and the source can be compiled again.
+//
+// layout, little words of 8 bytes in the writer's byte order:
+//   header: magic "bbbexpr", version | byte-order mark, sizeof(instr), entry count,
+//           file size, then (offset, size) of each entry
+//   entry:  checksum of the rest of the entry, flags (multi, schema), code length,
+//           pool length, max_stack, batch_slots, n_locals, record_size, record_stride,
+//           outputs, schema size, source_hash of the sources; then the code, the pool,
+//           each source (length, bytes padded to 8) and each variable (slot, length, name)
+
+enum class load_errc : std::uint8_t {
+	none,
+	io,              // the file could not be opened, read or mapped
+	truncated,       // shorter than its header says
+	bad_magic,       // not a bundle
+	bad_version,     // another format version
+	bad_layout,      // other byte order or instruction size, or misaligned data
+	corrupt,         // checksum mismatch or inconsistent fields
+	invalid_program, // rejected by the bytecode verifier
+};
+
+struct load_error {
+	std::string message;
+	load_errc code = load_errc::none;
+	std::size_t index = 0; // entry the error is in
+};
+
+// 64-bit FNV-1a of src, as stored with every saved program
+inline std::uint64_t source_hash(std::string_view src) {
+	std::uint64_t h = 0xcbf29ce484222325ull;
+	for (char c : src) {
+		h ^= static_cast<unsigned char>(c);
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+struct bundle_options {
+	bool jit = false; // generate native code for each program while loading (compile_options::jit)
+};
+
+namespace detail {
+
+// checks that code has the shape bytecode_compiler emits, which is what every backend
+// relies on: operands index the pool, the record, the locals and the outputs in range;
+// each conditional jump opens an if/else whose then arm ends in the jmp over the else arm
+// (eval_batch runs the arms separately), so every jump goes forward; the stack depth is
+// the same on every path, never dips below what its arm started with and ends at one
+// value (none for compile_many). it also measures the stack and lane slots the code needs.
+class bytecode_verifier {
+public:
+	using op = compiled_expr::op;
+	using instr = compiled_expr::instr;
+
+	std::size_t max_depth = 0; // stack slots, without locals
+	std::size_t max_lanes = 0; // eval_batch lane slots, without locals
+	std::size_t n_store_local = 0;
+	const char *error = nullptr;
+	std::size_t error_pc = 0;
+
+	bool run(const_span<instr> code, std::size_t n_consts, std::size_t n_locals, std::size_t record_size,
+	         std::size_t n_outputs, bool multi) {
+		code_ = code;
+		n_consts_ = n_consts;
+		n_locals_ = n_locals;
+		record_size_ = record_size;
+		n_outputs_ = multi ? n_outputs : 0;
+		max_depth = max_lanes = n_store_local = 0;
+		error = nullptr;
+
+		if (code.empty() || code[code.size() - 1].opcode != op::end) return fail(code.size(), "missing end");
+		long depth = 0;
+		if (!region(0, code.size() - 1, 0, 0, depth)) return false;
+		if (depth != (multi ? 0 : 1)) return fail(code.size() - 1, "unbalanced stack at end");
+		return true;
+	}
+
+private:
+	const_span<instr> code_;
+	std::size_t n_consts_ = 0, n_locals_ = 0, record_size_ = 0, n_outputs_ = 0;
+
+	bool fail(std::size_t pc, const char *why) {
+		error = why;
+		error_pc = pc;
+		return false;
+	}
+
+	bool is_var(long i) const { return 0 <= i && static_cast<std::size_t>(i) < record_size_; }
+	bool is_const(long i) const { return 0 <= i && static_cast<std::size_t>(i) < n_consts_; }
+
+	// values an instruction pops before it pushes (stack_effect has the net change)
+	static int pops(op o, int arg) {
+		switch (o) {
+			case op::pop: case op::to_bool: case op::neg: case op::logical_not:
+			case op::store_local: case op::store_out: case op::jz: case op::jnz:
+				return 1;
+			case op::add: case op::sub: case op::mul: case op::div_: case op::mod: case op::pow:
+			case op::lt: case op::le: case op::gt: case op::ge: case op::eq: case op::ne:
+			case op::jlt: case op::jle: case op::jgt: case op::jge: case op::jeq: case op::jne:
+				return 2;
+			case op::call:
+				return arg < 14 ? 1 : 2;
+			case op::fma: case op::select:
+				return 3;
+			case op::add_c: case op::sub_c: case op::mul_c: case op::div_c:
+			case op::add_v: case op::sub_v: case op::mul_v: case op::div_v:
+				return 1;
+			case op::call_sin: case op::call_cos: case op::call_tan: case op::call_asin: case op::call_acos:
+			case op::call_atan: case op::call_exp: case op::call_log: case op::call_log10: case op::call_sqrt:
+			case op::call_abs: case op::call_floor: case op::call_ceil: case op::call_round:
+				return 1;
+			case op::call_pow: case op::call_atan2: case op::call_fmod: case op::call_min: case op::call_max:
+				return 2;
+			default:
+				return 0;
+		}
+	}
+
+	// slots above the depth before the instruction that it writes, as eval_batch runs it:
+	// a superinstruction still builds its operands in lane slots
+	static int reach(op o) {
+		switch (o) {
+			case op::push_const: case op::push_var: case op::load_local:
+			case op::add_c: case op::sub_c: case op::mul_c: case op::div_c:
+			case op::add_v: case op::sub_v: case op::mul_v: case op::div_v:
+				return 1;
+			case op::add_vc: case op::sub_vc: case op::mul_vc: case op::div_vc:
+			case op::add_cv: case op::sub_cv: case op::mul_cv: case op::div_cv:
+			case op::add_vv: case op::sub_vv: case op::mul_vv: case op::div_vv:
+			case op::jlt_vc: case op::jle_vc: case op::jgt_vc: case op::jge_vc: case op::jeq_vc: case op::jne_vc:
+				return 2;
+			default:
+				return 0;
+		}
+	}
+
+	bool operands(const instr &in) const {
+		const op o = in.opcode;
+		switch (o) {
+			case op::push_const: return is_const(in.arg);
+			case op::push_var: return is_var(in.arg);
+			case op::store_local: case op::load_local:
+				return 0 <= in.arg && static_cast<std::size_t>(in.arg) < n_locals_;
+			case op::store_out: return 0 <= in.arg && static_cast<std::size_t>(in.arg) < n_outputs_;
+			case op::call: return 0 <= in.arg && in.arg <= 18;
+			default: break;
+		}
+		if (op::add_vc <= o && o <= op::div_cv) return is_var(in.arg) && is_const(in.k);
+		if (op::add_vv <= o && o <= op::div_vv) return is_var(in.arg) && is_var(in.arg2);
+		if (op::add_c <= o && o <= op::div_c) return is_const(in.k);
+		if (op::add_v <= o && o <= op::div_v) return is_var(in.arg);
+		if (op::jlt_vc <= o && o <= op::jne_vc) return is_var(in.arg2) && is_const(in.k);
+		return true;
+	}
+
+	// the instruction writes stack slots below top
+	void note(long top, long shift) {
+		if (max_depth < static_cast<std::size_t>(top)) max_depth = static_cast<std::size_t>(top);
+		if (max_lanes < static_cast<std::size_t>(top + shift)) max_lanes = static_cast<std::size_t>(top + shift);
+	}
+
+	// code[pc, stop) entered at depth floor, with shift lane slots held by enclosing arms. an
+	// arm of an if/else also knows the conditional jump that opened it and, while it is the
+	// then arm, where the else arm lies
+	struct arm {
+		std::size_t pc, stop;
+		long depth, floor, shift;
+		std::size_t jump_pc = 0;
+		std::size_t else_begin = 0, else_end = 0;
+		bool is_then = false;
+		long then_depth = 0; // else arm: the depth the then arm left
+	};
+	std::vector<arm> arms_; // innermost last; kept between runs
+
+	// walks code[pc, stop) and every arm nested in it, innermost first, on arms_ rather than
+	// the call stack: conditionals nest as deep as compile() makes them. out is the depth
+	// the region leaves
+	bool region(std::size_t pc, std::size_t stop, long depth, long shift, long &out) {
+		arms_.clear();
+		arms_.push_back(arm{pc, stop, depth, depth, shift});
+		for (;;) {
+			arm &a = arms_.back();
+			if (a.pc == a.stop) {
+				const arm done = a;
+				arms_.pop_back();
+				if (arms_.empty()) {
+					out = done.depth;
+					return true;
+				}
+				if (done.is_then) {
+					arm e{done.else_begin, done.else_end, done.floor, done.floor, done.shift + 1, done.jump_pc};
+					e.then_depth = done.depth;
+					arms_.push_back(e);
+				} else if (done.then_depth != done.floor + 1 || done.depth != done.floor + 1) {
+					return fail(done.jump_pc, "if/else arms leave different stacks");
+				}
+				continue;
+			}
+
+			const std::size_t at = a.pc;
+			const instr &in = code_[at];
+			if (static_cast<std::size_t>(in.opcode) >= compiled_expr::op_count) return fail(at, "unknown opcode");
+			if (!operands(in)) return fail(at, "operand out of range");
+			if (a.depth - pops(in.opcode, in.arg) < a.floor) return fail(at, "stack underflow");
+			const long after = a.depth + bytecode_compiler::stack_effect(in.opcode, in.arg);
+			note(std::max(a.depth + reach(in.opcode), after), a.shift);
+			if (in.opcode == op::store_local) ++n_store_local;
+
+			if (in.opcode == op::jmp) return fail(at, "jump outside an if/else");
+			if (in.opcode == op::end) return fail(at, "end before the last instruction");
+			if (!bytecode_compiler::is_jump(in.opcode)) {
+				a.depth = after;
+				++a.pc;
+				continue;
+			}
+
+			// cond jz else; then arm; jmp end; else: else arm; end:
+			if (in.arg < 0) return fail(at, "jump out of range");
+			const std::size_t target = static_cast<std::size_t>(in.arg);
+			if (target < at + 2 || target > a.stop) return fail(at, "jump out of range");
+			const instr &skip = code_[target - 1];
+			if (skip.opcode != op::jmp || skip.arg < 0) return fail(at, "if/else without a jmp over the else arm");
+			const std::size_t end = static_cast<std::size_t>(skip.arg);
+			if (end < target || end > a.stop) return fail(target - 1, "jump out of range");
+
+			// the enclosing arm resumes past the if/else once both arms check out
+			a.pc = end;
+			a.depth = after + 1;
+			arm t{at + 1, target - 1, after, after, a.shift + 1, at, target, end};
+			t.is_then = true;
+			arms_.push_back(t); // invalidates a
+		}
+	}
+};
+
+// reads and writes compiled_expr::program; the friend that knows its fields
+class program_io {
+public:
+	using program = compiled_expr::program;
+	using instr = compiled_expr::instr;
+
+	// bump whenever compiled_expr::op, instr or the layout above changes
+	static constexpr std::uint32_t format_version = 2;
+	static constexpr std::uint32_t byte_order = 0x01020304;
+	static constexpr char magic[8] = {'b', 'b', 'b', 'e', 'x', 'p', 'r', '\0'};
+	static constexpr std::size_t header_words = 5;
+	static constexpr std::size_t entry_words = 12;
+	static constexpr std::uint64_t flag_multi = 1, flag_schema = 2;
+
+	static const std::shared_ptr<const program> &of(const compiled_expr &e) { return e.prog_; }
+	static const std::shared_ptr<const program> &of(const compiled_multi_expr &m) { return m.e_.prog_; }
+
+	// one word per 8 bytes; depends on nothing but sizes, so both sides agree
+	static std::uint64_t checksum(const std::uint8_t *p, std::size_t words) {
+		std::uint64_t h = 0xcbf29ce484222325ull;
+		for (std::size_t i = 0; i < words; ++i) {
+			std::uint64_t w;
+			std::memcpy(&w, p + 8 * i, 8);
+			h = (h ^ w) * 0x100000001b3ull;
+		}
+		return h;
+	}
+
+	static std::uint64_t sources_hash(const program &p) {
+		if (!p.multi) return source_hash(p.expr);
+		std::uint64_t h = 0;
+		for (const std::string &s : p.outputs) h = (h ^ source_hash(s)) * 0x100000001b3ull;
+		return h;
+	}
+
+	static void put(std::vector<std::uint8_t> &out, std::uint64_t w) {
+		std::uint8_t b[8];
+		std::memcpy(b, &w, 8);
+		out.insert(out.end(), b, b + 8);
+	}
+	static void put_string(std::vector<std::uint8_t> &out, std::string_view s) {
+		put(out, s.size());
+		out.insert(out.end(), s.begin(), s.end());
+		out.resize((out.size() + 7) / 8 * 8, 0);
+	}
+
+	static void write_header(std::vector<std::uint8_t> &out, std::size_t count) {
+		out.insert(out.end(), magic, magic + 8);
+		put(out, std::uint64_t(format_version) | std::uint64_t(byte_order) << 32);
+		put(out, sizeof(instr));
+		put(out, count);
+		put(out, 0); // file size, patched by finish()
+		for (std::size_t i = 0; i < count; ++i) {
+			put(out, 0);
+			put(out, 0);
+		}
+	}
+
+	// appends p as entry i of a bundle whose header is already in out
+	static void write_entry(std::vector<std::uint8_t> &out, std::size_t i, const program &p) {
+		const std::size_t at = out.size();
+		put(out, 0); // checksum
+		put(out, (p.multi ? flag_multi : 0) | (p.has_schema ? flag_schema : 0));
+		put(out, p.code.size());
+		put(out, p.consts.size());
+		put(out, p.max_stack);
+		put(out, p.batch_slots);
+		put(out, p.n_locals);
+		put(out, p.record_size);
+		put(out, p.record_stride);
+		put(out, p.outputs.size());
+		put(out, p.vars.size());
+		put(out, sources_hash(p));
+		const std::uint8_t *code = reinterpret_cast<const std::uint8_t *>(p.code.data());
+		out.insert(out.end(), code, code + p.code.size() * sizeof(instr));
+		const std::uint8_t *pool = reinterpret_cast<const std::uint8_t *>(p.consts.data());
+		out.insert(out.end(), pool, pool + p.consts.size() * sizeof(double));
+		if (p.multi) {
+			for (const std::string &s : p.outputs) put_string(out, s);
+		} else {
+			put_string(out, p.expr);
+		}
+		for (const var_schema::var &v : p.vars) {
+			put(out, v.slot);
+			put_string(out, v.name);
+		}
+
+		const std::size_t size = out.size() - at;
+		const std::uint64_t sum = checksum(out.data() + at + 8, size / 8 - 1);
+		std::memcpy(out.data() + at, &sum, 8);
+		const std::uint64_t where[2] = {at, size};
+		std::memcpy(out.data() + 8 * (header_words + 2 * i), where, sizeof where);
+	}
+
+	static void finish(std::vector<std::uint8_t> &out) {
+		const std::uint64_t size = out.size();
+		std::memcpy(out.data() + 8 * (header_words - 1), &size, 8);
+	}
+
+	// reads the bundle header of data[0, size): the entry count and where the table starts
+	static std::optional<load_error> read_header(const std::uint8_t *data, std::size_t size, std::size_t &count) {
+		if (reinterpret_cast<std::uintptr_t>(data) % 8 != 0) return error(load_errc::bad_layout, "bundle is not 8-byte aligned");
+		if (size < 8 * header_words) return error(load_errc::truncated, "bundle header is truncated");
+		if (std::memcmp(data, magic, 8) != 0) return error(load_errc::bad_magic, "not an expression bundle");
+		const std::uint64_t *w = reinterpret_cast<const std::uint64_t *>(data);
+		if (static_cast<std::uint32_t>(w[1] >> 32) != byte_order) return error(load_errc::bad_layout, "bundle has another byte order");
+		if (static_cast<std::uint32_t>(w[1]) != format_version) return error(load_errc::bad_version, "bundle has another format version");
+		if (w[2] != sizeof(instr)) return error(load_errc::bad_layout, "bundle has another instruction size");
+		if (w[4] > size) return error(load_errc::truncated, "bundle is truncated");
+		if (w[4] != size) return error(load_errc::corrupt, "bundle size does not match its header");
+		if (w[3] > (size / 8 - header_words) / 2) return error(load_errc::truncated, "bundle entry table is truncated");
+		count = static_cast<std::size_t>(w[3]);
+		return std::nullopt;
+	}
+
+	// entry i of a bundle read_header accepted; code and constants stay in data, which
+	// backing (if any) keeps alive
+	static std::optional<load_error> read_entry(const std::uint8_t *data, std::size_t size, std::size_t i,
+	                                            const std::shared_ptr<const void> &backing, bool jit,
+	                                            std::shared_ptr<program> &out) {
+		const std::uint64_t *table = reinterpret_cast<const std::uint64_t *>(data) + header_words + 2 * i;
+		const std::uint64_t at = table[0], len = table[1];
+		if (at % 8 != 0 || len % 8 != 0 || at > size || len > size - at || len < 8 * entry_words) {
+			return error(load_errc::corrupt, "entry out of bounds", i);
+		}
+		const std::uint8_t *e = data + at;
+		const std::uint64_t *w = reinterpret_cast<const std::uint64_t *>(e);
+		if (checksum(e + 8, len / 8 - 1) != w[0]) return error(load_errc::corrupt, "checksum mismatch", i);
+
+		const std::uint64_t flags = w[1], n_code = w[2], n_consts = w[3];
+		const std::uint64_t n_outputs = w[9], n_vars = w[10];
+		if (flags & ~(flag_multi | flag_schema)) return error(load_errc::corrupt, "unknown flags", i);
+
+		std::size_t pos = 8 * entry_words;
+		auto take = [&](std::uint64_t words, const std::uint8_t *&p) {
+			if (words > (len - pos) / 8) return false;
+			p = e + pos;
+			pos += static_cast<std::size_t>(words * 8);
+			return true;
+		};
+		auto take_string = [&](std::string &s) {
+			const std::uint8_t *p;
+			if (!take(1, p)) return false;
+			std::uint64_t n;
+			std::memcpy(&n, p, 8);
+			if (n > len - pos) return false;
+			if (!take((n + 7) / 8, p)) return false;
+			s.assign(reinterpret_cast<const char *>(p), static_cast<std::size_t>(n));
+			return true;
+		};
+
+		auto p = std::make_shared<program>();
+		const std::uint8_t *code, *pool;
+		if (!take(n_code, code) || !take(n_consts, pool)) return error(load_errc::corrupt, "entry is truncated", i);
+		p->code = {reinterpret_cast<const instr *>(code), static_cast<std::size_t>(n_code)};
+		p->consts = {reinterpret_cast<const double *>(pool), static_cast<std::size_t>(n_consts)};
+		p->backing = backing;
+		p->multi = (flags & flag_multi) != 0;
+		p->has_schema = (flags & flag_schema) != 0;
+		p->max_stack = static_cast<std::size_t>(w[4]);
+		p->batch_slots = static_cast<std::size_t>(w[5]);
+		p->n_locals = static_cast<std::size_t>(w[6]);
+		p->record_size = static_cast<std::size_t>(w[7]);
+		p->record_stride = static_cast<std::size_t>(w[8]);
+
+		if (!p->multi && n_outputs != 0) return error(load_errc::corrupt, "outputs in a single expression", i);
+		if (n_outputs > (len - pos) / 8 || n_vars > (len - pos) / 16) return error(load_errc::corrupt, "entry is truncated", i);
+		if (p->multi) {
+			p->outputs.resize(static_cast<std::size_t>(n_outputs));
+			for (std::string &s : p->outputs) {
+				if (!take_string(s)) return error(load_errc::corrupt, "entry is truncated", i);
+			}
+		} else if (!take_string(p->expr)) {
+			return error(load_errc::corrupt, "entry is truncated", i);
+		}
+		var_schema schema;
+		for (std::uint64_t v = 0; v < n_vars; ++v) {
+			const std::uint8_t *slot;
+			std::string name;
+			if (!take(1, slot) || !take_string(name)) return error(load_errc::corrupt, "entry is truncated", i);
+			std::uint64_t s;
+			std::memcpy(&s, slot, 8);
+			if (s >= var_schema::max_slot) return error(load_errc::corrupt, "variable slot out of range", i);
+			schema.add(std::move(name), static_cast<std::size_t>(s));
+		}
+		if (pos != len) return error(load_errc::corrupt, "trailing bytes in entry", i);
+		if (sources_hash(*p) != w[11]) return error(load_errc::corrupt, "source hash mismatch", i);
+
+		if (p->has_schema) {
+			if (check_schema(schema)) return error(load_errc::corrupt, "invalid variable schema", i);
+			schema.set_stride(p->record_stride);
+			if (p->record_size != schema.record_size() || p->record_stride != schema.stride()) {
+				return error(load_errc::corrupt, "record size does not match the schema", i);
+			}
+			p->vars = schema.vars();
+		} else if (n_vars != 0 || p->record_size != 4 || p->record_stride != 4) {
+			return error(load_errc::corrupt, "record size without a schema", i);
+		}
+
+		bytecode_verifier v;
+		if (!v.run(p->code, p->consts.size(), p->n_locals, p->record_size, p->outputs.size(), p->multi)) {
+			return error(load_errc::invalid_program, "instruction " + std::to_string(v.error_pc) + ": " + v.error, i);
+		}
+		if (p->n_locals > v.n_store_local || p->max_stack != v.max_depth + p->n_locals ||
+		    p->batch_slots != v.max_lanes + p->n_locals) {
+			return error(load_errc::invalid_program, "stack sizes do not match the code", i);
+		}
+
+		p->opts.jit = jit; // what specialize() recompiles with
+		compiled_expr::bind(*p, jit);
+		out = std::move(p);
+		return std::nullopt;
+	}
+
+	static compiled_expr make_expr(std::shared_ptr<const program> p) {
+		compiled_expr e;
+		e.prog_ = std::move(p);
+		return e;
+	}
+	static compiled_multi_expr make_multi(std::shared_ptr<const program> p) {
+		compiled_multi_expr m;
+		m.e_.prog_ = std::move(p);
+		return m;
+	}
+
+	static load_error error(load_errc code, std::string message, std::size_t index = 0) {
+		load_error e;
+		e.message = std::move(message);
+		e.code = code;
+		e.index = index;
+		return e;
+	}
+};
+
+} // namespace detail
+
+// collects programs and lays them out as one bundle
+class expr_bundle_writer {
+public:
+	// return the entry index of the program
+	std::size_t add(const compiled_expr &e) { return push(detail::program_io::of(e)); }
+	std::size_t add(const compiled_multi_expr &m) { return push(detail::program_io::of(m)); }
+
+	std::size_t size() const { return programs_.size(); }
+
+	std::vector<std::uint8_t> bytes() const {
+		std::vector<std::uint8_t> out;
+		detail::program_io::write_header(out, programs_.size());
+		for (std::size_t i = 0; i < programs_.size(); ++i) detail::program_io::write_entry(out, i, *programs_[i]);
+		detail::program_io::finish(out);
+		return out;
+	}
+
+	// false if the file cannot be written
+	bool write(const std::string &path) const {
+		const std::vector<std::uint8_t> b = bytes();
+		std::FILE *f = std::fopen(path.c_str(), "wb");
+		if (!f) return false;
+		const bool ok = std::fwrite(b.data(), 1, b.size(), f) == b.size();
+		return std::fclose(f) == 0 && ok;
+	}
+
+private:
+	std::vector<std::shared_ptr<const detail::program_io::program>> programs_; // immutable, so shared
+
+	std::size_t push(const std::shared_ptr<const detail::program_io::program> &p) {
+		programs_.push_back(p);
+		return programs_.size() - 1;
+	}
+};
+
+// the programs of a bundle, verified once when it is opened. a bundle from open() or
+// view() is evaluated in place: programs point into the mapping (or the caller's buffer),
+// and their code and constants are never copied. programs taken from a bundle keep a
+// mapping alive on their own. vm_backend::reg programs load as stack bytecode.
+class expr_bundle {
+public:
+	using result = std::pair<expr_bundle, std::optional<load_error>>;
+
+	expr_bundle() = default;
+
+	// maps the file read-only (reads it on platforms without mmap)
+	static result open(const std::string &path, const bundle_options &opts = bundle_options{}) {
+#if defined(BBB_EXPRDSL_MMAP)
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return {expr_bundle{}, detail::program_io::error(load_errc::io, "cannot open " + path)};
+		struct stat st;
+		if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+			::close(fd);
+			return {expr_bundle{}, detail::program_io::error(st.st_size == 0 ? load_errc::truncated : load_errc::io, "cannot read " + path)};
+		}
+		const std::size_t size = static_cast<std::size_t>(st.st_size);
+		void *p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED) return {expr_bundle{}, detail::program_io::error(load_errc::io, "cannot map " + path)};
+		std::shared_ptr<const void> map(p, [size](const void *q) { ::munmap(const_cast<void *>(q), size); });
+		return load(static_cast<const std::uint8_t *>(p), size, std::move(map), opts);
+#else
+		std::FILE *f = std::fopen(path.c_str(), "rb");
+		if (!f) return {expr_bundle{}, detail::program_io::error(load_errc::io, "cannot open " + path)};
+		std::vector<std::uint8_t> bytes;
+		std::uint8_t buf[1 << 16];
+		for (std::size_t n; (n = std::fread(buf, 1, sizeof buf, f)) > 0;) bytes.insert(bytes.end(), buf, buf + n);
+		const bool failed = std::ferror(f) != 0;
+		std::fclose(f);
+		if (failed) return {expr_bundle{}, detail::program_io::error(load_errc::io, "cannot read " + path)};
+		return from_bytes(std::move(bytes), opts);
+#endif
+	}
+
+	// takes over a bundle in memory, e.g. expr_bundle_writer::bytes()
+	static result from_bytes(std::vector<std::uint8_t> bytes, const bundle_options &opts = bundle_options{}) {
+		auto owned = std::make_shared<const std::vector<std::uint8_t>>(std::move(bytes));
+		return load(owned->data(), owned->size(), owned, opts);
+	}
+
+	// a bundle in a caller's 8-byte aligned buffer, which must outlive every program from it
+	static result view(const void *data, std::size_t size, const bundle_options &opts = bundle_options{}) {
+		return load(static_cast<const std::uint8_t *>(data), size, nullptr, opts);
+	}
+
+	std::size_t size() const { return entries_.size(); }
+	bool is_multi(std::size_t i) const { return entries_[i].multi; }
+	// entry i; expr(i) of a compile_many entry (or multi(i) of a single one) is empty
+	const compiled_expr &expr(std::size_t i) const { return entries_[i].e; }
+	const compiled_multi_expr &multi(std::size_t i) const { return entries_[i].m; }
+
+	// the single-expression entry saved from exactly src, or nullptr
+	const compiled_expr *find(std::string_view src) const {
+		auto range = by_hash_.equal_range(source_hash(src));
+		for (auto it = range.first; it != range.second; ++it) {
+			const compiled_expr &e = entries_[it->second].e;
+			if (e.expr() == src) return &e;
+		}
+		return nullptr;
+	}
+
+private:
+	struct entry {
+		compiled_expr e;
+		compiled_multi_expr m;
+		bool multi = false;
+	};
+	std::vector<entry> entries_;
+	std::unordered_multimap<std::uint64_t, std::size_t> by_hash_;
+
+	static result load(const std::uint8_t *data, std::size_t size, std::shared_ptr<const void> backing,
+	                   const bundle_options &opts) {
+		std::size_t count = 0;
+		if (auto err = detail::program_io::read_header(data, size, count)) return {expr_bundle{}, std::move(err)};
+		expr_bundle b;
+		b.entries_.resize(count);
+		for (std::size_t i = 0; i < count; ++i) {
+			std::shared_ptr<detail::program_io::program> p;
+			if (auto err = detail::program_io::read_entry(data, size, i, backing, opts.jit, p)) return {expr_bundle{}, std::move(err)};
+			entry &e = b.entries_[i];
+			e.multi = p->multi;
+			if (e.multi) {
+				e.m = detail::program_io::make_multi(std::move(p));
+			} else {
+				b.by_hash_.emplace(source_hash(p->expr), i);
+				e.e = detail::program_io::make_expr(std::move(p));
+			}
+		}
+		return {std::move(b), std::nullopt};
+	}
+};
+
+// save a single program as a one-entry bundle / load one back (copied out of data)
+inline std::vector<std::uint8_t> save(const compiled_expr &e) {
+	expr_bundle_writer w;
+	w.add(e);
+	return w.bytes();
+}
+
+inline std::pair<compiled_expr, std::optional<load_error>>
+load(const std::vector<std::uint8_t> &data, const bundle_options &opts = bundle_options{}) {
+	auto [b, err] = expr_bundle::from_bytes(data, opts);
+	if (err) return {compiled_expr{}, std::move(err)};
+	if (b.size() != 1 || b.is_multi(0)) {
+		return {compiled_expr{}, detail::program_io::error(load_errc::corrupt, "not a single-expression bundle")};
+	}
+	return {b.expr(0), std::nullopt};
+}
+
+} // namespace bbb
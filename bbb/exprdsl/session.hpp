@@ -0,0 +1,397 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "./exprdsl.hpp"
+#include "./parallel.hpp"
+
+namespace bbb {
+
+struct session_options {
+	// applies to every update(); jit, profile and tier_up do not (the session runs eval_batch).
+	// the session keeps copies of what vars, ranges and bound point to
+	compile_options compile;
+	// intermediate columns kept between updates, each rows() doubles; the result of the last
+	// update is one of them. at least 1
+	std::size_t max_columns = 8;
+	// threads and chunking of each evaluation; chunk_rows 0 means 4096
+	parallel_options parallel;
+};
+
+// what the last expr_session::update() did
+struct session_update {
+	bool hit = false;        // the whole expression was a cached column: nothing evaluated
+	std::size_t reused = 0;  // cached subtree columns read instead of recomputed
+	std::size_t stored = 0;  // new columns written besides the result
+};
+
+// live re-evaluation over one fixed dataset of an expression that keeps changing, e.g. a
+// preview recomputed on every keystroke. compiling takes microseconds; what costs is running
+// over millions of rows, so the session keeps the columns of subtrees it computed (the
+// result and the operands of the top-level operation) and the next update reads them back
+// wherever the new expression contains the same subtree: appending "+ z" to the last
+// expression evaluates one addition per row, editing one operand reuses the others, and
+// undoing an edit evaluates nothing. subtrees are compared after binding and constant
+// folding, so "x * (1 + 1)" matches "x * 2". the values equal eval_batch on the same
+// expression but for fast_math, where the contraction across a reused subtree can round
+// differently. the least recently used columns go past session_options::max_columns.
+// one thread at a time; columns must stay valid and unmodified while the session lives.
+class expr_session {
+public:
+	// columns as for compiled_expr::eval_batch(x, y, z, w, out, n)
+	expr_session(const double *x, const double *y, const double *z, const double *w, std::size_t n,
+	             const session_options &opts = session_options{})
+		: expr_session(std::vector<const double *>{x, y, z, w}, n, opts) {}
+
+	// columns[s] is record slot s (see compile_options::vars); a null or missing column reads 0
+	expr_session(std::vector<const double *> columns, std::size_t n, const session_options &opts = session_options{})
+		: cols_(std::move(columns)), n_(n), opts_(opts) {
+		opts_.compile.jit = false;
+		opts_.compile.profile = false;
+		opts_.compile.tier_up = 0;
+		opts_.max_columns = std::max<std::size_t>(opts_.max_columns, 1);
+		const std::size_t slots = opts.compile.vars ? opts.compile.vars->record_size() : 4;
+		if (cols_.size() < slots) cols_.resize(slots, nullptr);
+		if (opts_.compile.vars) opts_.compile.vars = &(schema_base_ = *opts_.compile.vars);
+		else schema_base_.add("x", 0).add("y", 1).add("z", 2).add("w", 3);
+		if (opts_.compile.ranges) opts_.compile.ranges = &(ranges_ = *opts_.compile.ranges);
+		if (opts_.compile.bound) opts_.compile.bound = &(bound_ = *opts_.compile.bound);
+	}
+
+	expr_session(const expr_session &) = delete;
+	expr_session &operator=(const expr_session &) = delete;
+
+	// compiles src and evaluates it over every row into out(). a compile error is returned as
+	// compile() would and leaves out() as it was.
+	std::optional<compile_error> update(std::string_view src);
+
+	// rows() results of the last successful update; null before the first one. valid until
+	// the next update() or clear()
+	const double *out() const { return out_; }
+	std::size_t rows() const { return n_; }
+	const session_update &last_update() const { return last_; }
+	std::size_t cached_columns() const { return cache_.size(); }
+
+	// forgets every cached column and subtree; out() becomes null
+	void clear() {
+		for (auto &c : cache_) free_.push_back(std::move(c.second.data));
+		cache_.clear();
+		ids_.clear();
+		out_ = nullptr;
+	}
+
+private:
+	struct column {
+		std::unique_ptr<double[]> data; // rows() doubles
+		std::uint64_t used = 0; // update that last read or wrote it
+	};
+
+	std::vector<const double *> cols_; // record slots; cached columns follow in each update
+	std::size_t n_;
+	session_options opts_; // compile.vars, ranges and bound point to the copies below
+	var_schema schema_base_;
+	range_hints ranges_;
+	var_bindings bound_;
+	compile_context ctx_;
+
+	// structural key of a subtree (its kind, operator and operand ids) -> subtree id; equal
+	// ids mean equal values on every row
+	std::unordered_map<std::string, std::uint32_t> ids_;
+	std::unordered_map<std::uint32_t, column> cache_;
+	std::vector<std::unique_ptr<double[]>> free_; // evicted buffers, reused before allocating
+	std::uint64_t generation_ = 0;
+	const double *out_ = nullptr;
+	session_update last_;
+
+	// per update: ids of the cached columns read, in slot order past cols_
+	std::vector<std::uint32_t> reads_;
+	std::string key_;
+
+	// a subtree table this large is dropped with the cache rather than kept growing
+	static constexpr std::size_t max_ids = std::size_t(1) << 16;
+
+	static bool is_leaf(const detail::node *n) {
+		return n->kind == detail::node_kind::num || n->kind == detail::node_kind::var;
+	}
+
+	template <class V>
+	void put(const V &v) {
+		key_.append(reinterpret_cast<const char *>(&v), sizeof v);
+	}
+
+	// numbers n and its subtrees bottom-up into node::id (cse_pass renumbers later)
+	std::uint32_t number(detail::node *n) {
+		using detail::node_kind;
+		std::uint32_t kids[3] = {0, 0, 0};
+		switch (n->kind) {
+			case node_kind::unary: kids[0] = number(static_cast<detail::unary_node *>(n)->a); break;
+			case node_kind::binary: {
+				auto p = static_cast<detail::binary_node *>(n);
+				kids[0] = number(p->l);
+				kids[1] = number(p->r);
+				break;
+			}
+			case node_kind::ternary: {
+				auto p = static_cast<detail::ternary_node *>(n);
+				kids[0] = number(p->c);
+				kids[1] = number(p->t);
+				kids[2] = number(p->f);
+				break;
+			}
+			case node_kind::call: {
+				auto p = static_cast<detail::call_node *>(n);
+				for (int i = 0; i < p->argc; ++i) kids[i] = number(p->args[i]);
+				break;
+			}
+			default: break;
+		}
+		key_.clear();
+		put(n->kind);
+		switch (n->kind) {
+			case node_kind::num: put(static_cast<detail::num_node *>(n)->n); break;
+			case node_kind::var: put(static_cast<detail::var_node *>(n)->index); break;
+			case node_kind::unary: put(static_cast<detail::unary_node *>(n)->op); put(kids[0]); break;
+			case node_kind::binary: put(static_cast<detail::binary_node *>(n)->op); put(kids[0]); put(kids[1]); break;
+			case node_kind::ternary: put(kids); break;
+			case node_kind::call: {
+				auto p = static_cast<detail::call_node *>(n);
+				put(p->fid);
+				put(p->argc);
+				put(kids[0]);
+				put(kids[1]);
+				break;
+			}
+			default: break; // fma, shared and ref come from later passes
+		}
+		auto it = ids_.emplace(key_, static_cast<std::uint32_t>(ids_.size())).first;
+		return n->id = it->second;
+	}
+
+	detail::node *slot_var(std::size_t slot, std::size_t pos) {
+		return ctx_.arena_.make<detail::var_node>(static_cast<int>(slot), pos);
+	}
+
+	// n with every maximal subtree found in the cache read from its column instead
+	detail::node *reuse(detail::node *n) {
+		using detail::node_kind;
+		if (is_leaf(n)) return n;
+		auto hit = cache_.find(n->id);
+		if (hit != cache_.end()) {
+			hit->second.used = generation_;
+			auto at = std::find(reads_.begin(), reads_.end(), n->id);
+			if (at == reads_.end()) at = reads_.insert(reads_.end(), n->id);
+			return slot_var(cols_.size() + static_cast<std::size_t>(at - reads_.begin()), n->pos);
+		}
+		switch (n->kind) {
+			case node_kind::unary: {
+				auto p = static_cast<detail::unary_node *>(n);
+				p->a = reuse(p->a);
+				break;
+			}
+			case node_kind::binary: {
+				auto p = static_cast<detail::binary_node *>(n);
+				p->l = reuse(p->l);
+				p->r = reuse(p->r);
+				break;
+			}
+			case node_kind::ternary: {
+				auto p = static_cast<detail::ternary_node *>(n);
+				p->c = reuse(p->c);
+				p->t = reuse(p->t);
+				p->f = reuse(p->f);
+				break;
+			}
+			case node_kind::call: {
+				auto p = static_cast<detail::call_node *>(n);
+				for (int i = 0; i < p->argc; ++i) p->args[i] = reuse(p->args[i]);
+				break;
+			}
+			default: break;
+		}
+		return n;
+	}
+
+	// the operand slots of the top-level operation
+	static std::size_t operands(detail::node *n, detail::node **out[3]) {
+		using detail::node_kind;
+		switch (n->kind) {
+			case node_kind::unary: out[0] = &static_cast<detail::unary_node *>(n)->a; return 1;
+			case node_kind::binary: {
+				auto p = static_cast<detail::binary_node *>(n);
+				out[0] = &p->l;
+				out[1] = &p->r;
+				return 2;
+			}
+			case node_kind::ternary: {
+				auto p = static_cast<detail::ternary_node *>(n);
+				out[0] = &p->c;
+				out[1] = &p->t;
+				out[2] = &p->f;
+				return 3;
+			}
+			case node_kind::call: {
+				auto p = static_cast<detail::call_node *>(n);
+				for (int i = 0; i < p->argc; ++i) out[i] = &p->args[i];
+				return static_cast<std::size_t>(p->argc);
+			}
+			default: return 0;
+		}
+	}
+
+	// drops least recently used columns not read by this update until `more` fit
+	bool make_room(std::size_t more) {
+		while (cache_.size() + more > opts_.max_columns) {
+			auto victim = cache_.end();
+			for (auto it = cache_.begin(); it != cache_.end(); ++it) {
+				if (it->second.used == generation_) continue;
+				if (victim == cache_.end() || it->second.used < victim->second.used) victim = it;
+			}
+			if (victim == cache_.end()) return false;
+			free_.push_back(std::move(victim->second.data));
+			cache_.erase(victim);
+		}
+		return true;
+	}
+
+	// uninitialized: every row is written before it is read
+	std::unique_ptr<double[]> take_buffer() {
+		if (free_.empty()) return std::unique_ptr<double[]>(new double[n_]);
+		std::unique_ptr<double[]> b = std::move(free_.back());
+		free_.pop_back();
+		return b;
+	}
+
+	compiled_multi_expr build(std::vector<detail::node *> roots, const compile_options &opts) {
+		ctx_.cse_.reset();
+		ctx_.bc_.reset();
+		if (opts.fast_math) {
+			for (detail::node *&r : roots) r = detail::fold_constants(ctx_.fast_.run(r, ctx_.arena_), ctx_.arena_);
+		}
+		ctx_.roots_ = std::move(roots);
+		return compiled_multi_expr::build(ctx_, std::vector<std::string>(ctx_.roots_.size()), opts);
+	}
+
+	void evaluate(const compiled_multi_expr &parts, const compiled_multi_expr &result,
+	              const std::vector<const double *> &cols, const std::vector<double *> &stored, double *out);
+};
+
+inline std::optional<compile_error> expr_session::update(std::string_view src) {
+	const compile_options &copts = opts_.compile;
+	ctx_.arena_.reset();
+	try {
+		detail::parse_error e = detail::front_end::begin(ctx_, copts);
+		if (e) return e.to_compile_error();
+		detail::node *ast = detail::front_end::parse(ctx_, src, copts, e);
+		if (!ast) return e.to_compile_error();
+		ast = detail::front_end::lower(ctx_, ast, copts);
+
+		if (ids_.size() > max_ids) clear();
+		++generation_;
+		last_ = session_update{};
+		const std::uint32_t root_id = number(ast);
+		auto hit = cache_.find(root_id);
+		if (hit != cache_.end()) {
+			hit->second.used = generation_;
+			out_ = hit->second.data.get();
+			last_.hit = true;
+			return std::nullopt;
+		}
+
+		reads_.clear();
+		detail::node *root = reuse(ast);
+		last_.reused = reads_.size();
+
+		// the result, then as many non-leaf operands as fit: the next edit likely keeps some
+		detail::node **ops[3];
+		const std::size_t n_ops = is_leaf(root) ? 0 : operands(root, ops);
+		std::vector<detail::node **> store;
+		for (std::size_t i = 0; i < n_ops; ++i) {
+			const std::uint32_t id = (*ops[i])->id;
+			if (is_leaf(*ops[i]) || cache_.count(id)) continue;
+			if (std::none_of(store.begin(), store.end(), [&](detail::node **s) { return (*s)->id == id; })) store.push_back(ops[i]);
+		}
+		while (!make_room(1 + store.size())) {
+			if (store.empty()) break; // every cached column is read: go past max_columns
+			store.pop_back();
+		}
+
+		// slots: the record, the cached columns read, the operands stored now
+		std::vector<const double *> cols = cols_;
+		for (std::uint32_t id : reads_) cols.push_back(cache_[id].data.get());
+		std::vector<detail::node *> parts;
+		std::vector<std::uint32_t> part_ids;
+		std::vector<std::unique_ptr<double[]>> bufs;
+		for (detail::node **op : store) {
+			part_ids.push_back((*op)->id);
+			parts.push_back(*op);
+			*op = slot_var(cols.size(), (*op)->pos);
+			bufs.push_back(take_buffer());
+			cols.push_back(bufs.back().get());
+		}
+		std::unique_ptr<double[]> result = take_buffer();
+
+		var_schema schema = schema_base_;
+		for (std::size_t s = cols_.size(); s < cols.size(); ++s) schema.add("$" + std::to_string(s), s);
+		compile_options o = copts;
+		o.vars = &schema;
+		o.ranges = nullptr; // applied above
+		o.bound = nullptr;
+		const compiled_multi_expr part_prog = build(std::move(parts), o);
+		const compiled_multi_expr result_prog = build({root}, o);
+
+		std::vector<double *> stored;
+		for (std::unique_ptr<double[]> &b : bufs) stored.push_back(b.get());
+		evaluate(part_prog, result_prog, cols, stored, result.get());
+
+		for (std::size_t i = 0; i < bufs.size(); ++i) cache_[part_ids[i]] = column{std::move(bufs[i]), generation_};
+		last_.stored = bufs.size();
+		column &c = cache_[root_id];
+		c = column{std::move(result), generation_};
+		out_ = c.data.get();
+		return std::nullopt;
+	} catch (...) { // nothing above throws but std::bad_alloc
+		clear();
+		return compile_error{0, "Unknown error", compile_errc::internal};
+	}
+}
+
+inline void expr_session::evaluate(const compiled_multi_expr &parts, const compiled_multi_expr &result,
+                                   const std::vector<const double *> &cols, const std::vector<double *> &stored,
+                                   double *out) {
+	const std::size_t block = compiled_expr::batch_block;
+	std::size_t chunk = opts_.parallel.chunk_rows ? opts_.parallel.chunk_rows : 4096;
+	chunk = std::max<std::size_t>((chunk + block - 1) / block * block, block);
+	chunk = std::max<std::size_t>(chunk, n_ / 0xffffffffu + 1); // as parallel_rows settles it
+	parallel_options popts = opts_.parallel;
+	popts.chunk_rows = chunk;
+
+	const std::size_t k = stored.size();
+	const std::size_t lanes = std::max(parts.batch_scratch_size(), result.batch_scratch_size());
+	const std::size_t scratch_size = lanes + chunk * k;
+	const std::size_t row_bytes = 8 * (cols.size() + k + 1);
+	detail::parallel_rows(n_, row_bytes, scratch_size, popts, [&](std::size_t begin, std::size_t count, double *scratch) {
+		std::vector<const double *> at(cols.size());
+		for (std::size_t s = 0; s < cols.size(); ++s) at[s] = cols[s] ? cols[s] + begin : nullptr;
+		if (k) {
+			// the operands of this chunk, row-major, into their columns
+			double *rows = scratch + lanes;
+			parts.e_.run_batch<double>(compiled_expr::batch_input{at.data(), nullptr, 0, rows, k}, nullptr, count, scratch);
+			for (std::size_t j = 0; j < k; ++j) {
+				double *dst = stored[j] + begin;
+				for (std::size_t i = 0; i < count; ++i) dst[i] = rows[i * k + j];
+			}
+		}
+		result.e_.run_batch<double>(compiled_expr::batch_input{at.data(), nullptr, 0, out + begin, 1}, nullptr, count, scratch);
+	});
+}
+
+} // namespace bbb
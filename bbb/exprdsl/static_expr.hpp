@@ -0,0 +1,680 @@
+#pragma once
+
+// compile-time compilation of string literals: bbb::static_expr<"x*x + sin(y)">.
+// needs C++20 (class types as template parameters, std::bit_cast).
+#if __cplusplus >= 202002L && defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "./exprdsl.hpp"
+
+namespace bbb {
+namespace detail {
+
+// string literal usable as a template argument
+template <std::size_t N>
+struct fixed_string {
+	char s[N] = {};
+
+	constexpr fixed_string(const char (&a)[N]) {
+		for (std::size_t i = 0; i < N; ++i) s[i] = a[i];
+	}
+	constexpr std::string_view view() const { return std::string_view(s, N - 1); }
+};
+
+// compile_error::message, truncated to a fixed buffer so it can be a template argument
+struct static_message {
+	char s[96] = {};
+
+	constexpr void append(std::string_view v) {
+		std::size_t n = 0;
+		while (n < sizeof s - 1 && s[n]) ++n;
+		for (char c : v) {
+			if (n >= sizeof s - 1) break;
+			s[n++] = c;
+		}
+	}
+	constexpr void append(std::size_t v) {
+		char buf[24] = {};
+		std::size_t n = 0;
+		do { buf[n++] = static_cast<char>('0' + v % 10); v /= 10; } while (v);
+		char rev[24] = {};
+		for (std::size_t i = 0; i < n; ++i) rev[i] = buf[n - 1 - i];
+		append(std::string_view(rev, n));
+	}
+};
+
+// ---------- correctly rounded decimal -> double, like std::strtod ----------
+
+// unsigned big integer, enough bits for the scaled operands of decimal_to_double
+struct static_bigint {
+	static constexpr std::size_t limbs = 136; // 4352 bits
+	std::uint32_t d[limbs] = {};
+	std::size_t n = 0; // used limbs, no leading zero limb
+
+	constexpr void trim() { while (n && d[n - 1] == 0) --n; }
+	constexpr void mul_add(std::uint32_t m, std::uint32_t a) {
+		std::uint64_t carry = a;
+		for (std::size_t i = 0; i < n; ++i) {
+			const std::uint64_t t = std::uint64_t(d[i]) * m + carry;
+			d[i] = static_cast<std::uint32_t>(t);
+			carry = t >> 32;
+		}
+		if (carry) d[n++] = static_cast<std::uint32_t>(carry);
+	}
+	constexpr void mul_pow10(std::size_t k) {
+		for (; k >= 9; k -= 9) mul_add(1000000000u, 0);
+		std::uint32_t m = 1;
+		for (; k; --k) m *= 10;
+		mul_add(m, 0);
+	}
+	constexpr void shl(std::size_t k) {
+		const std::size_t w = k / 32, b = k % 32;
+		if (!n) return;
+		for (std::size_t i = n + w + 1; i-- > 0;) {
+			std::uint32_t v = 0;
+			if (i >= w) {
+				const std::size_t j = i - w;
+				if (j < n) v = d[j] << b;
+				if (b && j >= 1 && j - 1 < n) v |= d[j - 1] >> (32 - b);
+			}
+			d[i] = v;
+		}
+		n += w + 1;
+		trim();
+	}
+	constexpr void shr1() {
+		for (std::size_t i = 0; i < n; ++i) d[i] = (d[i] >> 1) | (i + 1 < n ? d[i + 1] << 31 : 0);
+		trim();
+	}
+	constexpr std::size_t bits() const {
+		if (!n) return 0;
+		return 32 * (n - 1) + static_cast<std::size_t>(std::bit_width(d[n - 1]));
+	}
+	constexpr int compare(const static_bigint &o) const {
+		if (n != o.n) return n < o.n ? -1 : 1;
+		for (std::size_t i = n; i-- > 0;) {
+			if (d[i] != o.d[i]) return d[i] < o.d[i] ? -1 : 1;
+		}
+		return 0;
+	}
+	constexpr void sub(const static_bigint &o) { // requires *this >= o
+		std::int64_t borrow = 0;
+		for (std::size_t i = 0; i < n; ++i) {
+			std::int64_t t = std::int64_t(d[i]) - (i < o.n ? o.d[i] : 0) - borrow;
+			borrow = t < 0;
+			d[i] = static_cast<std::uint32_t>(t + (borrow << 32));
+		}
+		trim();
+	}
+};
+
+// digits: the significant decimal digits without leading zeros, value = digits * 10^exp10
+constexpr double decimal_to_double(const char *digits, std::size_t nd, long exp10) {
+	if (nd == 0) return 0.0;
+	const long mag = static_cast<long>(nd) + exp10; // value < 10^mag
+	if (mag > 310) return std::bit_cast<double>(std::uint64_t(0x7ff0000000000000ull));
+	if (mag < -330) return 0.0;
+
+	// Clinger's fast path: both operands exact, one rounding
+	if (nd <= 15 && -22 <= exp10 && exp10 <= 22) {
+		double m = 0.0;
+		for (std::size_t i = 0; i < nd; ++i) m = m * 10 + (digits[i] - '0');
+		double p = 1.0;
+		for (long i = 0; i < (exp10 < 0 ? -exp10 : exp10); ++i) p *= 10;
+		return exp10 < 0 ? m / p : m * p;
+	}
+
+	// exact: value = u / v, scaled by 2^e until 2^52 <= u / v < 2^53, then rounded
+	static_bigint u, v;
+	v.d[0] = 1;
+	v.n = 1;
+	for (std::size_t i = 0; i < nd; ++i) u.mul_add(10, static_cast<std::uint32_t>(digits[i] - '0'));
+	if (exp10 >= 0) u.mul_pow10(static_cast<std::size_t>(exp10));
+	else v.mul_pow10(static_cast<std::size_t>(-exp10));
+
+	long e = static_cast<long>(u.bits()) - static_cast<long>(v.bits()) - 53;
+	if (e > 0) v.shl(static_cast<std::size_t>(e));
+	else u.shl(static_cast<std::size_t>(-e));
+	for (;;) {
+		static_bigint lo = v, hi = v;
+		lo.shl(52);
+		hi.shl(53);
+		if (u.compare(lo) < 0) { u.shl(1); --e; }
+		else if (u.compare(hi) >= 0) { v.shl(1); ++e; }
+		else break;
+	}
+	if (e < -1074) { // subnormal: fix the exponent, the quotient loses bits
+		v.shl(static_cast<std::size_t>(-1074 - e));
+		e = -1074;
+	}
+
+	std::uint64_t q = 0;
+	static_bigint vs = v;
+	vs.shl(53);
+	for (int bit = 53; bit >= 0; --bit) {
+		if (u.compare(vs) >= 0) {
+			u.sub(vs);
+			q |= std::uint64_t(1) << bit;
+		}
+		vs.shr1();
+	}
+	static_bigint twice = u; // remainder * 2 against v: round to nearest, ties to even
+	twice.shl(1);
+	const int c = twice.compare(v);
+	if (c > 0 || (c == 0 && (q & 1))) ++q;
+	if (q == (std::uint64_t(1) << 53)) { q >>= 1; ++e; }
+	if (e + 52 > 1023) return std::bit_cast<double>(std::uint64_t(0x7ff0000000000000ull));
+	if (q < (std::uint64_t(1) << 52)) return std::bit_cast<double>(q); // subnormal, e == -1074
+	const std::uint64_t biased = static_cast<std::uint64_t>(e + 52 + 1023);
+	return std::bit_cast<double>((biased << 52) | (q & ((std::uint64_t(1) << 52) - 1)));
+}
+
+// the lexer's number syntax: digits [. digits] [e [+-] digits]
+constexpr double parse_decimal(std::string_view s) {
+	// significant digits beyond this decide nothing but a sticky nonzero bit
+	constexpr std::size_t max_digits = 800;
+	char digits[max_digits + 1] = {};
+	std::size_t nd = 0;
+	long exp10 = 0;
+	bool sticky = false;
+	std::size_t i = 0;
+	bool in_frac = false;
+	for (; i < s.size() && ((s[i] >= '0' && s[i] <= '9') || s[i] == '.'); ++i) {
+		if (s[i] == '.') { in_frac = true; continue; }
+		if (nd == 0 && s[i] == '0') {
+			if (in_frac) --exp10;
+			continue;
+		}
+		if (nd < max_digits) {
+			digits[nd++] = s[i];
+			if (in_frac) --exp10;
+		} else {
+			if (s[i] != '0') sticky = true;
+			if (!in_frac) ++exp10;
+		}
+	}
+	if (i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+		++i;
+		bool neg = false;
+		if (i < s.size() && (s[i] == '+' || s[i] == '-')) neg = s[i++] == '-';
+		long x = 0;
+		for (; i < s.size(); ++i) {
+			if (x < 100000) x = x * 10 + (s[i] - '0');
+		}
+		exp10 += neg ? -x : x;
+	}
+	if (sticky) { // exactly between the truncation and the next digit string
+		digits[nd++] = '1';
+		--exp10;
+	}
+	return decimal_to_double(digits, nd, exp10);
+}
+
+// ---------- parser (same grammar, positions and messages as detail::parser) ----------
+
+enum class snode_kind : std::uint8_t { num, var, plus, minus, logical_not, binary, ternary, call };
+
+// operators of snode_kind::binary, in bin_op order
+enum class sbin : std::uint8_t { add, sub, mul, div_, mod, pow, lt, le, gt, ge, eq, ne, and_and, or_or };
+
+struct snode {
+	snode_kind kind = snode_kind::num;
+	sbin op = sbin::add;
+	int index = 0;        // variable index / function id
+	int a = -1, b = -1, c = -1; // children in the pool
+	double num = 0.0;
+};
+
+template <std::size_t N>
+struct static_program {
+	std::array<snode, N> nodes{};
+	int size = 0;
+	int root = -1;
+	bool ok = false;
+	std::size_t error_pos = 0;
+	static_message error;
+};
+
+template <std::size_t N>
+class static_parser {
+public:
+	explicit constexpr static_parser(std::string_view s) : src_(s) {}
+
+	constexpr static_program<N> parse_all() {
+		const int n = parse_expr();
+		if (!failed_ && peek().kind != tk::end) fail(peek().pos, "Unexpected token after end of expression");
+		prog_.root = n;
+		prog_.ok = !failed_;
+		return prog_;
+	}
+
+private:
+	enum class tk : std::uint8_t {
+		end, number, ident, var, lparen, rparen, comma,
+		plus, minus, star, slash, percent, caret, bang,
+		less, less_eq, greater, greater_eq, eq_eq, bang_eq, and_and, or_or,
+		question, colon
+	};
+	struct token {
+		tk kind = tk::end;
+		std::size_t pos = 0;
+		double number = 0.0;
+		int var_index = -1;
+		std::string_view ident;
+	};
+
+	std::string_view src_;
+	std::size_t i_ = 0;
+	bool has_peek_ = false;
+	token peek_tok_{};
+	bool failed_ = false;
+	static_program<N> prog_{};
+
+	// first error wins; afterwards every step just unwinds
+	constexpr void fail(std::size_t pos, std::string_view msg) {
+		if (failed_) return;
+		failed_ = true;
+		prog_.error_pos = pos;
+		prog_.error.append(msg);
+	}
+	// lexer errors carry no position in compile_error either
+	constexpr token lex_fail(std::string_view msg) {
+		fail(0, msg);
+		return token{};
+	}
+
+	static constexpr bool is_digit(char c) { return c >= '0' && c <= '9'; }
+	static constexpr bool is_alpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+	static constexpr bool is_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+	constexpr const token &peek() {
+		if (!has_peek_) { peek_tok_ = next_impl(); has_peek_ = true; }
+		return peek_tok_;
+	}
+	constexpr token next() {
+		if (has_peek_) { has_peek_ = false; return peek_tok_; }
+		return next_impl();
+	}
+
+	constexpr token next_impl() {
+		while (i_ < src_.size() && is_space(src_[i_])) ++i_;
+		token t;
+		t.pos = i_;
+		if (failed_ || i_ >= src_.size()) return t;
+		const char c = src_[i_];
+
+		auto match2 = [&](char a, char b) { return i_ + 1 < src_.size() && src_[i_] == a && src_[i_ + 1] == b; };
+		auto two = [&](tk k) { i_ += 2; t.kind = k; return t; };
+		auto one = [&](tk k) { ++i_; t.kind = k; return t; };
+
+		if (match2('&', '&')) return two(tk::and_and);
+		if (match2('|', '|')) return two(tk::or_or);
+		if (match2('=', '=')) return two(tk::eq_eq);
+		if (match2('!', '=')) return two(tk::bang_eq);
+		if (match2('<', '=')) return two(tk::less_eq);
+		if (match2('>', '=')) return two(tk::greater_eq);
+
+		switch (c) {
+			case '(': return one(tk::lparen);
+			case ')': return one(tk::rparen);
+			case ',': return one(tk::comma);
+			case '+': return one(tk::plus);
+			case '-': return one(tk::minus);
+			case '*': return one(tk::star);
+			case '/': return one(tk::slash);
+			case '%': return one(tk::percent);
+			case '^': return one(tk::caret);
+			case '!': return one(tk::bang);
+			case '<': return one(tk::less);
+			case '>': return one(tk::greater);
+			case '?': return one(tk::question);
+			case ':': return one(tk::colon);
+			default: break;
+		}
+
+		if (c == '$') {
+			++i_;
+			if (i_ >= src_.size() || !is_digit(src_[i_])) return lex_fail("Expected digit after '$'");
+			int n = 0;
+			while (i_ < src_.size() && is_digit(src_[i_])) {
+				if (n < 100) n = n * 10 + (src_[i_] - '0');
+				++i_;
+			}
+			if (n < 1 || 4 < n) return lex_fail("Variable index after '$' must be 1..4");
+			t.kind = tk::var;
+			t.var_index = n - 1;
+			return t;
+		}
+
+		if (c == 'x' || c == 'y' || c == 'z' || c == 'w') {
+			++i_;
+			t.kind = tk::var;
+			t.var_index = (c == 'x') ? 0 : (c == 'y') ? 1 : (c == 'z') ? 2 : 3;
+			return t;
+		}
+
+		if (is_alpha(c) || c == '_') {
+			const std::size_t start = i_++;
+			while (i_ < src_.size() && (is_alpha(src_[i_]) || is_digit(src_[i_]) || src_[i_] == '_')) ++i_;
+			t.kind = tk::ident;
+			t.ident = src_.substr(start, i_ - start);
+			return t;
+		}
+
+		if (is_digit(c) || c == '.') {
+			const std::size_t start = i_;
+			bool saw_digit = false;
+			if (c == '.') {
+				++i_;
+				while (i_ < src_.size() && is_digit(src_[i_])) { ++i_; saw_digit = true; }
+				if (!saw_digit) return lex_fail("Invalid number literal");
+			} else {
+				while (i_ < src_.size() && is_digit(src_[i_])) ++i_;
+				if (i_ < src_.size() && src_[i_] == '.') {
+					++i_;
+					while (i_ < src_.size() && is_digit(src_[i_])) ++i_;
+				}
+			}
+			if (i_ < src_.size() && (src_[i_] == 'e' || src_[i_] == 'E')) {
+				const std::size_t epos = i_++;
+				if (i_ < src_.size() && (src_[i_] == '+' || src_[i_] == '-')) ++i_;
+				if (i_ >= src_.size() || !is_digit(src_[i_])) i_ = epos;
+				else while (i_ < src_.size() && is_digit(src_[i_])) ++i_;
+			}
+			t.kind = tk::number;
+			t.number = parse_decimal(src_.substr(start, i_ - start));
+			return t;
+		}
+
+		return lex_fail("Unexpected character");
+	}
+
+	constexpr bool accept(tk k) {
+		if (peek().kind == k) { next(); return true; }
+		return false;
+	}
+	constexpr void expect(tk k, std::string_view what) {
+		const token t = next();
+		if (t.kind != k) {
+			static_message m;
+			m.append("Expected ");
+			m.append(what);
+			fail(t.pos, std::string_view(m.s));
+		}
+	}
+
+	constexpr int add(snode n) {
+		if (failed_) return -1;
+		prog_.nodes[static_cast<std::size_t>(prog_.size)] = n;
+		return prog_.size++;
+	}
+	constexpr int binary(sbin op, int l, int r) {
+		snode n;
+		n.kind = snode_kind::binary;
+		n.op = op;
+		n.a = l;
+		n.b = r;
+		return add(n);
+	}
+	constexpr int unary(snode_kind k, int a) {
+		snode n;
+		n.kind = k;
+		n.a = a;
+		return add(n);
+	}
+
+	constexpr int parse_expr() { return parse_conditional(); }
+
+	constexpr int parse_conditional() {
+		const int c = parse_logical_or();
+		if (!failed_ && accept(tk::question)) {
+			const int t = parse_expr();
+			if (!failed_) expect(tk::colon, "':' in conditional operator");
+			const int f = failed_ ? -1 : parse_conditional();
+			snode n;
+			n.kind = snode_kind::ternary;
+			n.a = c;
+			n.b = t;
+			n.c = f;
+			return add(n);
+		}
+		return c;
+	}
+
+	// one left-associative precedence level: ops[i] parses into bins[i]
+	template <std::size_t K, class Next>
+	constexpr int left_assoc(const tk (&ops)[K], const sbin (&bins)[K], Next next_level) {
+		int n = next_level();
+		while (!failed_) {
+			std::size_t i = 0;
+			while (i < K && !accept(ops[i])) ++i;
+			if (i == K || failed_) break;
+			const int r = next_level();
+			n = binary(bins[i], n, r);
+		}
+		return n;
+	}
+
+	constexpr int parse_logical_or() {
+		return left_assoc({tk::or_or}, {sbin::or_or}, [this] { return parse_logical_and(); });
+	}
+	constexpr int parse_logical_and() {
+		return left_assoc({tk::and_and}, {sbin::and_and}, [this] { return parse_equality(); });
+	}
+	constexpr int parse_equality() {
+		return left_assoc({tk::eq_eq, tk::bang_eq}, {sbin::eq, sbin::ne}, [this] { return parse_relational(); });
+	}
+	constexpr int parse_relational() {
+		return left_assoc({tk::less, tk::less_eq, tk::greater, tk::greater_eq}, {sbin::lt, sbin::le, sbin::gt, sbin::ge},
+		                  [this] { return parse_additive(); });
+	}
+	constexpr int parse_additive() {
+		return left_assoc({tk::plus, tk::minus}, {sbin::add, sbin::sub}, [this] { return parse_multiplicative(); });
+	}
+	constexpr int parse_multiplicative() {
+		return left_assoc({tk::star, tk::slash, tk::percent}, {sbin::mul, sbin::div_, sbin::mod}, [this] { return parse_unary(); });
+	}
+
+	constexpr int parse_unary() {
+		if (accept(tk::plus)) return unary(snode_kind::plus, parse_unary());
+		if (accept(tk::minus)) return unary(snode_kind::minus, parse_unary());
+		if (accept(tk::bang)) return unary(snode_kind::logical_not, parse_unary());
+		return parse_power();
+	}
+
+	constexpr int parse_power() {
+		const int n = parse_primary();
+		if (!failed_ && accept(tk::caret)) {
+			const int r = parse_unary();
+			return binary(sbin::pow, n, r);
+		}
+		return n;
+	}
+
+	constexpr int parse_primary() {
+		if (failed_) return -1;
+		const token t = peek();
+		switch (t.kind) {
+			case tk::number: {
+				next();
+				snode n;
+				n.kind = snode_kind::num;
+				n.num = t.number;
+				return add(n);
+			}
+			case tk::var: {
+				next();
+				snode n;
+				n.kind = snode_kind::var;
+				n.index = t.var_index;
+				return add(n);
+			}
+			case tk::ident: {
+				next();
+				if (!accept(tk::lparen)) {
+					fail(t.pos, "Identifier must be a function call like name(...)");
+					return -1;
+				}
+				const func_spec spec = find_func(t.ident); // the runtime parser's whitelist
+				if (spec.fid < 0) {
+					static_message m;
+					m.append("Unknown or disallowed function: ");
+					m.append(t.ident);
+					fail(t.pos, std::string_view(m.s));
+					return -1;
+				}
+
+				int args[2] = {-1, -1};
+				std::size_t argc = 0;
+				if (!accept(tk::rparen)) {
+					do {
+						const int a = parse_expr();
+						if (argc < 2) args[argc] = a;
+						++argc;
+					} while (!failed_ && accept(tk::comma));
+					if (!failed_) expect(tk::rparen, "')' to close function call");
+				}
+				if (failed_) return -1;
+				if (argc != static_cast<std::size_t>(spec.argc)) {
+					static_message m;
+					m.append("Function '");
+					m.append(t.ident);
+					m.append("' expects ");
+					m.append(static_cast<std::size_t>(spec.argc));
+					m.append(" args, got ");
+					m.append(argc);
+					fail(t.pos, std::string_view(m.s));
+					return -1;
+				}
+				snode n;
+				n.kind = snode_kind::call;
+				n.index = spec.fid;
+				n.a = args[0];
+				n.b = args[1];
+				return add(n);
+			}
+			case tk::lparen: {
+				next();
+				const int n = parse_expr();
+				if (!failed_) expect(tk::rparen, "')'");
+				return n;
+			}
+			default:
+				fail(t.pos, "Expected primary expression");
+				return -1;
+		}
+	}
+};
+
+template <std::size_t N>
+constexpr static_program<N> static_parse(std::string_view s) {
+	return static_parser<N>(s).parse_all();
+}
+
+// instantiated for every static_expr; an invalid expression fails here and the
+// diagnostic shows Pos (0-based, as in compile_error::pos) and Message
+template <bool Ok, std::size_t Pos, static_message Message>
+struct static_expr_check {
+	static_assert(Ok, "bbb::static_expr: invalid expression (see Pos and Message above)");
+	static constexpr bool value = true; // the assertion above is the one to report
+};
+
+} // namespace detail
+
+// an expression compiled by the C++ compiler: same grammar and results as compile(),
+// evaluated as straight-line inlined code
+template <detail::fixed_string Src>
+struct static_expr {
+	static constexpr std::string_view expr = Src.view();
+
+	constexpr double operator()(double x, double y, double z, double w) const {
+		if constexpr (program.ok) {
+			const double v[4] = {x, y, z, w};
+			return eval<program.root>(v);
+		} else {
+			return 0.0;
+		}
+	}
+
+private:
+	static constexpr auto program = detail::static_parse<sizeof(Src.s)>(Src.view());
+	static_assert(detail::static_expr_check<program.ok, program.error_pos, program.error>::value);
+
+	static constexpr double b2d(bool v) { return v ? 1.0 : 0.0; }
+	static constexpr bool truth(double v) { return v != 0.0; }
+
+	template <int I>
+	static constexpr double eval(const double *v) {
+		using detail::snode_kind;
+		using detail::sbin;
+		constexpr detail::snode n = program.nodes[static_cast<std::size_t>(I)];
+
+		if constexpr (n.kind == snode_kind::num) {
+			return n.num;
+		} else if constexpr (n.kind == snode_kind::var) {
+			return v[n.index];
+		} else if constexpr (n.kind == snode_kind::plus) {
+			return eval<n.a>(v);
+		} else if constexpr (n.kind == snode_kind::minus) {
+			return -eval<n.a>(v);
+		} else if constexpr (n.kind == snode_kind::logical_not) {
+			return b2d(!truth(eval<n.a>(v)));
+		} else if constexpr (n.kind == snode_kind::ternary) {
+			return truth(eval<n.a>(v)) ? eval<n.b>(v) : eval<n.c>(v);
+		} else if constexpr (n.kind == snode_kind::call) {
+			if constexpr (n.index == 17 || n.index == 18) {
+				const double a = eval<n.a>(v), b = eval<n.b>(v);
+				return n.index == 17 ? (a < b ? a : b) : (b < a ? a : b);
+			} else if constexpr (n.index >= 14) {
+				const double a = eval<n.a>(v), b = eval<n.b>(v);
+				if constexpr (n.index == 14) return std::pow(a, b);
+				else if constexpr (n.index == 15) return std::atan2(a, b);
+				else return std::fmod(a, b);
+			} else {
+				const double a = eval<n.a>(v);
+				if constexpr (n.index == 0) return std::sin(a);
+				else if constexpr (n.index == 1) return std::cos(a);
+				else if constexpr (n.index == 2) return std::tan(a);
+				else if constexpr (n.index == 3) return std::asin(a);
+				else if constexpr (n.index == 4) return std::acos(a);
+				else if constexpr (n.index == 5) return std::atan(a);
+				else if constexpr (n.index == 6) return std::exp(a);
+				else if constexpr (n.index == 7) return std::log(a);
+				else if constexpr (n.index == 8) return std::log10(a);
+				else if constexpr (n.index == 9) return std::sqrt(a);
+				else if constexpr (n.index == 10) return std::fabs(a);
+				else if constexpr (n.index == 11) return std::floor(a);
+				else if constexpr (n.index == 12) return std::ceil(a);
+				else return std::round(a);
+			}
+		} else if constexpr (n.op == sbin::and_and) {
+			return truth(eval<n.a>(v)) ? b2d(truth(eval<n.b>(v))) : 0.0;
+		} else if constexpr (n.op == sbin::or_or) {
+			return truth(eval<n.a>(v)) ? 1.0 : b2d(truth(eval<n.b>(v)));
+		} else {
+			const double a = eval<n.a>(v), b = eval<n.b>(v);
+			if constexpr (n.op == sbin::add) return a + b;
+			else if constexpr (n.op == sbin::sub) return a - b;
+			else if constexpr (n.op == sbin::mul) return a * b;
+			else if constexpr (n.op == sbin::div_) return a / b;
+			else if constexpr (n.op == sbin::mod) return std::fmod(a, b);
+			else if constexpr (n.op == sbin::pow) return std::pow(a, b);
+			else if constexpr (n.op == sbin::lt) return b2d(a < b);
+			else if constexpr (n.op == sbin::le) return b2d(a <= b);
+			else if constexpr (n.op == sbin::gt) return b2d(b < a);
+			else if constexpr (n.op == sbin::ge) return b2d(b <= a);
+			else if constexpr (n.op == sbin::eq) return b2d(a == b);
+			else return b2d(a != b);
+		}
+	}
+};
+
+} // namespace bbb
+
+#endif // C++20
@@ -0,0 +1,160 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "./exprdsl.hpp"
+
+namespace bbb {
+
+// evaluates an unbounded sequence of record chunks with buffers allocated once: a source
+// fills input chunks, eval_batch turns each into an output chunk, and a sink consumes it.
+// run() reads the next chunk on a second thread while the current one is evaluated (two
+// input buffers), so I/O and compute overlap; once both buffers are full the source waits
+// for the sink, and a sink returning false stops the stream. apart from run() starting its
+// reader thread nothing allocates, however many chunks pass through.
+// records are laid out as for eval_batch(records, out, n): record_stride() doubles each.
+class expr_stream {
+public:
+	// chunk_rows: rows per chunk, at least 1
+	explicit expr_stream(compiled_expr e, std::size_t chunk_rows = 4096)
+		: e_(std::move(e)), stride_(e_.record_stride()), outputs_(1) {
+		init(chunk_rows, e_.batch_scratch_size());
+	}
+	// every output of a compile_many program; an output chunk is rows x outputs() row-major
+	explicit expr_stream(compiled_multi_expr m, std::size_t chunk_rows = 4096)
+		: m_(std::move(m)), multi_(true), stride_(m_.record_stride()), outputs_(m_.size()) {
+		init(chunk_rows, m_.batch_scratch_size());
+	}
+
+	expr_stream(const expr_stream &) = delete;
+	expr_stream &operator=(const expr_stream &) = delete;
+
+	std::size_t chunk_rows() const { return chunk_rows_; }
+	std::size_t record_stride() const { return stride_; }
+	// doubles written per row
+	std::size_t outputs() const { return outputs_; }
+
+	// one chunk without the reader thread: evaluates the first min(rows, chunk_rows())
+	// records, as many as the output chunk holds, and returns it, valid until the next call
+	const double *eval(const double *records, std::size_t rows) {
+		eval_chunk(records, std::min(rows, chunk_rows_));
+		return out_.data();
+	}
+
+	// source(double *records, std::size_t max_rows) -> std::size_t writes up to max_rows
+	// records and returns how many; 0 ends the stream. it runs on the reader thread, one
+	// call at a time.
+	// sink(const double *out, std::size_t rows) -> bool gets each output chunk in order on
+	// the calling thread (valid during the call only); false stops the stream, after the
+	// source returns from a call in progress.
+	// returns the rows handed to the sink. an exception from either side stops the stream
+	// and is rethrown here.
+	template <class Source, class Sink>
+	std::size_t run(Source &&source, Sink &&sink) {
+		produced_ = consumed_ = 0;
+		stop_ = false;
+		std::exception_ptr failed;
+
+		std::thread reader([&] {
+			try {
+				for (;;) {
+					std::size_t slot;
+					{
+						std::unique_lock<std::mutex> lk(mutex_);
+						cv_.wait(lk, [&] { return stop_ || produced_ - consumed_ < 2; });
+						if (stop_) return;
+						slot = produced_ % 2;
+					}
+					const std::size_t rows = std::min<std::size_t>(source(in_[slot].data(), chunk_rows_), chunk_rows_);
+					{
+						std::lock_guard<std::mutex> lk(mutex_);
+						rows_[slot] = rows;
+						++produced_;
+					}
+					cv_.notify_all();
+					if (rows == 0) return;
+				}
+			} catch (...) {
+				std::lock_guard<std::mutex> lk(mutex_);
+				failed = std::current_exception();
+				stop_ = true;
+				cv_.notify_all();
+			}
+		});
+
+		std::size_t total = 0;
+		try {
+			for (;;) {
+				std::size_t slot;
+				{
+					std::unique_lock<std::mutex> lk(mutex_);
+					cv_.wait(lk, [&] { return stop_ || produced_ > consumed_; });
+					if (stop_) break; // the reader failed
+					slot = consumed_ % 2;
+				}
+				const std::size_t rows = rows_[slot];
+				if (rows == 0) break;
+				eval_chunk(in_[slot].data(), rows);
+				{
+					std::lock_guard<std::mutex> lk(mutex_);
+					++consumed_; // the input buffer is free again
+				}
+				cv_.notify_all();
+				total += rows;
+				if (!sink(static_cast<const double *>(out_.data()), rows)) break;
+			}
+		} catch (...) {
+			halt(reader);
+			throw;
+		}
+		halt(reader);
+		if (failed) std::rethrow_exception(failed);
+		return total;
+	}
+
+private:
+	compiled_expr e_;
+	compiled_multi_expr m_;
+	bool multi_ = false;
+	std::size_t stride_, outputs_;
+	std::size_t chunk_rows_ = 0;
+
+	std::vector<double> in_[2]; // chunk k is read into in_[k % 2]
+	std::size_t rows_[2] = {0, 0};
+	std::vector<double> out_;
+	std::vector<double> scratch_; // eval_batch lane stack
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::size_t produced_ = 0, consumed_ = 0; // chunks, guarded by mutex_
+	bool stop_ = false;
+
+	void init(std::size_t chunk_rows, std::size_t scratch_size) {
+		chunk_rows_ = std::max<std::size_t>(chunk_rows, 1);
+		for (std::vector<double> &b : in_) b.assign(chunk_rows_ * stride_, 0.0);
+		out_.assign(chunk_rows_ * outputs_, 0.0);
+		scratch_.assign(scratch_size, 0.0);
+	}
+
+	void eval_chunk(const double *records, std::size_t rows) {
+		if (multi_) m_.eval_batch(records, out_.data(), rows, scratch_.data());
+		else e_.eval_batch(records, out_.data(), rows, scratch_.data());
+	}
+
+	void halt(std::thread &reader) {
+		{
+			std::lock_guard<std::mutex> lk(mutex_);
+			stop_ = true;
+		}
+		cv_.notify_all();
+		reader.join();
+	}
+};
+
+} // namespace bbb
@@ -0,0 +1,253 @@
+// micro-benchmarks for the compiler and the evaluators over a fixed expression corpus.
+// prints one JSON object per line, so runs can be diffed and tracked over time:
+//   {"bench": "batch_hot", "corpus": "poly", "backend": "stack", "value": 1.234, "unit": "ns/row"}
+//
+// build from the repository root:
+//   g++ -std=c++17 -O2 -march=native -pthread -I. bench/bench.cpp -o bench_exprdsl
+// run:
+//   ./bench_exprdsl [--quick] [--filter <substring of bench/corpus/backend>]
+//
+// benchmarks:
+//   compile       ns per compile() through one reused compile_context
+//   scalar        ns per operator() call, each call's inputs depending on the previous
+//                 result (latency, not throughput), per backend: stack, reg, jit
+//   batch_hot     ns per row of eval_batch over 4096 rows that stay in cache
+//   batch_cold    ns per row of eval_batch over 64 MiB of columns (16 MiB with --quick),
+//                 caches flushed before every pass
+// each value is the median of several samples.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bbb/exprdsl.hpp"
+
+namespace {
+
+struct corpus_entry {
+	std::string name;
+	std::string src;
+};
+
+// nested (((x + 1) * y - 2) / ...) depth levels deep
+std::string deep_formula(int depth) {
+	static const char *ops[] = {" + ", " * ", " - ", " / "};
+	std::string s = "x";
+	for (int i = 0; i < depth; ++i) {
+		s = "(" + s + ops[i % 4] + (i % 3 == 0 ? "y" : std::to_string(1 + i % 7)) + ")";
+	}
+	return s;
+}
+
+// a sum of terms products of variables, constants and cheap calls, with a fixed seed
+std::string large_formula(int terms) {
+	static const char *vars[] = {"x", "y", "z", "w"};
+	static const char *funcs[] = {"sqrt(abs(", "sin(", "floor(", "min(1, "};
+	std::mt19937 rng(20240601);
+	std::string s;
+	for (int i = 0; i < terms; ++i) {
+		if (i) s += rng() % 2 ? " + " : " - ";
+		s += std::to_string(1 + rng() % 97) + " * " + vars[rng() % 4];
+		if (rng() % 3 == 0) {
+			const unsigned f = rng() % 4;
+			s += std::string(" * ") + funcs[f] + vars[rng() % 4] + (f == 0 ? "))" : ")");
+		}
+		if (rng() % 4 == 0) s += std::string(" * (") + vars[rng() % 4] + " > 0.5 ? 2 : 3)";
+	}
+	return s;
+}
+
+std::vector<corpus_entry> make_corpus() {
+	return {
+		{"poly", "((((3.5 * x + 2.25) * x - 1.5) * x + 0.75) * x - 0.125) * x + y"},
+		{"trig", "sin(x) * cos(y) + atan2(y, x) - exp(-abs(z)) * sqrt(x * x + y * y)"},
+		{"branchy", "x > 0.5 ? (y < 2 && z != 0 ? x * y : x / z) : (w > 1 || y > 3 ? w - y : x + w)"},
+		{"chain", "x > 0.1 && y > 0.2 && z > 0.3 && w > 0.4 && x < 0.9 && y < 0.8 || z + w > 1.5"},
+		{"cse", "sqrt(x * x + y * y) / (1 + sqrt(x * x + y * y)) + (x * x + y * y) * z"},
+		{"deep", deep_formula(200)},
+		{"large", large_formula(400)},
+	};
+}
+
+struct options {
+	bool quick = false;
+	std::string filter;
+};
+
+double now_ns() {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// median over samples of per-unit time; f(reps) runs reps units and returns nothing
+template <class F>
+double measure(const options &opt, F &&f) {
+	const double budget = opt.quick ? 2e6 : 2e7; // ns per sample
+	const int samples = opt.quick ? 3 : 7;
+	std::size_t reps = 1;
+	for (;;) { // calibrate: grow reps until a sample fills the budget
+		const double t0 = now_ns();
+		f(reps);
+		const double dt = now_ns() - t0;
+		if (dt >= budget || reps >= (std::size_t(1) << 40)) break;
+		reps = dt <= 0 ? reps * 16 : std::max(reps + 1, static_cast<std::size_t>(reps * budget / dt * 1.1));
+	}
+	std::vector<double> t(samples);
+	for (double &v : t) {
+		const double t0 = now_ns();
+		f(reps);
+		v = (now_ns() - t0) / static_cast<double>(reps);
+	}
+	std::nth_element(t.begin(), t.begin() + samples / 2, t.end());
+	return t[samples / 2];
+}
+
+void report(const char *bench, const std::string &corpus, const char *backend, double value, const char *unit) {
+	std::printf("{\"bench\": \"%s\", \"corpus\": \"%s\", \"backend\": \"%s\", \"value\": %.4g, \"unit\": \"%s\"}\n",
+	            bench, corpus.c_str(), backend, value, unit);
+	std::fflush(stdout);
+}
+
+bool selected(const options &opt, const char *bench, const std::string &corpus, const char *backend) {
+	if (opt.filter.empty()) return true;
+	return std::string(bench).find(opt.filter) != std::string::npos || corpus.find(opt.filter) != std::string::npos ||
+	       std::string(backend).find(opt.filter) != std::string::npos;
+}
+
+// keeps the optimizer from dropping a result
+volatile double sink;
+
+struct columns {
+	std::vector<double> x, y, z, w;
+	explicit columns(std::size_t n) : x(n), y(n), z(n), w(n) {
+		std::mt19937_64 rng(7);
+		std::uniform_real_distribution<double> u(0.0, 2.0);
+		for (std::size_t i = 0; i < n; ++i) {
+			x[i] = u(rng);
+			y[i] = u(rng);
+			z[i] = u(rng);
+			w[i] = u(rng);
+		}
+	}
+};
+
+void bench_compile(const options &opt, const corpus_entry &c) {
+	if (!selected(opt, "compile", c.name, "-")) return;
+	bbb::compile_context ctx;
+	const double ns = measure(opt, [&](std::size_t reps) {
+		for (std::size_t i = 0; i < reps; ++i) sink = static_cast<double>(bbb::compile(c.src, ctx).first.instruction_count());
+	});
+	report("compile", c.name, "-", ns, "ns/compile");
+}
+
+void bench_scalar(const options &opt, const corpus_entry &c, const columns &in) {
+	struct backend {
+		const char *name;
+		bbb::compile_options opts;
+	};
+	backend backends[3] = {{"stack", {}}, {"reg", {}}, {"jit", {}}};
+	backends[1].opts.backend = bbb::vm_backend::reg;
+	backends[2].opts.jit = true;
+	const std::size_t mask = 1023; // inputs from a table that stays in L1
+
+	for (const backend &b : backends) {
+		if (!selected(opt, "scalar", c.name, b.name)) continue;
+		auto [e, err] = bbb::compile(c.src, b.opts);
+		if (err) continue;
+		if (b.opts.jit && !e.native_function()) continue; // no JIT on this platform
+		const double ns = measure(opt, [&](std::size_t reps) {
+			double v = 0.0;
+			std::size_t i = 0;
+			for (std::size_t r = 0; r < reps; ++r) {
+				std::uint64_t bits;
+				std::memcpy(&bits, &v, sizeof bits);
+				i = (i + 1 + (bits & 1)) & mask; // the next row depends on this result
+				v = e(in.x[i], in.y[i], in.z[i], in.w[i]);
+			}
+			sink = v;
+		});
+		report("scalar", c.name, b.name, ns, "ns/call");
+	}
+}
+
+void bench_batch_hot(const options &opt, const corpus_entry &c, const columns &in) {
+	if (!selected(opt, "batch_hot", c.name, "stack")) return;
+	auto [e, err] = bbb::compile(c.src);
+	if (err) return;
+	const std::size_t n = 4096;
+	std::vector<double> out(n), scratch(e.batch_scratch_size());
+	const double ns = measure(opt, [&](std::size_t reps) {
+		for (std::size_t r = 0; r < reps; ++r) {
+			e.eval_batch(in.x.data(), in.y.data(), in.z.data(), in.w.data(), out.data(), n, scratch.data());
+		}
+		sink = out[n - 1];
+	});
+	report("batch_hot", c.name, "stack", ns / n, "ns/row");
+}
+
+void bench_batch_cold(const options &opt, const corpus_entry &c, const columns &big, std::vector<double> &flush) {
+	if (!selected(opt, "batch_cold", c.name, "stack")) return;
+	auto [e, err] = bbb::compile(c.src);
+	if (err) return;
+	const std::size_t n = big.x.size();
+	std::vector<double> out(n), scratch(e.batch_scratch_size());
+	const int samples = opt.quick ? 3 : 7;
+	std::vector<double> t(samples);
+	for (double &v : t) {
+		for (std::size_t i = 0; i < flush.size(); i += 8) flush[i] += 1.0; // evict the columns
+		const double t0 = now_ns();
+		e.eval_batch(big.x.data(), big.y.data(), big.z.data(), big.w.data(), out.data(), n, scratch.data());
+		v = (now_ns() - t0) / static_cast<double>(n);
+		sink = out[n - 1];
+	}
+	std::nth_element(t.begin(), t.begin() + samples / 2, t.end());
+	report("batch_cold", c.name, "stack", t[samples / 2], "ns/row");
+}
+
+const char *isa_name(bbb::simd_isa isa) {
+	switch (isa) {
+		case bbb::simd_isa::generic: return "generic";
+		case bbb::simd_isa::avx2: return "avx2";
+		case bbb::simd_isa::avx512: return "avx512";
+		case bbb::simd_isa::neon: return "neon";
+	}
+	return "?";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	options opt;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--quick") == 0) {
+			opt.quick = true;
+		} else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+			opt.filter = argv[++i];
+		} else {
+			std::fprintf(stderr, "usage: %s [--quick] [--filter <substring>]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	const bool jit = bbb::compile("x", [] { bbb::compile_options o; o.jit = true; return o; }()).first.native_function() != nullptr;
+	std::printf("{\"bench\": \"meta\", \"simd\": \"%s\", \"jit\": %s, \"batch_block\": %zu}\n",
+	            isa_name(bbb::active_simd_isa()), jit ? "true" : "false", bbb::compiled_expr::batch_block);
+
+	const std::vector<corpus_entry> corpus = make_corpus();
+	const columns hot(4096);
+	const std::size_t cold_rows = opt.quick ? (std::size_t(1) << 19) : (std::size_t(1) << 21); // 4 columns: 16 / 64 MiB
+	const columns cold(cold_rows);
+	std::vector<double> flush(opt.quick ? (std::size_t(1) << 22) : (std::size_t(1) << 24)); // 32 / 128 MiB
+
+	for (const corpus_entry &c : corpus) {
+		bench_compile(opt, c);
+		bench_scalar(opt, c, hot);
+		bench_batch_hot(opt, c, hot);
+		bench_batch_cold(opt, c, cold, flush);
+	}
+	return 0;
+}